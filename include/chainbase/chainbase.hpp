@@ -6,31 +6,41 @@
 #include <boost/interprocess/containers/flat_map.hpp>
 #include <boost/interprocess/containers/deque.hpp>
 #include <boost/interprocess/containers/string.hpp>
+#include <boost/interprocess/containers/vector.hpp>
 #include <boost/interprocess/allocators/allocator.hpp>
-#include <boost/interprocess/sync/interprocess_sharable_mutex.hpp>
-#include <boost/interprocess/sync/sharable_lock.hpp>
 #include <boost/interprocess/sync/file_lock.hpp>
 
 #include <boost/multi_index_container.hpp>
+#include <boost/mpl/size.hpp>
 
 #include <boost/chrono.hpp>
 #include <boost/config.hpp>
 #include <boost/filesystem.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/optional.hpp>
 #include <boost/thread.hpp>
 #include <boost/throw_exception.hpp>
 
 #include <array>
 #include <atomic>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <stdexcept>
+#include <thread>
 #include <typeindex>
 #include <typeinfo>
 
-#ifndef CHAINBASE_NUM_RW_LOCKS
-   #define CHAINBASE_NUM_RW_LOCKS 10
-#endif
+#include <chainbase/interleaved_find.hpp>
+#include <chainbase/key_compare.hpp>
+#include <chainbase/pooled_string.hpp>
+#include <chainbase/read_write_mutex.hpp>
+#include <chainbase/record_codec.hpp>
+#include <chainbase/trace.hpp>
+#include <chainbase/undo_arena.hpp>
 
 #ifdef CHAINBASE_CHECK_LOCKING
    #define CHAINBASE_REQUIRE_READ_LOCK(m, t) require_read_lock(m, typeid(t).name())
@@ -55,33 +65,48 @@ namespace chainbase {
    template<typename T>
    using shared_vector = std::vector<T, allocator<T> >;
 
+   /**
+    *  Orders strings by their bytes (length aware, so embedded nulls are significant).  For strings
+    *  without embedded nulls the order is the same as std::strcmp.
+    */
    struct strcmp_less
    {
       bool operator()( const shared_string& a, const shared_string& b )const
       {
-         return less( a.c_str(), b.c_str() );
+         return less( a.data(), a.size(), b.data(), b.size() );
       }
 
       bool operator()( const shared_string& a, const std::string& b )const
       {
-         return less( a.c_str(), b.c_str() );
+         return less( a.data(), a.size(), b.data(), b.size() );
       }
 
       bool operator()( const std::string& a, const shared_string& b )const
       {
-         return less( a.c_str(), b.c_str() );
+         return less( a.data(), a.size(), b.data(), b.size() );
+      }
+
+      bool operator()( const pooled_string& a, const pooled_string& b )const
+      {
+         return a < b;
+      }
+
+      bool operator()( const pooled_string& a, const std::string& b )const
+      {
+         return a < b;
+      }
+
+      bool operator()( const std::string& a, const pooled_string& b )const
+      {
+         return a < b;
       }
       private:
-         inline bool less( const char* a, const char* b )const
+         inline bool less( const char* a, size_t a_size, const char* b, size_t b_size )const
          {
-            return std::strcmp( a, b ) < 0;
+            return detail::compare_bytes( a, a_size, b, b_size ) < 0;
          }
    };
 
-   typedef boost::interprocess::interprocess_sharable_mutex read_write_mutex;
-   typedef boost::interprocess::sharable_lock< read_write_mutex > read_lock;
-   typedef boost::unique_lock< read_write_mutex > write_lock;
-
    /**
     *  Object ID type that includes the type of the object it references
     */
@@ -99,6 +124,64 @@ namespace chainbase {
          int64_t _id = 0;
    };
 
+   /**
+    *  Hash of an index key for key_filter.  Keys that compare equal hash equal: fixed width keys
+    *  hash their key_encoder bytes and all string types hash their contents, so a filter over a
+    *  pooled_string or shared_string key can be probed with a std::string.
+    */
+   template<typename Key, typename Enable = void>
+   struct key_filter_hash { static const bool supported = false; };
+
+   template<typename Key>
+   struct key_filter_hash< Key, typename std::enable_if< std::is_integral<Key>::value || std::is_enum<Key>::value >::type >
+   {
+      static const bool supported = true;
+      static uint64_t hash( const Key& k )
+      {
+         char bytes[ key_encoder<Key>::size ];
+         key_encoder<Key>::encode( k, bytes );
+         return detail::string_hash( bytes, sizeof(bytes) );
+      }
+   };
+
+   template<typename T>
+   struct key_filter_hash< oid<T> >
+   {
+      static const bool supported = true;
+      static uint64_t hash( const oid<T>& k ) { return key_filter_hash<int64_t>::hash( k._id ); }
+   };
+
+   template<size_t N>
+   struct key_filter_hash< normalized_key<N> >
+   {
+      static const bool supported = true;
+      static uint64_t hash( const normalized_key<N>& k ) { return detail::string_hash( k.data.data(), N ); }
+   };
+
+   template<typename String>
+   struct key_filter_hash< String, typename std::enable_if< std::is_same<String, std::string>::value ||
+                                                            std::is_same<String, shared_string>::value ||
+                                                            std::is_same<String, pooled_string>::value >::type >
+   {
+      static const bool supported = true;
+      static const bool is_string = true;
+      static uint64_t hash( const String& k ) { return detail::string_hash( k.data(), k.size() ); }
+   };
+
+   namespace detail {
+      template<typename Key, typename = void> struct is_string_key : std::false_type {};
+      template<typename Key> struct is_string_key< Key, typename std::enable_if< key_filter_hash<Key>::is_string >::type > : std::true_type {};
+   }
+
+   /**
+    *  True if a key_filter over keys of type Key can answer lookups by a Search key: either the same
+    *  hashable type, or two string types.
+    */
+   template<typename Key, typename Search>
+   struct key_filter_compatible : std::integral_constant< bool,
+      ( std::is_same<Key, Search>::value && key_filter_hash<Key>::supported ) ||
+      ( detail::is_string_key<Key>::value && detail::is_string_key<Search>::value ) > {};
+
    template<uint16_t TypeNumber, typename Derived>
    struct object
    {
@@ -122,28 +205,483 @@ namespace chainbase {
    template<typename Constructor, typename Allocator> \
    OBJECT_TYPE( Constructor&& c, Allocator&&  ) { c(*this); }
 
+   /**
+    *  The changes made to one index in one revision.  The tree nodes of the three containers are
+    *  allocated from the state's own undo_arena and returned to the segment all at once when the
+    *  state is destroyed (undone, committed or squashed into its predecessor) or packed.
+    */
    template< typename value_type >
    class undo_state
    {
       public:
-         typedef typename value_type::id_type                      id_type;
-         typedef allocator< std::pair<const id_type, value_type> > id_value_allocator_type;
-         typedef allocator< id_type >                              id_allocator_type;
+         typedef typename value_type::id_type                            id_type;
+         typedef arena_allocator< std::pair<const id_type, value_type> > id_value_allocator_type;
+         typedef arena_allocator< id_type >                              id_allocator_type;
 
          template<typename T>
          undo_state( allocator<T> al )
-         :old_values( id_value_allocator_type( al.get_segment_manager() ) ),
-          removed_values( id_value_allocator_type( al.get_segment_manager() ) ),
-          new_ids( id_allocator_type( al.get_segment_manager() ) ){}
+         :arena( al.get_segment_manager() ),
+          old_values( id_value_allocator_type( &arena ) ),
+          removed_values( id_value_allocator_type( &arena ) ),
+          new_ids( id_allocator_type( &arena ) ),
+          packed( allocator<char>( al.get_segment_manager() ) ){}
 
          typedef boost::interprocess::map< id_type, value_type, std::less<id_type>, id_value_allocator_type >  id_value_type_map;
          typedef boost::interprocess::set< id_type, std::less<id_type>, id_allocator_type >                    id_type_set;
 
+         undo_arena                   arena; ///< must outlive the containers below
          id_value_type_map            old_values;
          id_value_type_map            removed_values;
          id_type_set                  new_ids;
          id_type                      old_next_id = 0;
          int64_t                      revision = 0;
+
+         /// number of create/modify/remove calls made while this was the head revision
+         uint64_t                     creates = 0;
+         uint64_t                     modifies = 0;
+         uint64_t                     removes = 0;
+
+         /// the three containers above encoded by pack(), empty unless the state is packed
+         bip::vector< char, allocator<char> > packed;
+
+         bool is_packed()const { return !packed.empty(); }
+
+         /**
+          *  Replaces new_ids, old_values and removed_values by their encoding with record_encoder,
+          *  the saved values starting from dictionary (sizeof(value_type) bytes).  A packed state
+          *  must be unpack()ed with the same dictionary before it is undone, squashed or recorded to.
+          *  Only trivially copyable objects can be packed.
+          */
+         void pack( const char* dictionary ) {
+            static_assert( std::is_trivially_copyable<value_type>::value, "only trivially copyable objects can be packed" );
+            if( is_packed() || ( new_ids.empty() && old_values.empty() && removed_values.empty() ) ) return;
+
+            vector<char> out;
+            put_varint( out, new_ids.size() );
+            put_varint( out, old_values.size() );
+            put_varint( out, removed_values.size() );
+
+            record_encoder ids( sizeof(id_type) );
+            for( const auto& id : new_ids )
+               ids.put( reinterpret_cast<const char*>( &id ), out );
+
+            record_encoder values( sizeof(value_type), dictionary );
+            for( const auto& item : old_values )
+               values.put( reinterpret_cast<const char*>( &item.second ), out );
+            for( const auto& item : removed_values )
+               values.put( reinterpret_cast<const char*>( &item.second ), out );
+
+            new_ids.clear();
+            old_values.clear();
+            removed_values.clear();
+            arena.release();
+            packed.reserve( out.size() );
+            packed.assign( out.begin(), out.end() );
+         }
+
+         /** reverses pack(), a is passed to the constructor of the restored values */
+         template<typename Allocator>
+         void unpack( const char* dictionary, const Allocator& a ) {
+            if( !is_packed() ) return;
+
+            record_reader in( packed.data(), packed.size() );
+            const uint64_t new_count     = get_varint( in );
+            const uint64_t old_count     = get_varint( in );
+            const uint64_t removed_count = get_varint( in );
+
+            record_decoder ids( sizeof(id_type) );
+            for( uint64_t i = 0; i < new_count; ++i ) {
+               id_type id;
+               ids.get( in, reinterpret_cast<char*>( &id ) );
+               new_ids.insert( new_ids.end(), id );
+            }
+
+            record_decoder values( sizeof(value_type), dictionary );
+            for( uint64_t i = 0; i < old_count + removed_count; ++i ) {
+               value_type v( []( value_type& ){}, a );
+               values.get( in, reinterpret_cast<char*>( &v ) );
+               auto& target = i < old_count ? old_values : removed_values;
+               target.emplace_hint( target.end(), v.id, std::move( v ) );
+            }
+
+            packed.clear();
+            packed.shrink_to_fit();
+         }
+
+         /** number of new_ids, old_values and removed_values, also for a packed state */
+         std::array<uint64_t, 3> entry_counts()const {
+            if( !is_packed() ) return {{ new_ids.size(), old_values.size(), removed_values.size() }};
+            record_reader in( packed.data(), packed.size() );
+            std::array<uint64_t, 3> counts;
+            for( auto& c : counts ) c = get_varint( in );
+            return counts;
+         }
+
+         /** saves the value v had before its first modification in this revision */
+         void record_modify( const value_type& v ) {
+            ++modifies;
+
+            if( new_ids.find( v.id ) != new_ids.end() )
+               return;
+
+            auto itr = old_values.find( v.id );
+            if( itr != old_values.end() )
+               return;
+
+            old_values.emplace( std::pair< id_type, const value_type& >( v.id, v ) );
+         }
+
+         void record_remove( const value_type& v ) {
+            ++removes;
+            if( new_ids.count(v.id) ) {
+               new_ids.erase( v.id );
+               return;
+            }
+
+            auto itr = old_values.find( v.id );
+            if( itr != old_values.end() ) {
+               removed_values.emplace( std::move( *itr ) );
+               old_values.erase( v.id );
+               return;
+            }
+
+            if( removed_values.count( v.id ) )
+               return;
+
+            removed_values.emplace( std::pair< id_type, const value_type& >( v.id, v ) );
+         }
+
+         void record_create( const value_type& v ) {
+            ++creates;
+            new_ids.insert( v.id );
+         }
+   };
+
+   /**
+    *  Merges the changes recorded in state into prev_state so that undoing prev_state afterwards
+    *  restores everything to how it was before prev_state was started.  state is left in an
+    *  unspecified (moved from) condition and should be discarded.
+    */
+   template<typename UndoState>
+   void squash_undo_states( UndoState& prev_state, UndoState& state )
+   {
+      // An object's relationship to a state can be:
+      // in new_ids            : new
+      // in old_values (was=X) : upd(was=X)
+      // in removed (was=X)    : del(was=X)
+      // not in any of above   : nop
+      //
+      // When merging A=prev_state and B=state we have a 4x4 matrix of all possibilities:
+      //
+      //                   |--------------------- B ----------------------|
+      //
+      //                +------------+------------+------------+------------+
+      //                | new        | upd(was=Y) | del(was=Y) | nop        |
+      //   +------------+------------+------------+------------+------------+
+      // / | new        | N/A        | new       A| nop       C| new       A|
+      // | +------------+------------+------------+------------+------------+
+      // | | upd(was=X) | N/A        | upd(was=X)A| del(was=X)C| upd(was=X)A|
+      // A +------------+------------+------------+------------+------------+
+      // | | del(was=X) | N/A        | N/A        | N/A        | del(was=X)A|
+      // | +------------+------------+------------+------------+------------+
+      // \ | nop        | new       B| upd(was=Y)B| del(was=Y)B| nop      AB|
+      //   +------------+------------+------------+------------+------------+
+      //
+      // Each entry was composed by labelling what should occur in the given case.
+      //
+      // Type A means the composition of states contains the same entry as the first of the two merged states for that object.
+      // Type B means the composition of states contains the same entry as the second of the two merged states for that object.
+      // Type C means the composition of states contains an entry different from either of the merged states for that object.
+      // Type N/A means the composition of states violates causal timing.
+      // Type AB means both type A and type B simultaneously.
+      //
+      // The merge() operation is defined as modifying prev_state in-place to be the state object which represents the composition of
+      // state A and B.
+      //
+      // Type A (and AB) can be implemented as a no-op; prev_state already contains the correct value for the merged state.
+      // Type B (and AB) can be implemented by copying from state to prev_state.
+      // Type C needs special case-by-case logic.
+      // Type N/A can be ignored or assert(false) as it can only occur if prev_state and state have illegal values
+      // (a serious logic error which should never happen).
+      //
+
+      // We can only be outside type A/AB (the nop path) if B is not nop, so it suffices to iterate through B's three containers.
+
+      for( const auto& item : state.old_values )
+      {
+         if( prev_state.new_ids.find( item.second.id ) != prev_state.new_ids.end() )
+         {
+            // new+upd -> new, type A
+            continue;
+         }
+         if( prev_state.old_values.find( item.second.id ) != prev_state.old_values.end() )
+         {
+            // upd(was=X) + upd(was=Y) -> upd(was=X), type A
+            continue;
+         }
+         // del+upd -> N/A
+         assert( prev_state.removed_values.find(item.second.id) == prev_state.removed_values.end() );
+         // nop+upd(was=Y) -> upd(was=Y), type B
+         prev_state.old_values.emplace( std::move(item) );
+      }
+
+      // *+new, but we assume the N/A cases don't happen, leaving type B nop+new -> new
+      for( auto id : state.new_ids )
+         prev_state.new_ids.insert(id);
+
+      // *+del
+      for( auto& obj : state.removed_values )
+      {
+         if( prev_state.new_ids.find(obj.second.id) != prev_state.new_ids.end() )
+         {
+            // new + del -> nop (type C)
+            prev_state.new_ids.erase(obj.second.id);
+            continue;
+         }
+         auto it = prev_state.old_values.find(obj.second.id);
+         if( it != prev_state.old_values.end() )
+         {
+            // upd(was=X) + del(was=Y) -> del(was=X)
+            prev_state.removed_values.emplace( std::move(*it) );
+            prev_state.old_values.erase(obj.second.id);
+            continue;
+         }
+         // del + del -> N/A
+         assert( prev_state.removed_values.find( obj.second.id ) == prev_state.removed_values.end() );
+         // nop + del(was=Y) -> del(was=Y)
+         prev_state.removed_values.emplace( std::move(obj) ); //[obj.second->id] = std::move(obj.second);
+      }
+
+      prev_state.creates  += state.creates;
+      prev_state.modifies += state.modifies;
+      prev_state.removes  += state.removes;
+   }
+
+   /**
+    *  Merges every level of an undo stack newer than revision into the level of revision in one
+    *  pass.  The newer levels are folded into that level oldest first with squash_undo_states, so
+    *  each recorded entry is visited once and an id keeps the value of the oldest level that saved
+    *  it, where squashing the top two levels repeatedly would carry the merged entries up again and
+    *  again.  revision must not be older than the oldest level.
+    *
+    *  @return the number of levels removed
+    */
+   template<typename UndoStack>
+   size_t squash_undo_stack( UndoStack& stack, int64_t revision )
+   {
+      if( stack.empty() || revision >= stack.back().revision ) return 0;
+      if( revision < stack.front().revision )
+         BOOST_THROW_EXCEPTION( std::logic_error( "cannot squash into revision " + std::to_string( revision ) + ", the oldest undo level is " + std::to_string( stack.front().revision ) ) );
+
+      const size_t target = size_t( revision - stack.front().revision );
+      assert( stack[target].revision == revision );
+      for( size_t i = target + 1; i < stack.size(); ++i )
+         squash_undo_states( stack[target], stack[i] );
+
+      const size_t removed = stack.size() - target - 1;
+      while( stack.size() > target + 1 )
+         stack.pop_back();
+      return removed;
+   }
+
+   /**
+    *  Count, total and worst case duration (in nanoseconds) of a repeated operation
+    */
+   struct timing_stats
+   {
+      uint64_t count    = 0;
+      uint64_t total_ns = 0;
+      uint64_t max_ns   = 0;
+
+      void record( uint64_t ns )
+      {
+         ++count;
+         total_ns += ns;
+         if( ns > max_ns ) max_ns = ns;
+      }
+   };
+
+   /**
+    *  Adds the lifetime of this object to a timing_stats
+    */
+   class scoped_timer
+   {
+      public:
+         scoped_timer( timing_stats& t ):_stats(t),_start( detail::steady_now_ns() ){}
+         ~scoped_timer() { _stats.record( detail::steady_now_ns() - _start ); }
+
+      private:
+         timing_stats& _stats;
+         int64_t       _start;
+   };
+
+   /**
+    *  Cumulative counters kept by each generic_index.  They live in the shared segment next to the
+    *  index so any process that maps the database can read them.  All mutation happens under the
+    *  write lock, so plain integers are sufficient.
+    */
+   struct index_counters
+   {
+      uint64_t      creates = 0;
+      uint64_t      modifies = 0;
+      uint64_t      removes = 0;
+      uint64_t      in_place_restores = 0;  ///< values undo() copied back without relinking the object
+      timing_stats  undo_time;
+      timing_stats  squash_time;
+      timing_stats  commit_time;
+   };
+
+   /**
+    *  Size of one level of the undo stack.  Bytes are the memory held by the level itself (its arena
+    *  and packed form) and do not include memory owned by the saved values themselves.
+    */
+   struct undo_level_statistics
+   {
+      int64_t  revision = 0;
+      uint64_t new_ids = 0;
+      uint64_t old_values = 0;
+      uint64_t removed_values = 0;
+      uint64_t bytes = 0;
+      uint64_t packed_bytes = 0;  ///< size of the encoding if the level is packed, included in bytes
+      uint64_t arena_bytes = 0;   ///< memory held by the level's undo_arena, see undo_state
+      uint64_t creates = 0;
+      uint64_t modifies = 0;
+      uint64_t removes = 0;
+   };
+
+   /**
+    *  Point in time snapshot of the state of one index, see database::get_statistics()
+    */
+   struct index_statistics
+   {
+      uint32_t                         type_id = 0;
+      std::string                      type_name;
+      uint64_t                         object_count = 0;
+      uint64_t                         node_size = 0;
+      uint64_t                         node_bytes = 0;
+      int64_t                          revision = 0;
+      index_counters                   counters;
+      vector<undo_level_statistics>    undo_levels; ///< oldest first
+      uint64_t                         undo_entries = 0;
+      uint64_t                         undo_bytes = 0;
+   };
+
+   /**
+    *  Fills in the undo related fields of stats from an index's undo stack
+    */
+   template<typename UndoStack>
+   void get_undo_statistics( const UndoStack& stack, index_statistics& stats )
+   {
+      typedef typename UndoStack::value_type                             undo_state_type;
+
+      stats.undo_levels.clear();
+      stats.undo_levels.reserve( stack.size() );
+      stats.undo_entries = 0;
+      stats.undo_bytes   = 0;
+
+      for( const auto& state : stack ) {
+         undo_level_statistics level;
+         level.revision       = state.revision;
+         level.new_ids        = state.new_ids.size();
+         level.old_values     = state.old_values.size();
+         level.removed_values = state.removed_values.size();
+         level.arena_bytes    = state.arena.reserved_bytes();
+         level.bytes          = sizeof(undo_state_type) + level.arena_bytes;
+         if( state.is_packed() ) {
+            const auto counts    = state.entry_counts();
+            level.new_ids        = counts[0];
+            level.old_values     = counts[1];
+            level.removed_values = counts[2];
+            level.packed_bytes   = state.packed.capacity();
+            level.bytes         += level.packed_bytes;
+         }
+         level.creates        = state.creates;
+         level.modifies       = state.modifies;
+         level.removes        = state.removes;
+
+         stats.undo_entries += level.new_ids + level.old_values + level.removed_values;
+         stats.undo_bytes   += level.bytes;
+         stats.undo_levels.push_back( level );
+      }
+   }
+
+   /**
+    *  Memory used by one index, see database::get_memory_report()
+    */
+   struct index_memory_usage
+   {
+      uint32_t     type_id = 0;
+      std::string  type_name;
+      uint64_t     object_count = 0;
+      uint64_t     live_bytes = 0;   ///< multi_index nodes, excluding memory owned by the objects
+      uint64_t     undo_bytes = 0;
+      bool         own_segment = false;  ///< true if the table was added with its own segment file
+      uint64_t     segment_size = 0;     ///< size of that file, 0 for tables in shared_memory.bin
+      uint64_t     segment_free_bytes = 0;
+   };
+
+   /**
+    *  Describes how fragmented the free space of the segment is.
+    *
+    *  free_block_histogram[i] counts free blocks of at least 2^i bytes and less than 2^(i+1) bytes.
+    *  Only blocks of at least min_block_size are enumerated, free memory held in smaller fragments is
+    *  reported as small_fragment_bytes.
+    */
+   struct segment_memory_report
+   {
+      uint64_t                      segment_size = 0;
+      uint64_t                      free_bytes = 0;
+      uint64_t                      largest_free_block = 0;
+      uint64_t                      min_block_size = 0;
+      vector<uint64_t>              free_block_histogram;
+      uint64_t                      small_fragment_bytes = 0;
+      vector<index_memory_usage>    indices;
+   };
+
+   /**
+    *  Undo session of a single index, returned by start_undo_session().  Unless push()ed or
+    *  squash()ed the changes made since it was started are undone when it goes out of scope.
+    */
+   template<typename Index>
+   class undo_session {
+      public:
+         undo_session( undo_session&& mv )
+         :_index(mv._index),_apply(mv._apply){ mv._apply = false; }
+
+         ~undo_session() {
+            if( _apply ) {
+               _index.undo();
+            }
+         }
+
+         /** leaves the UNDO state on the stack when session goes out of scope */
+         void push()   { _apply = false; }
+         /** combines this session with the prior session */
+         void squash() { if( _apply ) _index.squash(); _apply = false; }
+         void undo()   { if( _apply ) _index.undo();  _apply = false; }
+
+         undo_session& operator = ( undo_session&& mv ) {
+            if( this == &mv ) return *this;
+            if( _apply ) _index.undo();
+            _apply = mv._apply;
+            mv._apply = false;
+            return *this;
+         }
+
+         int64_t revision()const { return _revision; }
+
+      private:
+         friend Index;
+
+         undo_session( Index& idx, int64_t revision )
+         :_index(idx),_revision(revision) {
+            if( revision == -1 )
+               _apply = false;
+         }
+
+         Index&         _index;
+         bool           _apply = true;
+         int64_t        _revision = 0;
    };
 
    /**
@@ -169,6 +707,175 @@ namespace chainbase {
          int32_t& _target;
    };
 
+   namespace detail {
+      /**
+       *  Runs f( part ) for every part in [0, parts), part 0 on the calling thread and the others on
+       *  threads of their own, and waits for all of them.  The first exception thrown by any part is
+       *  rethrown once every thread has finished.
+       */
+      template<typename F>
+      void run_parallel( uint32_t parts, F&& f )
+      {
+         vector<std::exception_ptr> errors( parts );
+         vector<std::thread>        workers;
+         auto run = [&f, &errors]( uint32_t p ) {
+            try { f( p ); } catch( ... ) { errors[p] = std::current_exception(); }
+         };
+         for( uint32_t p = 1; p < parts; ++p )
+            workers.emplace_back( run, p );
+         if( parts ) run( 0 );
+         for( auto& w : workers ) w.join();
+         for( auto& e : errors )
+            if( e ) std::rethrow_exception( e );
+      }
+
+      template<typename Index>
+      auto any_object( const Index& idx, const std::function<bool( const void* )>& in, int ) -> decltype( idx.indices().begin(), bool() )
+      {
+         for( const auto& obj : idx.indices() )
+            if( in( &obj ) ) return true;
+         return false;
+      }
+
+      /** table types that cannot list their objects are assumed to have some everywhere */
+      template<typename Index>
+      bool any_object( const Index&, const std::function<bool( const void* )>&, long ) { return true; }
+
+      /** true if a and b have equivalent keys in the ordered index idx */
+      template<typename Index, typename Value>
+      auto same_key( const Index& idx, const Value& a, const Value& b, int ) -> decltype( idx.key_comp(), bool() )
+      {
+         const auto& key = idx.key_extractor();
+         return !idx.key_comp()( key( a ), key( b ) ) && !idx.key_comp()( key( b ), key( a ) );
+      }
+
+      /** true if a and b have equal keys in the hashed index idx */
+      template<typename Index, typename Value>
+      auto same_key( const Index& idx, const Value& a, const Value& b, int ) -> decltype( idx.key_eq(), bool() )
+      {
+         const auto& key = idx.key_extractor();
+         return idx.key_eq()( key( a ), key( b ) );
+      }
+
+      /** sequenced and random access indices have no keys */
+      template<typename Index, typename Value>
+      bool same_key( const Index&, const Value&, const Value&, ... ) { return true; }
+
+      /** true if a and b have the same keys in every index of a multi_index_container, from the N-th on */
+      template<size_t N, typename MultiIndexType>
+      typename std::enable_if< N == boost::mpl::size<typename MultiIndexType::index_type_list>::value, bool >::type
+      same_keys( const MultiIndexType&, const typename MultiIndexType::value_type&, const typename MultiIndexType::value_type& )
+      {
+         return true;
+      }
+
+      template<size_t N, typename MultiIndexType>
+      typename std::enable_if< N < boost::mpl::size<typename MultiIndexType::index_type_list>::value, bool >::type
+      same_keys( const MultiIndexType& indices, const typename MultiIndexType::value_type& a, const typename MultiIndexType::value_type& b )
+      {
+         return same_key( indices.template get<N>(), a, b, 0 ) && same_keys<N + 1>( indices, a, b );
+      }
+   }
+
+   /**
+    *  Count, sum, minimum and maximum of the values passed to add().  Sum is the type used to
+    *  accumulate the sum so that it can be wider than T.
+    */
+   template<typename T, typename Sum = T>
+   struct aggregate_result
+   {
+      uint64_t count = 0;
+      Sum      sum   = Sum();
+      T        min   = T();
+      T        max   = T();
+
+      void add( const T& v )
+      {
+         if( !count || v < min ) min = v;
+         if( !count || max < v ) max = v;
+         sum += v;
+         ++count;
+      }
+
+      /** merges the result of another, disjoint, part of the range */
+      aggregate_result& operator += ( const aggregate_result& o )
+      {
+         if( !o.count ) return *this;
+         if( !count || o.min < min ) min = o.min;
+         if( !count || max < o.max ) max = o.max;
+         sum += o.sum;
+         count += o.count;
+         return *this;
+      }
+   };
+
+   namespace detail {
+
+      template<typename Id>
+      struct id_list
+      {
+         vector<Id> ids;
+         id_list& operator += ( const id_list& o ) { ids.insert( ids.end(), o.ids.begin(), o.ids.end() ); return *this; }
+      };
+
+   } // namespace detail
+
+   /**
+    *  Position of a chunked scan over one ordered index of a generic_index, see generic_index::scan().
+    *
+    *  The cursor remembers the id and key of the next object to visit instead of an iterator, so it
+    *  stays usable after the read lock is released between chunks.  If that object is modified or
+    *  removed in between, the scan resumes at the first object not less than the remembered key, so
+    *  objects with a key equal to it may be visited again on non-unique indices.
+    */
+   template<typename OrderedIndex>
+   class index_cursor
+   {
+      public:
+         typedef typename OrderedIndex::key_type key_type;
+
+         /** scans the whole index */
+         index_cursor(){}
+         /** scans [lower, end) */
+         explicit index_cursor( const key_type& lower ):_lower( lower ){}
+         /** scans [lower, upper) */
+         index_cursor( const key_type& lower, const key_type& upper ):_lower( lower ),_upper( upper ){}
+
+         bool done()const { return _done; }
+
+      private:
+         template<typename> friend class generic_index;
+
+         boost::optional<key_type>  _lower;
+         boost::optional<key_type>  _upper;
+         boost::optional<key_type>  _next_key;
+         int64_t                    _next_id = 0;
+         bool                       _done = false;
+   };
+
+   /**
+    *  Receives every change made to the objects of a generic_index, including the changes made by
+    *  undo.  Observers are owned by the process that registered them and are never shared with
+    *  other processes, see generic_index::add_observer().
+    */
+   template<typename Object>
+   class index_observer
+   {
+      public:
+         virtual ~index_observer(){}
+
+         virtual void on_create( const Object& obj ) = 0;
+         /** called with the object as it is before a modification */
+         virtual void on_modifying( const Object& obj ) = 0;
+         /** called with the object as it is after a successful modification */
+         virtual void on_modified( const Object& obj ) = 0;
+         virtual void on_remove( const Object& obj ) = 0;
+
+      private:
+         template<typename> friend class generic_index;
+         index_observer* _next_observer = nullptr;
+   };
+
    /**
     *  The value_type stored in the multiindex container must have a integer field with the name 'id'.  This will
     *  be the primary key and it will be assigned and managed by generic_index.
@@ -186,7 +893,8 @@ namespace chainbase {
          typedef undo_state< value_type >                              undo_state_type;
 
          generic_index( allocator<value_type> a )
-         :_stack(a),_indices( a ),_size_of_value_type( sizeof(typename MultiIndexType::node_type) ),_size_of_this(sizeof(*this)){}
+         :_stack(a),_indices( a ),_size_of_value_type( sizeof(typename MultiIndexType::node_type) ),_size_of_this(sizeof(*this)),
+          _undo_dictionary( allocator<char>( a ) ){}
 
          void validate()const {
             if( sizeof(typename MultiIndexType::node_type) != _size_of_value_type || sizeof(*this) != _size_of_this )
@@ -213,19 +921,54 @@ namespace chainbase {
             }
 
             ++_next_id;
+            ++_counters.creates;
             on_create( *insert_result.first );
+            notify( [&]( index_observer<value_type>& o ) { o.on_create( *insert_result.first ); } );
             return *insert_result.first;
          }
 
          template<typename Modifier>
          void modify( const value_type& obj, Modifier&& m ) {
+            ++_counters.modifies;
             on_modify( obj );
+            notify( [&]( index_observer<value_type>& o ) { o.on_modifying( obj ); } );
             auto ok = _indices.modify( _indices.iterator_to( obj ), m );
             if( !ok ) BOOST_THROW_EXCEPTION( std::logic_error( "Could not modify object, most likely a uniqueness constraint was violated" ) );
+            notify( [&]( index_observer<value_type>& o ) { o.on_modified( obj ); } );
+         }
+
+         /**
+          *  Like modify(), for changes that leave every key of obj as it was, such as balances and
+          *  counters no index is ordered by.  The change is recorded for undo and reported to observers
+          *  as usual, but obj is changed in place, without the multi_index_container checking and
+          *  relinking it in each of its indices.  Changing a key this way corrupts the indices, so
+          *  builds without NDEBUG compare the keys of every index before and after m and, if one
+          *  changed, put obj back as it was and throw.
+          */
+         template<typename Modifier>
+         void modify_fields( const value_type& obj, Modifier&& m ) {
+            ++_counters.modifies;
+            on_modify( obj );
+            notify( [&]( index_observer<value_type>& o ) { o.on_modifying( obj ); } );
+            auto& target = const_cast<value_type&>( obj );
+#ifndef NDEBUG
+            value_type before( obj );
+            m( target );
+            if( !detail::same_keys<0>( _indices, before, obj ) ) {
+               target = std::move( before );
+               notify( [&]( index_observer<value_type>& o ) { o.on_modified( obj ); } );
+               BOOST_THROW_EXCEPTION( std::logic_error( "modify_fields changed a key of the object, use modify" ) );
+            }
+#else
+            m( target );
+#endif
+            notify( [&]( index_observer<value_type>& o ) { o.on_modified( obj ); } );
          }
 
          void remove( const value_type& obj ) {
+            ++_counters.removes;
             on_remove( obj );
+            notify( [&]( index_observer<value_type>& o ) { o.on_remove( obj ); } );
             _indices.erase( _indices.iterator_to( obj ) );
          }
 
@@ -245,61 +988,183 @@ namespace chainbase {
 
          const index_type& indices()const { return _indices; }
 
-         class session {
-            public:
-               session( session&& mv )
-               :_index(mv._index),_apply(mv._apply){ mv._apply = false; }
-
-               ~session() {
-                  if( _apply ) {
-                     _index.undo();
-                  }
-               }
-
-               /** leaves the UNDO state on the stack when session goes out of scope */
-               void push()   { _apply = false; }
-               /** combines this session with the prior session */
-               void squash() { if( _apply ) _index.squash(); _apply = false; }
-               void undo()   { if( _apply ) _index.undo();  _apply = false; }
-
-               session& operator = ( session&& mv ) {
-                  if( this == &mv ) return *this;
-                  if( _apply ) _index.undo();
-                  _apply = mv._apply;
-                  mv._apply = false;
-                  return *this;
-               }
-
-               int64_t revision()const { return _revision; }
-
-            private:
-               friend class generic_index;
-
-               session( generic_index& idx, int64_t revision )
-               :_index(idx),_revision(revision) {
-                  if( revision == -1 )
-                     _apply = false;
-               }
-
-               generic_index& _index;
-               bool           _apply = true;
-               int64_t        _revision = 0;
-         };
+         typedef undo_session< generic_index > session;
 
          session start_undo_session( bool enabled ) {
             if( enabled ) {
                _stack.emplace_back( _indices.get_allocator() );
                _stack.back().old_next_id = _next_id;
                _stack.back().revision = ++_revision;
+               if( _undo_pack_depth && _stack.size() > _undo_pack_depth )
+                  pack_level( _stack[ _stack.size() - 1 - _undo_pack_depth ] );
                return session( *this, _revision );
             } else {
                return session( *this, -1 );
             }
          }
 
+         /**
+          *  Keeps only the depth most recent undo levels as trees of saved objects and packs the older
+          *  ones with record_encoder, against a dictionary object kept with the index.  A packed level
+          *  is unpacked when undo() makes it the head again or squash() merges into it, commit() drops
+          *  it without unpacking.  0 (the default) stops packing new levels.  Only indices of trivially
+          *  copyable objects can be packed.
+          */
+         void set_undo_pack_depth( uint32_t depth )
+         {
+            if( depth && !std::is_trivially_copyable<value_type>::value )
+               BOOST_THROW_EXCEPTION( std::logic_error( "undo levels can only be packed for trivially copyable objects" ) );
+            _undo_pack_depth = depth;
+            for( size_t i = 0; depth && i + depth < _stack.size(); ++i )
+               pack_level( _stack[i] );
+         }
+
+         uint32_t undo_pack_depth()const { return _undo_pack_depth; }
+
          const index_type& indicies()const { return _indices; }
          int64_t revision()const { return _revision; }
 
+         template<typename Tag>
+         using cursor = index_cursor< typename index_type::template index<Tag>::type >;
+
+         /**
+          *  Visits up to max_items objects of the index tagged Tag in order, starting where cursor left
+          *  off.  Callers bound the time the read lock is held by scanning in chunks and releasing the
+          *  lock in between (see database::read_in_chunks).
+          *
+          *  @return true once the end of the cursor's range has been reached
+          */
+         template<typename Tag, typename Visitor>
+         bool scan( cursor<Tag>& c, size_t max_items, Visitor&& visit )const
+         {
+            if( c._done ) return true;
+
+            const auto& idx = _indices.template get<Tag>();
+            const auto  key = idx.key_extractor();
+
+            auto itr = cursor_begin<Tag>( c );
+            const auto end = c._upper ? idx.lower_bound( *c._upper ) : idx.end();
+
+            for( size_t n = 0; itr != end && n < max_items; ++itr, ++n )
+               visit( *itr );
+
+            if( itr == end ) {
+               c._done = true;
+            } else {
+               c._next_key = key( *itr );
+               c._next_id  = itr->id._id;
+            }
+            return c._done;
+         }
+
+         /**
+          *  Adds field( obj ) of every object accepted by pred to result, scanning up to max_items
+          *  objects from cursor.
+          *
+          *  @return true once the end of the cursor's range has been reached
+          */
+         template<typename Tag, typename Field, typename Predicate, typename T, typename Sum>
+         bool aggregate( cursor<Tag>& c, size_t max_items, Field&& field, Predicate&& pred, aggregate_result<T, Sum>& result )const
+         {
+            return scan<Tag>( c, max_items, [&]( const value_type& obj ) {
+               if( pred( obj ) ) result.add( field( obj ) );
+            });
+         }
+
+         /**
+          *  Appends the ids of the objects accepted by pred to ids, scanning up to max_items objects
+          *
+          *  @return true once the end of the cursor's range has been reached
+          */
+         template<typename Tag, typename Predicate>
+         bool select_ids( cursor<Tag>& c, size_t max_items, Predicate&& pred, vector<typename value_type::id_type>& ids )const
+         {
+            return scan<Tag>( c, max_items, [&]( const value_type& obj ) {
+               if( pred( obj ) ) ids.push_back( obj.id );
+            });
+         }
+
+         /**
+          *  Like aggregate(), but visits everything that is left of the cursor's range in one call,
+          *  split across up to threads threads at split_points() that fall inside the range.  Ranges
+          *  holding fewer than about 1/16 of the index per thread get fewer threads, down to running
+          *  on the calling thread.  The read lock is held for the whole range, so this is for ranges
+          *  worth the threads rather than for read_in_chunks().
+          */
+         template<typename Tag, typename Field, typename Predicate, typename T, typename Sum>
+         void parallel_aggregate( cursor<Tag>& c, uint32_t threads, Field&& field, Predicate&& pred, aggregate_result<T, Sum>& result )const
+         {
+            result += parallel_range<Tag, aggregate_result<T, Sum>>( c, threads, [&]( const value_type& obj, aggregate_result<T, Sum>& r ) {
+               if( pred( obj ) ) r.add( field( obj ) );
+            });
+         }
+
+         /** select_ids() over the rest of the cursor's range in one call, see parallel_aggregate() */
+         template<typename Tag, typename Predicate>
+         void parallel_select_ids( cursor<Tag>& c, uint32_t threads, Predicate&& pred, vector<typename value_type::id_type>& ids )const
+         {
+            typedef detail::id_list<typename value_type::id_type> result_type;
+            auto selected = parallel_range<Tag, result_type>( c, threads, [&]( const value_type& obj, result_type& r ) {
+               if( pred( obj ) ) r.ids.push_back( obj.id );
+            });
+            ids.insert( ids.end(), selected.ids.begin(), selected.ids.end() );
+         }
+
+         /**
+          *  Returns up to parts - 1 increasing keys of the index tagged Tag that split it into parts
+          *  ranges of roughly equal size: [begin, k0), [k0, k1), ... [kn, end).
+          *
+          *  The tree keeps no subtree sizes, so the keys are quantiles of a sample of objects taken at
+          *  evenly spaced ids through the primary index.  The result is only as even as ids are dense,
+          *  which holds for tables that are mostly appended to.
+          */
+         template<typename Tag>
+         vector<typename cursor<Tag>::key_type> split_points( uint32_t parts, uint32_t samples_per_part = 64 )const
+         {
+            typedef typename cursor<Tag>::key_type key_type;
+            vector<key_type> result;
+            if( parts < 2 || _indices.empty() ) return result;
+
+            const auto& idx = _indices.template get<Tag>();
+            const auto  key = idx.key_extractor();
+            const auto  cmp = idx.key_comp();
+
+            const int64_t first = _indices.begin()->id._id;
+            const int64_t last  = _indices.rbegin()->id._id;
+            const size_t  count = std::min<size_t>( size_t( parts ) * samples_per_part, _indices.size() );
+
+            vector<key_type> sample;
+            sample.reserve( count );
+            for( size_t i = 0; i < count; ++i ) {
+               auto itr = _indices.lower_bound( typename value_type::id_type( first + int64_t( ( last - first ) * double( i ) / count ) ) );
+               sample.push_back( key( *itr ) );
+            }
+            std::sort( sample.begin(), sample.end(), cmp );
+
+            for( uint32_t p = 1; p < parts; ++p ) {
+               const auto& k = sample[ sample.size() * p / parts ];
+               if( result.empty() || cmp( result.back(), k ) ) result.push_back( k );
+            }
+            return result;
+         }
+
+         /**
+          *  Visits every object of the index tagged Tag using up to threads threads, each one walking
+          *  one of the ranges returned by split_points().  visit( obj, result ) accumulates into a
+          *  Result owned by its range, and the per range results are merged with += in key order, so
+          *  the outcome is the same as one sequential pass for any merge that is associative.
+          *
+          *  The caller must hold the read lock (or be the only writer) for the duration of the call;
+          *  visit must not modify the database.
+          */
+         template<typename Tag, typename Result, typename Visitor>
+         Result parallel_scan( uint32_t threads, Visitor&& visit, uint32_t min_objects_per_thread = 4096 )const
+         {
+            threads = uint32_t( std::max<size_t>( 1, std::min<size_t>( threads, _indices.size() / std::max<uint32_t>( min_objects_per_thread, 1 ) ) ) );
+            cursor<Tag> all;
+            return parallel_range<Tag, Result>( all, threads, std::forward<Visitor>( visit ) );
+         }
+
 
          /**
           *  Restores the state to how it was prior to the current session discarding all changes
@@ -307,29 +1172,34 @@ namespace chainbase {
           */
          void undo() {
             if( !enabled() ) return;
+            scoped_timer timer( _counters.undo_time );
 
             const auto& head = _stack.back();
 
             for( auto& item : head.old_values ) {
-               auto ok = _indices.modify( _indices.find( item.second.id ), [&]( value_type& v ) {
-                  v = std::move( item.second );
-               });
-               if( !ok ) BOOST_THROW_EXCEPTION( std::logic_error( "Could not modify object, most likely a uniqueness constraint was violated" ) );
+               auto itr = _indices.find( item.second.id );
+               notify( [&]( index_observer<value_type>& o ) { o.on_modifying( *itr ); } );
+               restore( itr, item.second, packable() );
+               notify( [&]( index_observer<value_type>& o ) { o.on_modified( *itr ); } );
             }
 
             for( auto id : head.new_ids )
             {
-               _indices.erase( _indices.find( id ) );
+               auto itr = _indices.find( id );
+               notify( [&]( index_observer<value_type>& o ) { o.on_remove( *itr ); } );
+               _indices.erase( itr );
             }
             _next_id = head.old_next_id;
 
             for( auto& item : head.removed_values ) {
-               bool ok = _indices.emplace( std::move( item.second ) ).second;
-               if( !ok ) BOOST_THROW_EXCEPTION( std::logic_error( "Could not restore object, most likely a uniqueness constraint was violated" ) );
+               auto insert_result = _indices.emplace( std::move( item.second ) );
+               if( !insert_result.second ) BOOST_THROW_EXCEPTION( std::logic_error( "Could not restore object, most likely a uniqueness constraint was violated" ) );
+               notify( [&]( index_observer<value_type>& o ) { o.on_create( *insert_result.first ); } );
             }
 
             _stack.pop_back();
             --_revision;
+            if( enabled() ) unpack_level( _stack.back() );
          }
 
          /**
@@ -341,110 +1211,40 @@ namespace chainbase {
          void squash()
          {
             if( !enabled() ) return;
+            scoped_timer timer( _counters.squash_time );
             if( _stack.size() == 1 ) {
                _stack.pop_front();
                return;
             }
 
-            auto& state = _stack.back();
-            auto& prev_state = _stack[_stack.size()-2];
-
-            // An object's relationship to a state can be:
-            // in new_ids            : new
-            // in old_values (was=X) : upd(was=X)
-            // in removed (was=X)    : del(was=X)
-            // not in any of above   : nop
-            //
-            // When merging A=prev_state and B=state we have a 4x4 matrix of all possibilities:
-            //
-            //                   |--------------------- B ----------------------|
-            //
-            //                +------------+------------+------------+------------+
-            //                | new        | upd(was=Y) | del(was=Y) | nop        |
-            //   +------------+------------+------------+------------+------------+
-            // / | new        | N/A        | new       A| nop       C| new       A|
-            // | +------------+------------+------------+------------+------------+
-            // | | upd(was=X) | N/A        | upd(was=X)A| del(was=X)C| upd(was=X)A|
-            // A +------------+------------+------------+------------+------------+
-            // | | del(was=X) | N/A        | N/A        | N/A        | del(was=X)A|
-            // | +------------+------------+------------+------------+------------+
-            // \ | nop        | new       B| upd(was=Y)B| del(was=Y)B| nop      AB|
-            //   +------------+------------+------------+------------+------------+
-            //
-            // Each entry was composed by labelling what should occur in the given case.
-            //
-            // Type A means the composition of states contains the same entry as the first of the two merged states for that object.
-            // Type B means the composition of states contains the same entry as the second of the two merged states for that object.
-            // Type C means the composition of states contains an entry different from either of the merged states for that object.
-            // Type N/A means the composition of states violates causal timing.
-            // Type AB means both type A and type B simultaneously.
-            //
-            // The merge() operation is defined as modifying prev_state in-place to be the state object which represents the composition of
-            // state A and B.
-            //
-            // Type A (and AB) can be implemented as a no-op; prev_state already contains the correct value for the merged state.
-            // Type B (and AB) can be implemented by copying from state to prev_state.
-            // Type C needs special case-by-case logic.
-            // Type N/A can be ignored or assert(false) as it can only occur if prev_state and state have illegal values
-            // (a serious logic error which should never happen).
-            //
-
-            // We can only be outside type A/AB (the nop path) if B is not nop, so it suffices to iterate through B's three containers.
-
-            for( const auto& item : state.old_values )
-            {
-               if( prev_state.new_ids.find( item.second.id ) != prev_state.new_ids.end() )
-               {
-                  // new+upd -> new, type A
-                  continue;
-               }
-               if( prev_state.old_values.find( item.second.id ) != prev_state.old_values.end() )
-               {
-                  // upd(was=X) + upd(was=Y) -> upd(was=X), type A
-                  continue;
-               }
-               // del+upd -> N/A
-               assert( prev_state.removed_values.find(item.second.id) == prev_state.removed_values.end() );
-               // nop+upd(was=Y) -> upd(was=Y), type B
-               prev_state.old_values.emplace( std::move(item) );
-            }
-
-            // *+new, but we assume the N/A cases don't happen, leaving type B nop+new -> new
-            for( auto id : state.new_ids )
-               prev_state.new_ids.insert(id);
-
-            // *+del
-            for( auto& obj : state.removed_values )
-            {
-               if( prev_state.new_ids.find(obj.second.id) != prev_state.new_ids.end() )
-               {
-                  // new + del -> nop (type C)
-                  prev_state.new_ids.erase(obj.second.id);
-                  continue;
-               }
-               auto it = prev_state.old_values.find(obj.second.id);
-               if( it != prev_state.old_values.end() )
-               {
-                  // upd(was=X) + del(was=Y) -> del(was=X)
-                  prev_state.removed_values.emplace( std::move(*it) );
-                  prev_state.old_values.erase(obj.second.id);
-                  continue;
-               }
-               // del + del -> N/A
-               assert( prev_state.removed_values.find( obj.second.id ) == prev_state.removed_values.end() );
-               // nop + del(was=Y) -> del(was=Y)
-               prev_state.removed_values.emplace( std::move(obj) ); //[obj.second->id] = std::move(obj.second);
-            }
+            unpack_level( _stack[_stack.size()-2] );
+            squash_undo_states( _stack[_stack.size()-2], _stack.back() );
 
             _stack.pop_back();
             --_revision;
          }
 
+         /**
+          *  Merges every revision after revision into it in one pass, leaving revision as the head;
+          *  the same result as squash() called revision() - revision times.  See squash_undo_stack().
+          */
+         void squash_to( int64_t revision )
+         {
+            if( !enabled() || revision >= _revision ) return;
+            scoped_timer timer( _counters.squash_time );
+            if( revision >= _stack.front().revision )
+               for( size_t i = size_t( revision - _stack.front().revision ); i < _stack.size(); ++i )
+                  unpack_level( _stack[i] );
+            squash_undo_stack( _stack, revision );
+            _revision = revision;
+         }
+
          /**
           * Discards all undo history prior to revision
           */
          void commit( int64_t revision )
          {
+            scoped_timer timer( _counters.commit_time );
             while( _stack.size() && _stack[0].revision <= revision )
             {
                _stack.pop_front();
@@ -473,51 +1273,205 @@ namespace chainbase {
             remove( *val );
          }
 
+         const index_counters& counters()const { return _counters; }
+
+         /**
+          *  Registers an observer that is told about every later change to this index.  Observers
+          *  are process local: the pointers are only meaningful to the process that registered them,
+          *  database::add_index() discards any left over from a previous process.
+          */
+         void add_observer( index_observer<value_type>& o )
+         {
+            o._next_observer = _observers;
+            _observers = &o;
+         }
+
+         void remove_observer( index_observer<value_type>& o )
+         {
+            for( auto p = &_observers; *p; p = &(*p)->_next_observer ) {
+               if( *p == &o ) {
+                  *p = o._next_observer;
+                  o._next_observer = nullptr;
+                  return;
+               }
+            }
+         }
+
+         void clear_observers() { _observers = nullptr; }
+
+         /**
+          *  Number of object level changes ever made to this index, including those made by undo.
+          *  Structures derived from the index record it to detect changes they did not observe.
+          */
+         uint64_t change_count()const { return _change_count; }
+
+         /**
+          *  Copies every object of other into this (empty) index in primary key order, so the nodes end
+          *  up allocated contiguously in id order.  Undo history cannot be carried across segments, so
+          *  other must not have any.
+          */
+         void copy_from( const generic_index& other )
+         {
+            if( other._stack.size() )
+               BOOST_THROW_EXCEPTION( std::logic_error( "cannot copy an index with undo history, commit it first" ) );
+            if( _indices.size() || _stack.size() )
+               BOOST_THROW_EXCEPTION( std::logic_error( "can only copy into an empty index" ) );
+
+            for( const auto& obj : other._indices ) {
+               auto insert_result = _indices.emplace( [&]( value_type& v ) { v = obj; }, _indices.get_allocator() );
+               if( !insert_result.second )
+                  BOOST_THROW_EXCEPTION( std::logic_error( "could not copy object, most likely a uniqueness constraint was violated" ) );
+            }
+
+            _revision = other._revision;
+            _next_id  = other._next_id;
+            _counters = other._counters;
+            _change_count = other._change_count;
+            _undo_pack_depth = other._undo_pack_depth;
+         }
+
+         /**
+          *  Fills in everything about this index that can be derived without knowing its name
+          */
+         void get_statistics( index_statistics& stats )const
+         {
+            stats.type_id      = value_type::type_id;
+            stats.object_count = _indices.size();
+            stats.node_size    = _size_of_value_type;
+            stats.node_bytes   = stats.object_count * stats.node_size;
+            stats.revision     = _revision;
+            stats.counters     = _counters;
+            get_undo_statistics( _stack, stats );
+         }
+
       private:
          bool enabled()const { return _stack.size(); }
 
+         template<typename F>
+         void notify( F&& f ) {
+            ++_change_count;
+            for( auto o = _observers; o; o = o->_next_observer )
+               f( *o );
+         }
+
          void on_modify( const value_type& v ) {
             if( !enabled() ) return;
+            _stack.back().record_modify( v );
+         }
 
-            auto& head = _stack.back();
+         void on_remove( const value_type& v ) {
+            if( !enabled() ) return;
+            _stack.back().record_remove( v );
+         }
 
-            if( head.new_ids.find( v.id ) != head.new_ids.end() )
-               return;
+         void on_create( const value_type& v ) {
+            if( !enabled() ) return;
+            _stack.back().record_create( v );
+         }
 
-            auto itr = head.old_values.find( v.id );
-            if( itr != head.old_values.end() )
-               return;
+         typedef std::integral_constant< bool, std::is_trivially_copyable<value_type>::value > packable;
 
-            head.old_values.emplace( std::pair< typename value_type::id_type, const value_type& >( v.id, v ) );
+         /** the next object scan() visits from c */
+         template<typename Tag>
+         typename index_type::template index<Tag>::type::const_iterator cursor_begin( const cursor<Tag>& c )const
+         {
+            const auto& idx = _indices.template get<Tag>();
+            const auto  key = idx.key_extractor();
+            const auto  cmp = idx.key_comp();
+
+            if( c._next_key ) {
+               auto obj = _indices.find( typename value_type::id_type( c._next_id ) );
+               if( obj != _indices.end() && !cmp( key( *obj ), *c._next_key ) && !cmp( *c._next_key, key( *obj ) ) )
+                  return idx.iterator_to( *obj );
+               return idx.lower_bound( *c._next_key );
+            }
+            return c._lower ? idx.lower_bound( *c._lower ) : idx.begin();
          }
 
-         void on_remove( const value_type& v ) {
-            if( !enabled() ) return;
-
-            auto& head = _stack.back();
-            if( head.new_ids.count(v.id) ) {
-               head.new_ids.erase( v.id );
-               return;
+         /**
+          *  Runs visit( obj, result ) over the rest of c's range, split at up to threads - 1 of the
+          *  split_points() inside it, merges the per part results in key order and finishes c
+          */
+         template<typename Tag, typename Result, typename Visitor>
+         Result parallel_range( cursor<Tag>& c, uint32_t threads, Visitor&& visit )const
+         {
+            typedef typename cursor<Tag>::key_type key_type;
+            if( c._done ) return Result();
+
+            const auto& idx   = _indices.template get<Tag>();
+            const auto  cmp   = idx.key_comp();
+            const auto  first = cursor_begin<Tag>( c );
+            const auto  last  = c._upper ? idx.lower_bound( *c._upper ) : idx.end();
+            const auto& from  = c._next_key ? c._next_key : c._lower;
+
+            vector<key_type> splits;
+            if( threads > 1 ) {
+               vector<key_type> inside;
+               for( auto& k : split_points<Tag>( threads * 16, 8 ) )
+                  if( ( !from || cmp( *from, k ) ) && ( !c._upper || cmp( k, *c._upper ) ) )
+                     inside.push_back( std::move( k ) );
+               for( uint32_t p = 1; p < threads && !inside.empty(); ++p ) {
+                  const auto& k = inside[ inside.size() * p / threads ];
+                  if( splits.empty() || cmp( splits.back(), k ) ) splits.push_back( k );
+               }
             }
+            const auto parts = uint32_t( splits.size() + 1 );
+
+            vector<Result> results( parts );
+            detail::run_parallel( parts, [&]( uint32_t p ) {
+               auto itr = p == 0 ? first : idx.lower_bound( splits[p - 1] );
+               auto end = p + 1 == parts ? last : idx.lower_bound( splits[p] );
+               for( ; itr != end; ++itr )
+                  visit( *itr, results[p] );
+            });
+            c._done = true;
+
+            Result result = std::move( results[0] );
+            for( uint32_t p = 1; p < parts; ++p ) result += results[p];
+            return result;
+         }
 
-            auto itr = head.old_values.find( v.id );
-            if( itr != head.old_values.end() ) {
-               head.removed_values.emplace( std::move( *itr ) );
-               head.old_values.erase( v.id );
-               return;
+         void pack_level( undo_state_type& state ) { pack_level( state, packable() ); }
+         void pack_level( undo_state_type&, std::false_type ) {}
+         void pack_level( undo_state_type& state, std::true_type ) {
+            if( _undo_dictionary.empty() ) {
+               // the first object saved by an undo level stands in for a typical object of the table
+               const value_type* sample = nullptr;
+               if( state.old_values.size() )          sample = &state.old_values.begin()->second;
+               else if( state.removed_values.size() ) sample = &state.removed_values.begin()->second;
+               else return state.pack( nullptr );
+               const char* bytes = reinterpret_cast<const char*>( sample );
+               _undo_dictionary.assign( bytes, bytes + sizeof(value_type) );
             }
+            state.pack( _undo_dictionary.data() );
+         }
 
-            if( head.removed_values.count( v.id ) )
+         /**
+          *  Puts the value saved by undo back into the object at itr.  Most undone modifications
+          *  only changed fields no index is ordered by; a trivially copyable value with the same
+          *  keys as the object is copied over it in place, without multi_index_container checking
+          *  the position of the object in each of its indices.  Other values go through modify().
+          */
+         void restore( typename index_type::iterator itr, const value_type& old, std::true_type ) {
+            if( detail::same_keys<0>( _indices, *itr, old ) ) {
+               memcpy( static_cast<void*>( const_cast<value_type*>( &*itr ) ), &old, sizeof(value_type) );
+               ++_counters.in_place_restores;
                return;
-
-            head.removed_values.emplace( std::pair< typename value_type::id_type, const value_type& >( v.id, v ) );
+            }
+            restore( itr, old, std::false_type() );
          }
 
-         void on_create( const value_type& v ) {
-            if( !enabled() ) return;
-            auto& head = _stack.back();
+         void restore( typename index_type::iterator itr, const value_type& old, std::false_type ) {
+            auto ok = _indices.modify( itr, [&]( value_type& v ) {
+               v = old;
+            });
+            if( !ok ) BOOST_THROW_EXCEPTION( std::logic_error( "Could not modify object, most likely a uniqueness constraint was violated" ) );
+         }
 
-            head.new_ids.insert( v.id );
+         void unpack_level( undo_state_type& state ) { unpack_level( state, packable() ); }
+         void unpack_level( undo_state_type&, std::false_type ) {}
+         void unpack_level( undo_state_type& state, std::true_type ) {
+            state.unpack( _undo_dictionary.size() ? _undo_dictionary.data() : nullptr, _indices.get_allocator() );
          }
 
          boost::interprocess::deque< undo_state_type, allocator<undo_state_type> > _stack;
@@ -533,6 +1487,11 @@ namespace chainbase {
          index_type                      _indices;
          uint32_t                        _size_of_value_type = 0;
          uint32_t                        _size_of_this = 0;
+         index_counters                  _counters;
+         uint64_t                        _change_count = 0;
+         index_observer<value_type>*     _observers = nullptr; ///< process local, see add_observer()
+         uint32_t                        _undo_pack_depth = 0;
+         bip::vector< char, allocator<char> > _undo_dictionary; ///< see set_undo_pack_depth()
    };
 
    class abstract_session {
@@ -569,77 +1528,297 @@ namespace chainbase {
          virtual int64_t revision()const = 0;
          virtual void    undo()const = 0;
          virtual void    squash()const = 0;
+         virtual void    squash_to( int64_t revision )const = 0;
          virtual void    commit( int64_t revision )const = 0;
          virtual void    undo_all()const = 0;
          virtual uint32_t type_id()const  = 0;
 
          virtual void remove_object( int64_t id ) = 0;
+         virtual index_statistics get_statistics()const = 0;
+
+         /** true if in() accepts the address of an object of the index, or if the index cannot tell */
+         virtual bool any_object( const std::function<bool( const void* )>& in )const = 0;
+
+         /**
+          *  Constructs a copy of this index in segment and returns a new abstract_index for it
+          */
+         virtual abstract_index* copy_to( bip::managed_mapped_file& segment )const = 0;
+
+         void* get()const { return _idx_ptr; }
+      private:
+         void* _idx_ptr;
+   };
+
+   /**
+    *  Maps the type passed to database::add_index() / get_index() to the index class that is stored
+    *  in the segment.  Multi index containers are wrapped in a generic_index, other table types
+    *  specialize this to name themselves.
+    */
+   template<typename IndexType>
+   struct index_storage_type { typedef generic_index<IndexType> type; };
+
+   template<typename BaseIndex>
+   class index_impl : public abstract_index {
+      public:
+         index_impl( BaseIndex& base ):abstract_index( &base ),_base(base){}
+
+         virtual unique_ptr<abstract_session> start_undo_session( bool enabled ) override {
+            return unique_ptr<abstract_session>(new session_impl<typename BaseIndex::session>( _base.start_undo_session( enabled ) ) );
+         }
+
+         virtual void     set_revision( uint64_t revision ) override { _base.set_revision( revision ); }
+         virtual int64_t  revision()const  override { return _base.revision(); }
+         virtual void     undo()const  override { _base.undo(); }
+         virtual void     squash()const  override { _base.squash(); }
+         virtual void     squash_to( int64_t revision )const  override { _base.squash_to( revision ); }
+         virtual void     commit( int64_t revision )const  override { _base.commit(revision); }
+         virtual void     undo_all() const override {_base.undo_all(); }
+         virtual uint32_t type_id()const override { return BaseIndex::value_type::type_id; }
+
+         virtual void     remove_object( int64_t id ) override { return _base.remove_object( id ); }
+
+         virtual index_statistics get_statistics()const override {
+            index_statistics stats;
+            _base.get_statistics( stats );
+            stats.type_name = boost::core::demangle( typeid( typename BaseIndex::value_type ).name() );
+            return stats;
+         }
+
+         virtual bool any_object( const std::function<bool( const void* )>& in )const override {
+            return in( &_base ) || detail::any_object( _base, in, 0 );
+         }
+
+         virtual abstract_index* copy_to( bip::managed_mapped_file& segment )const override;
+
+      private:
+         BaseIndex& _base;
+   };
+
+   template<typename IndexType>
+   class index : public index_impl<IndexType> {
+      public:
+         index( IndexType& i ):index_impl<IndexType>( i ){}
+   };
+
+   template<typename BaseIndex>
+   abstract_index* index_impl<BaseIndex>::copy_to( bip::managed_mapped_file& segment )const
+   {
+      std::string type_name = boost::core::demangle( typeid( typename BaseIndex::value_type ).name() );
+      auto idx_ptr = segment.construct< BaseIndex >( type_name.c_str() )( typename BaseIndex::allocator_type( segment.get_segment_manager() ) );
+      idx_ptr->copy_from( _base );
+      return new index<BaseIndex>( *idx_ptr );
+   }
+
+
+   /**
+    *  Lives in shared_memory.meta and holds the single read_write_mutex shared by every process
+    *  that has the database open.
+    */
+   class read_write_mutex_manager
+   {
+      public:
+         read_write_mutex_manager()
+         :_size_of_this( sizeof(*this) ){}
+
+         ~read_write_mutex_manager(){}
+
+         void validate()const {
+            if( sizeof(*this) != _size_of_this )
+               BOOST_THROW_EXCEPTION( std::runtime_error( "shared_memory.meta was created by an incompatible version of chainbase" ) );
+         }
+
+         read_write_mutex& current_lock()
+         {
+            return _lock;
+         }
+
+      private:
+         read_write_mutex                                           _lock;
+         uint32_t                                                   _size_of_this = 0;
+   };
+
+
+   class database;
+
+   namespace detail { struct write_tracker; }
+
+   /**
+    *  How database::snapshot() copies the database files
+    */
+   struct snapshot_options
+   {
+      /**
+       *  Copy files when the file system cannot clone them.  A copy happens while writers are held
+       *  off, so it makes the pause as long as the copy of the whole database; without it, the
+       *  default, snapshot() throws instead and holds writers off only for as long as it takes to
+       *  find out.
+       */
+      bool     allow_copy = false;
+      /** how long to wait for the read lock, 0 waits forever */
+      uint64_t wait_micro = 1000000;
+   };
+
+   /**
+    *  What database::snapshot() did and how long writers were held off
+    */
+   struct snapshot_result
+   {
+      int64_t   revision = 0;
+      uint64_t  files = 0;
+      uint64_t  bytes = 0;
+      bool      cloned = true;   ///< every file was cloned by the file system rather than copied
+      uint64_t  flush_ns = 0;    ///< writing back dirty pages before taking the lock
+      uint64_t  pause_ns = 0;    ///< time the read lock was held
+   };
+
+   /**
+    *  A part of a segment file whose content no longer matches the checksum taken when the database
+    *  was last flushed
+    */
+   struct changed_region
+   {
+      bfs::path file;
+      uint64_t  offset = 0;
+      uint64_t  size = 0;
+   };
+
+   /**
+    *  What opening the database found when it checked the segment checksums after an unclean
+    *  shutdown, see database::enable_checksums()
+    */
+   struct integrity_report
+   {
+      bool                      verified = false;   ///< the last shutdown was unclean and the segments were checked
+      uint64_t                  regions = 0;        ///< regions checked
+      uint64_t                  bytes = 0;          ///< bytes checked
+      uint64_t                  verify_ns = 0;
+      vector<changed_region>    changed;            ///< regions written after the last flush
+      vector<std::string>       affected_indices;   ///< tables added so far with objects in a changed region
+   };
+
+   /**
+    *  Placement of a table in a segment file of its own, see database::add_index( const segment_options& )
+    */
+   struct segment_options
+   {
+      /** size of the file when it is created, or the size to grow an existing smaller file to */
+      uint64_t size = 0;
+      /** ask the kernel to back the mapping with transparent huge pages (Linux only, advisory) */
+      bool     huge_pages = false;
+   };
 
-         void* get()const { return _idx_ptr; }
-      private:
-         void* _idx_ptr;
+   /**
+    *  Process local handle of an index that is derived from a table and kept in the segment next to
+    *  it, see secondary_index.  The database attaches the handles it owns again whenever the
+    *  tables they follow move (compact()) and detaches them before the segment is unmapped.
+    */
+   class abstract_secondary_index
+   {
+      public:
+         virtual ~abstract_secondary_index(){}
+         virtual void attach( database& db ) = 0;
+         virtual void detach() = 0;
    };
 
-   template<typename BaseIndex>
-   class index_impl : public abstract_index {
+   /**
+    *  Process local view of a key_filter, consulted by database::find() before searching an index
+    */
+   class abstract_key_filter
+   {
       public:
-         index_impl( BaseIndex& base ):abstract_index( &base ),_base(base){}
+         virtual ~abstract_key_filter(){}
+         /** false only if no object has a key with this key_filter_hash */
+         virtual bool may_contain( uint64_t hash )const = 0;
+   };
 
-         virtual unique_ptr<abstract_session> start_undo_session( bool enabled ) override {
-            return unique_ptr<abstract_session>(new session_impl<typename BaseIndex::session>( _base.start_undo_session( enabled ) ) );
-         }
+   /**
+    *  Order independent digest of a set of objects: the lane wise sum (mod 2^64) of the 256 bit
+    *  hashes of its members.  Digests of disjoint sets combine by addition and a member is taken
+    *  out again by subtraction, see state_hash.
+    */
+   struct state_digest
+   {
+      std::array<uint64_t, 4> words{{ 0, 0, 0, 0 }};
 
-         virtual void     set_revision( uint64_t revision ) override { _base.set_revision( revision ); }
-         virtual int64_t  revision()const  override { return _base.revision(); }
-         virtual void     undo()const  override { _base.undo(); }
-         virtual void     squash()const  override { _base.squash(); }
-         virtual void     commit( int64_t revision )const  override { _base.commit(revision); }
-         virtual void     undo_all() const override {_base.undo_all(); }
-         virtual uint32_t type_id()const override { return BaseIndex::value_type::type_id; }
+      state_digest& operator+=( const state_digest& o ) {
+         for( size_t i = 0; i < words.size(); ++i ) words[i] += o.words[i];
+         return *this;
+      }
+      state_digest& operator-=( const state_digest& o ) {
+         for( size_t i = 0; i < words.size(); ++i ) words[i] -= o.words[i];
+         return *this;
+      }
 
-         virtual void     remove_object( int64_t id ) override { return _base.remove_object( id ); }
-      private:
-         BaseIndex& _base;
+      bool operator==( const state_digest& o )const { return words == o.words; }
+      bool operator!=( const state_digest& o )const { return words != o.words; }
+
+      /** 64 hex digits, most significant word first */
+      std::string str()const {
+         static const char digits[] = "0123456789abcdef";
+         std::string result;
+         for( auto w = words.rbegin(); w != words.rend(); ++w )
+            for( int shift = 60; shift >= 0; shift -= 4 )
+               result.push_back( digits[ ( *w >> shift ) & 0xf ] );
+         return result;
+      }
    };
 
-   template<typename IndexType>
-   class index : public index_impl<IndexType> {
+   /**
+    *  Process local view of a state_hash, summed by database::get_state_digest()
+    */
+   class abstract_state_hash
+   {
       public:
-         index( IndexType& i ):index_impl<IndexType>( i ){}
+         virtual ~abstract_state_hash(){}
+         virtual state_digest digest()const = 0;
    };
 
+   namespace detail {
+      /**
+       *  Process local map from a table in a mapped segment to the descriptor of its cold store
+       *  (see database::cold_store_file()).  Descriptors cannot be kept in the segment itself, it is
+       *  shared with other processes and mapped read only by some of them.
+       */
+      class cold_store_registry
+      {
+         public:
+            static cold_store_registry& instance() { static cold_store_registry r; return r; }
 
-   class read_write_mutex_manager
-   {
-      public:
-         read_write_mutex_manager()
-         {
-            _current_lock = 0;
-         }
-
-         ~read_write_mutex_manager(){}
+            void set( const void* table, int fd ) {
+               std::lock_guard<std::mutex> guard( _mutex );
+               if( fd < 0 ) _fds.erase( table );
+               else         _fds[ table ] = fd;
+            }
 
-         void next_lock()
-         {
-            _current_lock++;
-            new( &_locks[ _current_lock % CHAINBASE_NUM_RW_LOCKS ] ) read_write_mutex();
-         }
+            int get( const void* table ) {
+               std::lock_guard<std::mutex> guard( _mutex );
+               auto itr = _fds.find( table );
+               return itr == _fds.end() ? -1 : itr->second;
+            }
 
-         read_write_mutex& current_lock()
-         {
-            return _locks[ _current_lock % CHAINBASE_NUM_RW_LOCKS ];
-         }
+            /** forgets every table using fd, called when it is closed */
+            void forget( int fd ) {
+               std::lock_guard<std::mutex> guard( _mutex );
+               for( auto itr = _fds.begin(); itr != _fds.end(); )
+                  itr = itr->second == fd ? _fds.erase( itr ) : std::next( itr );
+            }
 
-         uint32_t current_lock_num()
-         {
-            return _current_lock;
-         }
+         private:
+            std::mutex                   _mutex;
+            std::map<const void*, int>   _fds;
+      };
+   }
 
-      private:
-         std::array< read_write_mutex, CHAINBASE_NUM_RW_LOCKS >     _locks;
-         std::atomic< uint32_t >                                    _current_lock;
-   };
+   /**
+    *  Called by database::add_index() every time a table is opened so that the table can reset
+    *  state that is only meaningful to a single process.  Found by argument dependent lookup, table
+    *  types with such state provide an overload.
+    */
+   template<typename IndexType>
+   void index_opened( IndexType&, database& ) {}
 
+   template<typename MultiIndexType>
+   void index_opened( generic_index<MultiIndexType>& idx, database& db );
 
    /**
     *  This class
@@ -652,6 +1831,9 @@ namespace chainbase {
             read_write    = 1
          };
 
+         database();
+         ~database();
+
          void open( const bfs::path& dir, uint32_t write = read_only, uint64_t shared_file_size = 0 );
          bool is_open()const;
          void close();
@@ -677,7 +1859,7 @@ namespace chainbase {
 
          struct session {
             public:
-               session( session&& s ):_index_sessions( std::move(s._index_sessions) ),_revision( s._revision ){}
+               session( session&& s ):_index_sessions( std::move(s._index_sessions) ),_revision( s._revision ),_db( s._db ){ s._db = nullptr; }
                session( vector<std::unique_ptr<abstract_session>>&& s ):_index_sessions( std::move(s) )
                {
                   if( _index_sessions.size() )
@@ -692,18 +1874,21 @@ namespace chainbase {
                {
                   for( auto& i : _index_sessions ) i->push();
                   _index_sessions.clear();
+                  traced( trace_op::session_push );
                }
 
                void squash()
                {
                   for( auto& i : _index_sessions ) i->squash();
                   _index_sessions.clear();
+                  traced( trace_op::session_squash );
                }
 
                void undo()
                {
                   for( auto& i : _index_sessions ) i->undo();
                   _index_sessions.clear();
+                  traced( trace_op::session_undo );
                }
 
                int64_t revision()const { return _revision; }
@@ -712,8 +1897,16 @@ namespace chainbase {
                friend class database;
                session(){}
 
+               /** records the end of the session once, if it was started while tracing */
+               void traced( trace_op op )
+               {
+                  if( BOOST_UNLIKELY( _db != nullptr ) ) _db->trace( op );
+                  _db = nullptr;
+               }
+
                vector< std::unique_ptr<abstract_session> > _index_sessions;
                int64_t _revision = -1;
+               database* _db = nullptr;
          };
 
          session start_undo_session( bool enabled );
@@ -725,10 +1918,33 @@ namespace chainbase {
 
          void undo();
          void squash();
+
+         /**
+          *  Merges every revision after revision into it, in one pass per index, so that undo() then
+          *  takes the database back to how it was before revision was started.  Same as calling
+          *  squash() revision() - revision times, in time linear in the number of undo entries.
+          */
+         void squash_to( int64_t revision );
          void commit( int64_t revision );
          void undo_all();
 
 
+         /**
+          *  Starts recording the operations made through this database to file, replacing any trace
+          *  being recorded: undo sessions, undo, squash and commit, and the type, id and size of the
+          *  objects passed to create, modify, remove, find and get.  Object content and search keys
+          *  are not recorded.  The trace can be replayed against a fresh database with the
+          *  chainbase_replay program to measure a change under a real workload.
+          *
+          *  Changes made directly through an index (get_mutable_index()) are not recorded.  When no
+          *  trace is being recorded each operation pays a single branch.
+          */
+         void start_trace( const bfs::path& file );
+
+         /** writes out and closes the trace, if any */
+         void stop_trace();
+         bool is_tracing()const { return bool( _trace ); }
+
          void set_revision( uint64_t revision )
          {
              CHAINBASE_REQUIRE_WRITE_LOCK( "set_revision", uint64_t );
@@ -738,32 +1954,72 @@ namespace chainbase {
 
          template<typename MultiIndexType>
          void add_index() {
-             const uint16_t type_id = generic_index<MultiIndexType>::value_type::type_id;
-             typedef generic_index<MultiIndexType>          index_type;
-             typedef typename index_type::allocator_type    index_alloc;
+             typedef typename index_storage_type<MultiIndexType>::type index_type;
+             const uint16_t type_id = index_type::value_type::type_id;
 
+             require_unused_type_id( type_id, boost::core::demangle( typeid( typename index_type::value_type ).name() ) );
+             if( bfs::exists( index_segment_path( type_id ) ) )
+                BOOST_THROW_EXCEPTION( std::logic_error( index_segment_path( type_id ).generic_string() + " exists, the table must be added with its own segment" ) );
+
+             add_index_to< MultiIndexType >( *_segment );
+         }
+
+         /**
+          *  Adds a table that lives in a segment file of its own, index-<type_id>.bin in the data
+          *  directory, instead of in shared_memory.bin.  The table's nodes, undo history and any memory
+          *  its objects allocate come from that segment, so it grows, flushes (flush_index()) and is
+          *  compacted independently of the other tables and does not contend on their allocator.
+          *
+          *  A table must be added the same way every time the database is opened.
+          */
+         template<typename MultiIndexType>
+         void add_index( const segment_options& own_segment ) {
+             typedef typename index_storage_type<MultiIndexType>::type index_type;
+             const uint16_t type_id = index_type::value_type::type_id;
              std::string type_name = boost::core::demangle( typeid( typename index_type::value_type ).name() );
 
-             if( !( _index_map.size() <= type_id || _index_map[ type_id ] == nullptr ) ) {
-                BOOST_THROW_EXCEPTION( std::logic_error( type_name + "::type_id is already in use" ) );
-             }
+             require_unused_type_id( type_id, type_name );
+             if( _segment->find< index_type >( type_name.c_str() ).first )
+                BOOST_THROW_EXCEPTION( std::logic_error( type_name + " is stored in shared_memory.bin, it cannot be moved to its own segment" ) );
 
-             index_type* idx_ptr =  nullptr;
-             if( !_read_only ) {
-                idx_ptr = _segment->find_or_construct< index_type >( type_name.c_str() )( index_alloc( _segment->get_segment_manager() ) );
-             } else {
-                idx_ptr = _segment->find< index_type >( type_name.c_str() ).first;
-                if( !idx_ptr ) BOOST_THROW_EXCEPTION( std::runtime_error( "unable to find index for " + type_name + " in read only database" ) );
-             }
+             add_index_to< MultiIndexType >( open_index_segment( type_id, own_segment ) );
+         }
 
-             idx_ptr->validate();
+         /** flushes only the segment holding the table, see add_index( const segment_options& ) */
+         template<typename MultiIndexType>
+         void flush_index() {
+             flush_segment_of( index_storage_type<MultiIndexType>::type::value_type::type_id );
+         }
 
-             if( type_id >= _index_map.size() )
-                _index_map.resize( type_id + 1 );
+         /**
+          *  Attaches a secondary_index to a table added with add_index().  The secondary index is
+          *  built (using up to threads threads) if it does not exist yet or if the table changed
+          *  while it was not attached, and from then on it is maintained with the table.
+          */
+         template<typename SecondaryIndex>
+         SecondaryIndex& add_secondary_index( uint32_t threads = 1 ) {
+             if( find_secondary_index<SecondaryIndex>() )
+                BOOST_THROW_EXCEPTION( std::logic_error( boost::core::demangle( typeid( SecondaryIndex ).name() ) + " is already attached" ) );
+
+             unique_ptr<SecondaryIndex> secondary( new SecondaryIndex( threads ) );
+             secondary->attach( *this );
+             _secondary_list.emplace_back( std::move( secondary ) );
+             return static_cast<SecondaryIndex&>( *_secondary_list.back() );
+         }
 
-             auto new_index = new index<index_type>( *idx_ptr );
-             _index_map[ type_id ].reset( new_index );
-             _index_list.push_back( new_index );
+         /**
+          *  Sum of the digests of every state_hash attached with add_secondary_index(), a digest of
+          *  the content of those tables that is maintained with every change instead of computed by
+          *  walking them.
+          */
+         state_digest get_state_digest()const;
+
+         template<typename SecondaryIndex>
+         const SecondaryIndex& get_secondary_index()const {
+             auto result = find_secondary_index<SecondaryIndex>();
+             if( !result )
+                BOOST_THROW_EXCEPTION( std::out_of_range( boost::core::demangle( typeid( SecondaryIndex ).name() ) + " is not attached" ) );
+             return *result;
          }
 
          auto get_segment_manager() -> decltype( ((bip::managed_mapped_file*)nullptr)->get_segment_manager()) {
@@ -775,11 +2031,84 @@ namespace chainbase {
             return _segment->get_segment_manager()->get_free_memory();
          }
 
+         /**
+          *  Reports live bytes per index and how the free space of the segment is fragmented.
+          *
+          *  The segment manager does not expose its free list, so free blocks are discovered by
+          *  repeatedly allocating the largest block that still fits (binary search) and releasing
+          *  them all at the end.  This requires a writable database and the write lock; on a read
+          *  only database only the per index usage and free_bytes are filled in.
+          *
+          *  @param min_block_size  free blocks smaller than this are not enumerated
+          *  @param max_blocks      upper bound on the number of free blocks enumerated
+          */
+         segment_memory_report get_memory_report( uint64_t min_block_size = 4096, uint32_t max_blocks = 65536 );
+
+         /**
+          *  Rewrites every index into a fresh segment of the same size, allocating each index's
+          *  objects contiguously in id order, and replaces shared_memory.bin with the result.  This
+          *  removes all fragmentation caused by create/remove churn.
+          *
+          *  The undo history must be committed first, the caller must hold the write lock and no other
+          *  process may have the database open.  Named objects other than the indices added to this
+          *  database are not carried over.  References to objects obtained before the call are
+          *  invalidated.
+          */
+         void compact();
+
+         /**
+          *  Makes a point in time copy of the database files in dir (which must not be the data
+          *  directory) that can later be opened, read only or not, as a database of its own.  Exports,
+          *  backups and audits can then run against the copy for as long as they need while this
+          *  database keeps changing.
+          *
+          *  Dirty pages are first written back without any lock, then the read lock is taken, which
+          *  waits for the writer to finish its current change and holds off the next, and the files
+          *  are cloned (FICLONE), an operation that only shares their extents.  On file systems
+          *  without reflinks snapshot() throws, unless snapshot_options::allow_copy asks for a copy
+          *  under the lock.  With checksums enabled they are brought up to date under the lock, for
+          *  the regions written since the flush before it, and cloned with the segments.  A fork
+          *  of the process cannot provide the same view: the segment is a shared mapping, so a child
+          *  would keep seeing every later change.
+          *
+          *  The caller must not hold the lock.  The copy includes any undo history.
+          */
+         snapshot_result snapshot( const bfs::path& dir, const snapshot_options& options = snapshot_options() );
+
+         /**
+          *  Keeps a checksum of every region_size bytes of each segment file, in a .sums file next to
+          *  it, that is updated by flush() and close().  When a database is opened for writing after
+          *  a shutdown without close() (a crash, a kill or a power loss), the regions written after
+          *  the last flush are checked in parallel against their checksums and get_integrity_report()
+          *  tells which regions and tables changed, so that only those need to be checked or rebuilt
+          *  rather than the whole database trusted or replayed.
+          *
+          *  Writes are found by mapping every region that has not been written since the last flush
+          *  read only.  The first write to such a region faults; a SIGSEGV handler then marks the
+          *  region in a .dirty file next to the segment, waits for the mark to reach the disk, and
+          *  makes the region writable again.  flush() and close() only read the marked regions and
+          *  opening the database only checks them, so both take time in proportion to what was
+          *  written, not to the size of the files.  Memory of the segment must therefore not be
+          *  passed to system calls that write into it, such as read(), which fail with EFAULT on a
+          *  region that has not been written since the last flush.  The handler is installed, again
+          *  if it was replaced, whenever a segment with checksums is opened; a handler for SIGSEGV
+          *  installed before is still called for faults outside the segments, one installed later
+          *  while the database is open must pass faults it does not handle on to the one it replaced.
+          *
+          *  region_size must be a multiple of the page size.  Once enabled, checksums stay on for
+          *  the database.
+          */
+         void enable_checksums( uint64_t region_size = 64 * 1024 * 1024 );
+         bool checksums_enabled()const { return _checksum_region_size != 0; }
+
+         /** the result of the check made when the database was opened, with the affected tables added so far */
+         integrity_report get_integrity_report()const;
+
          template<typename MultiIndexType>
-         const generic_index<MultiIndexType>& get_index()const
+         const typename index_storage_type<MultiIndexType>::type& get_index()const
          {
             CHAINBASE_REQUIRE_READ_LOCK("get_index", typename MultiIndexType::value_type);
-            typedef generic_index<MultiIndexType> index_type;
+            typedef typename index_storage_type<MultiIndexType>::type index_type;
             typedef index_type*                   index_type_ptr;
             assert( _index_map.size() > index_type::value_type::type_id );
             assert( _index_map[index_type::value_type::type_id] );
@@ -787,7 +2116,7 @@ namespace chainbase {
          }
 
          template<typename MultiIndexType, typename ByIndex>
-         auto get_index()const -> decltype( ((generic_index<MultiIndexType>*)( nullptr ))->indicies().template get<ByIndex>() )
+         const typename MultiIndexType::template index<ByIndex>::type& get_index()const
          {
             CHAINBASE_REQUIRE_READ_LOCK("get_index", typename MultiIndexType::value_type);
             typedef generic_index<MultiIndexType> index_type;
@@ -798,10 +2127,10 @@ namespace chainbase {
          }
 
          template<typename MultiIndexType>
-         generic_index<MultiIndexType>& get_mutable_index()
+         typename index_storage_type<MultiIndexType>::type& get_mutable_index()
          {
             CHAINBASE_REQUIRE_WRITE_LOCK("get_mutable_index", typename MultiIndexType::value_type);
-            typedef generic_index<MultiIndexType> index_type;
+            typedef typename index_storage_type<MultiIndexType>::type index_type;
             typedef index_type*                   index_type_ptr;
             assert( _index_map.size() > index_type::value_type::type_id );
             assert( _index_map[index_type::value_type::type_id] );
@@ -812,29 +2141,48 @@ namespace chainbase {
          const ObjectType* find( CompatibleKey&& key )const
          {
              CHAINBASE_REQUIRE_READ_LOCK("find", ObjectType);
+             auto obj = lookup< ObjectType, IndexedByType >( std::forward< CompatibleKey >( key ) );
+             trace_lookup( trace_op::find, obj, 1 );
+             return obj;
+         }
+
+         /**
+          *  Looks up every key in the index tagged IndexedByType and returns the objects (or nullptr)
+          *  in the order of keys, the same results as a find() per key.  Lookups in ordered indices
+          *  walk the tree in sorted key order with up to group descents interleaved, so a batch of
+          *  keys whose nodes are not in cache costs far fewer serial memory stalls than a loop of
+          *  find() calls.  With CHAINBASE_INTERLEAVED_FIND off (see interleaved_find.hpp) it is such
+          *  a loop.
+          */
+         template< typename ObjectType, typename IndexedByType, typename Key >
+         vector<const ObjectType*> find_many( const vector<Key>& keys, size_t group = 16 )const
+         {
+             CHAINBASE_REQUIRE_READ_LOCK("find_many", ObjectType);
              typedef typename get_index_type< ObjectType >::type index_type;
+             typedef typename index_type::template index< IndexedByType >::type::key_type key_type;
+             vector<const ObjectType*> results( keys.size(), nullptr );
              const auto& idx = get_index< index_type >().indicies().template get< IndexedByType >();
-             auto itr = idx.find( std::forward< CompatibleKey >( key ) );
-             if( itr == idx.end() ) return nullptr;
-             return &*itr;
+             detail::interleaved_find( idx, keys, results, [&]( const Key& k ) {
+                return key_may_exist< ObjectType, IndexedByType >( k, key_filter_compatible< key_type, Key >() );
+             }, group, 0 );
+             return results;
          }
 
          template< typename ObjectType >
          const ObjectType* find( oid< ObjectType > key = oid< ObjectType >() ) const
          {
              CHAINBASE_REQUIRE_READ_LOCK("find", ObjectType);
-             typedef typename get_index_type< ObjectType >::type index_type;
-             const auto& idx = get_index< index_type >().indices();
-             auto itr = idx.find( key );
-             if( itr == idx.end() ) return nullptr;
-             return &*itr;
+             auto obj = lookup< ObjectType >( key );
+             trace_lookup( trace_op::find, obj, 0 );
+             return obj;
          }
 
          template< typename ObjectType, typename IndexedByType, typename CompatibleKey >
          const ObjectType& get( CompatibleKey&& key )const
          {
              CHAINBASE_REQUIRE_READ_LOCK("get", ObjectType);
-             auto obj = find< ObjectType, IndexedByType >( std::forward< CompatibleKey >( key ) );
+             auto obj = lookup< ObjectType, IndexedByType >( std::forward< CompatibleKey >( key ) );
+             trace_lookup( trace_op::get, obj, 1 );
              if( !obj ) BOOST_THROW_EXCEPTION( std::out_of_range( "unknown key" ) );
              return *obj;
          }
@@ -843,7 +2191,8 @@ namespace chainbase {
          const ObjectType& get( const oid< ObjectType >& key = oid< ObjectType >() )const
          {
              CHAINBASE_REQUIRE_READ_LOCK("get", ObjectType);
-             auto obj = find< ObjectType >( key );
+             auto obj = lookup< ObjectType >( key );
+             trace_lookup( trace_op::get, obj, 0 );
              if( !obj ) BOOST_THROW_EXCEPTION( std::out_of_range( "unknown key") );
              return *obj;
          }
@@ -853,14 +2202,26 @@ namespace chainbase {
          {
              CHAINBASE_REQUIRE_WRITE_LOCK("modify", ObjectType);
              typedef typename get_index_type<ObjectType>::type index_type;
+             trace( trace_op::modify, ObjectType::type_id, obj.id._id, sizeof(ObjectType) );
              get_mutable_index<index_type>().modify( obj, m );
          }
 
+         /** see generic_index::modify_fields() */
+         template<typename ObjectType, typename Modifier>
+         void modify_fields( const ObjectType& obj, Modifier&& m )
+         {
+             CHAINBASE_REQUIRE_WRITE_LOCK("modify_fields", ObjectType);
+             typedef typename get_index_type<ObjectType>::type index_type;
+             trace( trace_op::modify, ObjectType::type_id, obj.id._id, sizeof(ObjectType) );
+             get_mutable_index<index_type>().modify_fields( obj, m );
+         }
+
          template<typename ObjectType>
          void remove( const ObjectType& obj )
          {
              CHAINBASE_REQUIRE_WRITE_LOCK("remove", ObjectType);
              typedef typename get_index_type<ObjectType>::type index_type;
+             trace( trace_op::remove, ObjectType::type_id, obj.id._id );
              return get_mutable_index<index_type>().remove( obj );
          }
 
@@ -869,29 +2230,20 @@ namespace chainbase {
          {
              CHAINBASE_REQUIRE_WRITE_LOCK("create", ObjectType);
              typedef typename get_index_type<ObjectType>::type index_type;
-             return get_mutable_index<index_type>().emplace( std::forward<Constructor>(con) );
+             const auto& obj = get_mutable_index<index_type>().emplace( std::forward<Constructor>(con) );
+             trace( trace_op::create, ObjectType::type_id, obj.id._id, sizeof(ObjectType) );
+             return obj;
          }
 
          template< typename Lambda >
          auto with_read_lock( Lambda&& callback, uint64_t wait_micro = 1000000 ) -> decltype( (*(Lambda*)nullptr)() )
          {
-            read_lock lock( _rw_manager->current_lock(), bip::defer_lock_type() );
+            read_lock lock( _rw_manager->current_lock(), _lock_slot, wait_micro ? int64_t(wait_micro) * 1000 : -1 );
 #ifdef CHAINBASE_CHECK_LOCKING
             BOOST_ATTRIBUTE_UNUSED
             int_incrementer ii( _read_lock_count );
 #endif
 
-            if( !wait_micro )
-            {
-               lock.lock();
-            }
-            else
-            {
-
-               if( !lock.timed_lock( boost::posix_time::microsec_clock::local_time() + boost::posix_time::microseconds( wait_micro ) ) )
-                  BOOST_THROW_EXCEPTION( std::runtime_error( "unable to acquire lock" ) );
-            }
-
             return callback();
          }
 
@@ -901,33 +2253,173 @@ namespace chainbase {
             if( _read_only )
                BOOST_THROW_EXCEPTION( std::logic_error( "cannot acquire write lock on read-only process" ) );
 
-            write_lock lock( _rw_manager->current_lock(), boost::defer_lock_t() );
+            /// writers never give up, the lock already reclaims anything held by dead processes while we wait
+            write_lock lock( _rw_manager->current_lock(), _lock_slot, wait_micro ? int64_t(wait_micro) * 1000 : -1, [&]() {
+               std::cerr << "Lock timeout, still waiting for write lock (state " << std::hex
+                         << _rw_manager->current_lock().state() << std::dec << ")" << std::endl;
+            });
 #ifdef CHAINBASE_CHECK_LOCKING
             BOOST_ATTRIBUTE_UNUSED
             int_incrementer ii( _write_lock_count );
 #endif
 
-            if( !wait_micro )
-            {
-               lock.lock();
-            }
-            else
-            {
-               while( !lock.timed_lock( boost::posix_time::microsec_clock::local_time() + boost::posix_time::microseconds( wait_micro ) ) )
-               {
-                  _rw_manager->next_lock();
-                  std::cerr << "Lock timeout, moving to lock " << _rw_manager->current_lock_num() << std::endl;
-                  lock = write_lock( _rw_manager->current_lock(), boost::defer_lock_t() );
-               }
-            }
-
             return callback();
          }
 
+         /**
+          *  Returns a snapshot of every index that has been added to this database.  This only reads
+          *  counters maintained by the indices themselves so it is cheap enough to poll, and it works
+          *  equally well from a read only process (while holding the read lock).
+          */
+         vector<index_statistics> get_statistics()const;
+
+         /**
+          *  Calls step() repeatedly, each time under a separate read lock, until it returns true.  This
+          *  bounds how long a long running scan holds the lock and lets the (writer preferring) lock
+          *  admit the writer between chunks.  step is expected to resume from a cursor it owns.
+          */
+         template< typename Step >
+         void read_in_chunks( Step&& step, uint64_t wait_micro = 1000000 )
+         {
+            while( !with_read_lock( [&]() -> bool { return step(); }, wait_micro ) ) {}
+         }
+
+         lock_stats get_read_lock_stats()const  { return _rw_manager->current_lock().read_stats(); }
+         lock_stats get_write_lock_stats()const { return _rw_manager->current_lock().write_stats(); }
+
+         /** true while a writer in any process waits for the lock, see read_write_mutex::writer_waiting() */
+         bool writer_waiting()const { return _rw_manager->current_lock().writer_waiting(); }
+
+         bool is_read_only()const { return _read_only; }
+
+         /** path of the segment file used by a table added with its own segment */
+         bfs::path index_segment_path( uint16_t type_id )const;
+
+         /**
+          *  File descriptor of the append only store a table keeps evicted objects in
+          *  (cold-<type_id>.dat in the data directory), opened on first use and closed with the
+          *  database.  See tiered_index.
+          */
+         int cold_store_file( uint16_t type_id );
+
+         /**
+          *  Makes find< ObjectType, Tag >() consult filter before searching the index identified by
+          *  typeid( index_type::index<Tag>::type ), or stops it when filter is nullptr.  Called by
+          *  key_filter when it is attached and detached.
+          */
+         void set_key_filter( uint16_t type_id, const std::type_info& index, const abstract_key_filter* filter );
+
       private:
+         void release_lock_slot();
+         void detach_secondary_indices();
+         void close_cold_store_files();
+         bip::managed_mapped_file& open_index_segment( uint16_t type_id, const segment_options& options );
+         bip::managed_mapped_file* own_segment_of( uint16_t type_id )const;
+         void flush_segment_of( uint16_t type_id );
+         void compact_segment( const bfs::path& path, unique_ptr<bip::managed_mapped_file>& segment, const vector<abstract_index*>& indices );
+
+         vector<std::pair<bfs::path, bip::managed_mapped_file*>> segment_files()const;
+         void verify_checksums( const bfs::path& file, bip::managed_mapped_file& segment );
+         void write_checksums( const bfs::path& file, bip::managed_mapped_file& segment, bool clean );
+         detail::write_tracker& write_tracker_of( const bfs::path& file, bip::managed_mapped_file& segment );
+         void forget_writes( const bfs::path& file );
+
+         void require_unused_type_id( uint16_t type_id, const std::string& type_name )const {
+            if( !( _index_map.size() <= type_id || _index_map[ type_id ] == nullptr ) )
+               BOOST_THROW_EXCEPTION( std::logic_error( type_name + "::type_id is already in use" ) );
+         }
+
+         template<typename MultiIndexType>
+         void add_index_to( bip::managed_mapped_file& segment ) {
+             typedef typename index_storage_type<MultiIndexType>::type index_type;
+             const uint16_t type_id = index_type::value_type::type_id;
+             typedef typename index_type::allocator_type    index_alloc;
+
+             std::string type_name = boost::core::demangle( typeid( typename index_type::value_type ).name() );
+
+             index_type* idx_ptr =  nullptr;
+             if( !_read_only ) {
+                idx_ptr = segment.find_or_construct< index_type >( type_name.c_str() )( index_alloc( segment.get_segment_manager() ) );
+             } else {
+                idx_ptr = segment.find< index_type >( type_name.c_str() ).first;
+                if( !idx_ptr ) BOOST_THROW_EXCEPTION( std::runtime_error( "unable to find index for " + type_name + " in read only database" ) );
+             }
+
+             idx_ptr->validate();
+             index_opened( *idx_ptr, *this );
+
+             if( type_id >= _index_map.size() )
+                _index_map.resize( type_id + 1 );
+
+             auto new_index = new index<index_type>( *idx_ptr );
+             _index_map[ type_id ].reset( new_index );
+             _index_list.push_back( new_index );
+         }
+
+         template<typename ObjectType, typename Tag, typename Key>
+         bool key_may_exist( const Key& key, std::true_type )const {
+            const uint16_t type_id = ObjectType::type_id;
+            if( BOOST_LIKELY( type_id >= _key_filters.size() ) ) return true;
+            for( const auto& item : _key_filters[ type_id ] )
+               if( item.first == typeid( typename get_index_type< ObjectType >::type::template index< Tag >::type ) ) return item.second->may_contain( key_filter_hash<Key>::hash( key ) );
+            return true;
+         }
+
+         template<typename ObjectType, typename Tag, typename Key>
+         bool key_may_exist( const Key&, std::false_type )const { return true; }
+
+         template< typename ObjectType, typename IndexedByType, typename CompatibleKey >
+         const ObjectType* lookup( CompatibleKey&& key )const
+         {
+             typedef typename get_index_type< ObjectType >::type index_type;
+             typedef typename index_type::template index< IndexedByType >::type::key_type key_type;
+             typedef typename std::decay< CompatibleKey >::type search_type;
+             if( !key_may_exist< ObjectType, IndexedByType >( key, key_filter_compatible< key_type, search_type >() ) )
+                return nullptr;
+             const auto& idx = get_index< index_type >().indicies().template get< IndexedByType >();
+             auto itr = idx.find( std::forward< CompatibleKey >( key ) );
+             if( itr == idx.end() ) return nullptr;
+             return &*itr;
+         }
+
+         template< typename ObjectType >
+         const ObjectType* lookup( const oid< ObjectType >& key )const
+         {
+             typedef typename get_index_type< ObjectType >::type index_type;
+             const auto& idx = get_index< index_type >().indices();
+             auto itr = idx.find( key );
+             if( itr == idx.end() ) return nullptr;
+             return &*itr;
+         }
+
+         void trace( trace_op op, uint16_t type_id = 0, int64_t id = -1, int64_t value = 0 )const
+         {
+             if( BOOST_LIKELY( !_trace ) ) return;
+             trace_record r;
+             r.op      = op;
+             r.type_id = type_id;
+             r.id      = id;
+             r.value   = value;
+             _trace->write( r );
+         }
+
+         template< typename ObjectType >
+         void trace_lookup( trace_op op, const ObjectType* obj, int64_t by_key )const
+         {
+             trace( op, ObjectType::type_id, obj ? int64_t( obj->id._id ) : -1, by_key );
+         }
+
+         template<typename SecondaryIndex>
+         SecondaryIndex* find_secondary_index()const {
+            for( const auto& item : _secondary_list )
+               if( auto result = dynamic_cast<SecondaryIndex*>( item.get() ) ) return result;
+            return nullptr;
+         }
+
          unique_ptr<bip::managed_mapped_file>                        _segment;
          unique_ptr<bip::managed_mapped_file>                        _meta;
          read_write_mutex_manager*                                   _rw_manager = nullptr;
+         int32_t                                                     _lock_slot = read_write_mutex::anonymous_slot;
          bool                                                        _read_only = false;
          bip::file_lock                                              _flock;
 
@@ -940,14 +2432,59 @@ namespace chainbase {
           * This is a full map (size 2^16) of all possible index designed for constant time lookup
           */
          vector<unique_ptr<abstract_index>>                          _index_map;
+         vector<unique_ptr<abstract_secondary_index>>                _secondary_list;
+
+         struct index_segment
+         {
+            unique_ptr<bip::managed_mapped_file>   file;
+            segment_options                        options;
+         };
+
+         /**
+          * Segment files of the tables added with their own segment, by type_id
+          */
+         vector<index_segment>                                       _index_segments;
+
+         /**
+          * Descriptors returned by cold_store_file(), by type_id, -1 if not open
+          */
+         vector<int>                                                 _cold_store_files;
+
+         /**
+          * Filters attached with set_key_filter(), by object type_id and then index
+          */
+         vector<vector<std::pair<std::type_index, const abstract_key_filter*>>> _key_filters;
 
          bfs::path                                                   _data_dir;
 
+         /**
+          * Size of the regions covered by one checksum, 0 without checksums
+          */
+         uint64_t                                                    _checksum_region_size = 0;
+         integrity_report                                            _integrity;
+
+         /**
+          * Regions of each segment file written since its checksums were taken, see enable_checksums()
+          */
+         vector<unique_ptr<detail::write_tracker>>                   _write_trackers;
+
+         /**
+          * Set while start_trace() is recording
+          */
+         unique_ptr<trace_writer>                                    _trace;
+
          int32_t                                                     _read_lock_count = 0;
          int32_t                                                     _write_lock_count = 0;
          bool                                                        _enable_require_locking = false;
    };
 
+   template<typename MultiIndexType>
+   void index_opened( generic_index<MultiIndexType>& idx, database& db )
+   {
+      // observers registered by a process that has since exited are dangling
+      if( !db.is_read_only() ) idx.clear_observers();
+   }
+
    template<typename Object, typename... Args>
    using shared_multi_index_container = boost::multi_index_container<Object,Args..., chainbase::allocator<Object> >;
 }  // namepsace chainbase
@@ -0,0 +1,477 @@
+#pragma once
+
+#include <chainbase/chainbase.hpp>
+
+#include <boost/interprocess/containers/vector.hpp>
+
+#include <algorithm>
+#include <limits>
+#include <tuple>
+#include <type_traits>
+
+namespace chainbase {
+
+   /**
+    *  Names one field of Object that a column_index stores as its own column
+    */
+   template<typename Object, typename T, T Object::*Member>
+   struct column
+   {
+      typedef T type;
+      static T&       get( Object& o )       { return o.*Member; }
+      static const T& get( const Object& o ) { return o.*Member; }
+   };
+
+   /**
+    *  Specialize as std::true_type for an Object whose column_index deliberately leaves some of its
+    *  fields out of the listed columns, see column_index
+    */
+   template<typename Object>
+   struct column_index_drops_fields : std::false_type {};
+
+   namespace detail {
+
+      template<typename Column, typename... Columns> struct column_position;
+
+      template<typename Column, typename... Rest>
+      struct column_position<Column, Column, Rest...> { static const size_t value = 0; };
+
+      template<typename Column, typename Other, typename... Rest>
+      struct column_position<Column, Other, Rest...> { static const size_t value = 1 + column_position<Column, Rest...>::value; };
+
+      template<typename... Columns> struct row_size;
+      template<> struct row_size<> { static const size_t value = 0; };
+      template<typename Column, typename... Rest>
+      struct row_size<Column, Rest...> { static const size_t value = sizeof(typename Column::type) + row_size<Rest...>::value; };
+
+      /** applies f( column_descriptor, column_vector ) to every column */
+      template<size_t I, typename Storage, typename F, typename... Columns>
+      struct for_each_column_impl;
+
+      template<size_t I, typename Storage, typename F>
+      struct for_each_column_impl<I, Storage, F> {
+         static void apply( Storage&, F& ) {}
+      };
+
+      template<size_t I, typename Storage, typename F, typename Column, typename... Rest>
+      struct for_each_column_impl<I, Storage, F, Column, Rest...> {
+         static void apply( Storage& s, F& f ) {
+            f( Column(), std::get<I>( s ) );
+            for_each_column_impl<I + 1, Storage, F, Rest...>::apply( s, f );
+         }
+      };
+
+      /**
+       *  Splits [begin, end) into up to threads parts and runs f( part_begin, part_end, result ) on each
+       *  concurrently, then merges the per part results in order so the outcome does not depend on
+       *  scheduling.  Small ranges are not worth a thread and run inline.
+       */
+      template<typename Result, typename F>
+      Result parallel_slots( int64_t begin, int64_t end, uint32_t threads, F&& f )
+      {
+         const int64_t min_slots_per_thread = 1 << 16;
+         int64_t n = end - begin;
+         threads = uint32_t( std::max<int64_t>( 1, std::min<int64_t>( threads, n / min_slots_per_thread ) ) );
+
+         vector<Result> parts( threads );
+         const int64_t step = ( n + threads - 1 ) / threads;
+         run_parallel( threads, [&]( uint32_t t ) {
+            int64_t b = std::min( end, begin + step * t );
+            f( b, std::min( end, b + step ), parts[t] );
+         });
+
+         Result result = std::move( parts[0] );
+         for( uint32_t t = 1; t < threads; ++t ) result += parts[t];
+         return result;
+      }
+
+   } // namespace detail
+
+   /**
+    *  A table for trivially copyable objects that stores every field listed in Columns in its own
+    *  contiguous vector indexed by the object's id (structure of arrays), instead of storing whole
+    *  objects in multi_index nodes.  A scan over one field touches only that field's memory.
+    *
+    *  Ids are dense: slot i of every column belongs to the object with id i.  Slots of removed
+    *  objects keep value initialized fields and are flagged as dead in live_data(), so aggregates
+    *  such as sums can run over the raw column while counts consult the live flags.
+    *
+    *  Aggregate and filter queries over a column (aggregate(), select_ids()) are written as branch free
+    *  loops over the contiguous column and live flags so the compiler can vectorize them, and can be
+    *  split across threads.  They take an explicit slot range, which doubles as a resumable cursor
+    *  when a long scan is broken into chunks to bound the read lock hold time.
+    *
+    *  Only the id and the fields listed in Columns are stored.  Any other field of Object would be
+    *  reset to its default on create and modify and read back that way, so the columns must cover
+    *  the whole object (the listed fields and the id add up to sizeof(Object)) unless
+    *  column_index_drops_fields<Object> is specialized to say that losing the others is intended.
+    *
+    *  Create, modify, remove and the undo / squash / commit semantics are the same as generic_index.
+    *  Because there is no node to reference, objects are returned by value.  The table is added to a
+    *  database with add_index<column_index<...>>() and reached through get_index / get_mutable_index;
+    *  database::create / modify / find do not apply to it.
+    *
+    *  @code
+    *  typedef column_index< book, column<book,int,&book::pages>, column<book,int,&book::publish_date> > book_columns;
+    *  @endcode
+    */
+   template<typename Object, typename... Columns>
+   class column_index
+   {
+      public:
+         typedef bip::managed_mapped_file::segment_manager             segment_manager_type;
+         typedef Object                                                value_type;
+         typedef typename value_type::id_type                          id_type;
+         typedef bip::allocator< column_index, segment_manager_type >  allocator_type;
+         typedef undo_state< value_type >                              undo_state_type;
+         typedef undo_session< column_index >                          session;
+         typedef bip::vector< uint8_t, allocator<uint8_t> >            live_vector_type;
+         typedef std::tuple< bip::vector< typename Columns::type, allocator<typename Columns::type> >... > column_storage;
+
+         static_assert( std::is_trivially_copyable<value_type>::value, "column_index requires a trivially copyable object type" );
+         static_assert( detail::row_size<Columns...>::value + sizeof(id_type) == sizeof(value_type) || column_index_drops_fields<value_type>::value,
+                        "the columns do not cover every field of the object, see column_index_drops_fields" );
+
+         template<typename Column>
+         struct column_vector {
+            typedef typename std::tuple_element< detail::column_position<Column, Columns...>::value, column_storage >::type type;
+         };
+
+         column_index( allocator<value_type> a )
+         :_stack(a),_live(a),_columns( allocator<typename Columns::type>( a )... ),
+          _size_of_row( detail::row_size<Columns...>::value ),_size_of_this( sizeof(*this) ){}
+
+         void validate()const {
+            if( detail::row_size<Columns...>::value != _size_of_row || sizeof(*this) != _size_of_this )
+               BOOST_THROW_EXCEPTION( std::runtime_error("content of memory does not match data expected by executable") );
+         }
+
+         /**
+          *  Appends a new object, assigns it the next id and returns that id
+          */
+         template<typename Constructor>
+         id_type emplace( Constructor&& c ) {
+            auto new_id = _next_id;
+            value_type v( [&]( value_type& o ) {
+               o.id = new_id;
+               c( o );
+            }, _live.get_allocator() );
+            v.id = new_id;
+
+            _live.push_back( 1 );
+            push_back_row( v );
+            ++_live_count;
+            ++_next_id;
+            ++_counters.creates;
+            on_create( v );
+            return new_id;
+         }
+
+         template<typename Modifier>
+         void modify( id_type id, Modifier&& m ) {
+            value_type v = get( id );
+            ++_counters.modifies;
+            on_modify( v );
+            m( v );
+            v.id = id;
+            store( v );
+         }
+
+         void remove( id_type id ) {
+            value_type v = get( id );
+            ++_counters.removes;
+            on_remove( v );
+            clear_slot( id );
+         }
+
+         bool contains( id_type id )const {
+            return id._id >= 0 && size_t(id._id) < _live.size() && _live[id._id];
+         }
+
+         value_type get( id_type id )const {
+            if( !contains( id ) ) BOOST_THROW_EXCEPTION( std::out_of_range("key not found") );
+            return load( id );
+         }
+
+         /** number of live objects */
+         size_t size()const { return _live_count; }
+
+         /** number of slots in every column, including those of removed objects */
+         size_t slots()const { return _live.size(); }
+
+         /** one byte per slot, non zero if the slot holds a live object */
+         const uint8_t* live_data()const { return _live.data(); }
+
+         /** contiguous storage of one column, slots() elements long */
+         template<typename Column>
+         const typename Column::type* column_data()const {
+            return std::get< detail::column_position<Column, Columns...>::value >( _columns ).data();
+         }
+
+         /**
+          *  Count, sum, min and max of Column over the live slots in [begin, end) whose value is
+          *  accepted by pred.  end < 0 means up to slots().
+          *
+          *  @param threads  upper bound on the number of threads the range is split across
+          */
+         template<typename Column, typename Sum = typename Column::type, typename Predicate>
+         aggregate_result<typename Column::type, Sum> aggregate( Predicate&& pred, int64_t begin = 0, int64_t end = -1, uint32_t threads = 1 )const {
+            typedef typename Column::type T;
+            typedef aggregate_result<T, Sum> result_type;
+            static_assert( std::is_arithmetic<T>::value, "aggregate requires an arithmetic column" );
+
+            const T*       values = column_data<Column>();
+            const uint8_t* live   = live_data();
+            clamp_range( begin, end );
+
+            return detail::parallel_slots<result_type>( begin, end, threads, [&]( int64_t b, int64_t e, result_type& r ) {
+               uint64_t count = 0;
+               Sum      sum   = Sum();
+               T        mn    = std::numeric_limits<T>::max();
+               T        mx    = std::numeric_limits<T>::lowest();
+               for( int64_t i = b; i < e; ++i ) {
+                  const T    v    = values[i];
+                  const bool keep = bool( live[i] ) & bool( pred( v ) );
+                  count += keep;
+                  sum   += keep ? Sum( v ) : Sum();
+                  mn     = ( keep & ( v < mn ) ) ? v : mn;
+                  mx     = ( keep & ( mx < v ) ) ? v : mx;
+               }
+               r.count = count;
+               r.sum   = sum;
+               r.min   = count ? mn : T();
+               r.max   = count ? mx : T();
+            });
+         }
+
+         /** number of live slots in [begin, end) whose Column value is accepted by pred */
+         template<typename Column, typename Predicate>
+         uint64_t count( Predicate&& pred, int64_t begin = 0, int64_t end = -1, uint32_t threads = 1 )const {
+            return aggregate<Column, uint64_t>( std::forward<Predicate>( pred ), begin, end, threads ).count;
+         }
+
+         /** ids of the live slots in [begin, end) whose Column value is accepted by pred, in id order */
+         template<typename Column, typename Predicate>
+         vector<id_type> select_ids( Predicate&& pred, int64_t begin = 0, int64_t end = -1, uint32_t threads = 1 )const {
+            typedef detail::id_list<id_type> result_type;
+            const auto*    values = column_data<Column>();
+            const uint8_t* live   = live_data();
+            clamp_range( begin, end );
+
+            return detail::parallel_slots<result_type>( begin, end, threads, [&]( int64_t b, int64_t e, result_type& r ) {
+               for( int64_t i = b; i < e; ++i )
+                  if( live[i] && pred( values[i] ) ) r.ids.push_back( id_type( i ) );
+            }).ids;
+         }
+
+         session start_undo_session( bool enabled ) {
+            if( enabled ) {
+               _stack.emplace_back( _live.get_allocator() );
+               _stack.back().old_next_id = _next_id;
+               _stack.back().revision = ++_revision;
+               return session( *this, _revision );
+            } else {
+               return session( *this, -1 );
+            }
+         }
+
+         int64_t revision()const { return _revision; }
+
+         void undo() {
+            if( !enabled() ) return;
+            scoped_timer timer( _counters.undo_time );
+
+            const auto& head = _stack.back();
+
+            for( auto& item : head.old_values )
+               store( item.second );
+
+            for( auto id : head.new_ids )
+               clear_slot( id );
+
+            // every id handed out during this revision is at or past old_next_id
+            _next_id = head.old_next_id;
+            resize_slots( _next_id._id );
+
+            for( auto& item : head.removed_values ) {
+               store( item.second );
+               _live[item.first._id] = 1;
+               ++_live_count;
+            }
+
+            _stack.pop_back();
+            --_revision;
+         }
+
+         void squash() {
+            if( !enabled() ) return;
+            scoped_timer timer( _counters.squash_time );
+            if( _stack.size() == 1 ) {
+               _stack.pop_front();
+               return;
+            }
+
+            squash_undo_states( _stack[_stack.size()-2], _stack.back() );
+
+            _stack.pop_back();
+            --_revision;
+         }
+
+         /** @see generic_index::squash_to */
+         void squash_to( int64_t revision ) {
+            if( !enabled() || revision >= _revision ) return;
+            scoped_timer timer( _counters.squash_time );
+            squash_undo_stack( _stack, revision );
+            _revision = revision;
+         }
+
+         void commit( int64_t revision ) {
+            scoped_timer timer( _counters.commit_time );
+            while( _stack.size() && _stack[0].revision <= revision )
+               _stack.pop_front();
+         }
+
+         void undo_all() {
+            while( enabled() )
+               undo();
+         }
+
+         void set_revision( uint64_t revision ) {
+            if( _stack.size() != 0 ) BOOST_THROW_EXCEPTION( std::logic_error("cannot set revision while there is an existing undo stack") );
+            _revision = revision;
+         }
+
+         void remove_object( int64_t id ) {
+            if( !contains( id_type(id) ) ) BOOST_THROW_EXCEPTION( std::out_of_range( boost::lexical_cast<std::string>(id) ) );
+            remove( id_type(id) );
+         }
+
+         const index_counters& counters()const { return _counters; }
+
+         void get_statistics( index_statistics& stats )const {
+            stats.type_id      = value_type::type_id;
+            stats.object_count = _live_count;
+            stats.node_size    = _size_of_row + sizeof(uint8_t);
+            stats.node_bytes   = _live.size() * stats.node_size;
+            stats.revision     = _revision;
+            stats.counters     = _counters;
+            get_undo_statistics( _stack, stats );
+         }
+
+         /** @see generic_index::copy_from */
+         void copy_from( const column_index& other ) {
+            if( other._stack.size() )
+               BOOST_THROW_EXCEPTION( std::logic_error( "cannot copy an index with undo history, commit it first" ) );
+            if( _live.size() || _stack.size() )
+               BOOST_THROW_EXCEPTION( std::logic_error( "can only copy into an empty index" ) );
+
+            _live.assign( other._live.begin(), other._live.end() );
+            copy_columns f{ other._columns };
+            detail::for_each_column_impl<0, column_storage, copy_columns, Columns...>::apply( _columns, f );
+            _live_count = other._live_count;
+            _revision   = other._revision;
+            _next_id    = other._next_id;
+            _counters   = other._counters;
+         }
+
+      private:
+         bool enabled()const { return _stack.size(); }
+
+         void on_modify( const value_type& v ) {
+            if( !enabled() ) return;
+            _stack.back().record_modify( v );
+         }
+
+         void on_remove( const value_type& v ) {
+            if( !enabled() ) return;
+            _stack.back().record_remove( v );
+         }
+
+         void on_create( const value_type& v ) {
+            if( !enabled() ) return;
+            _stack.back().record_create( v );
+         }
+
+         struct push_field {
+            const value_type& v;
+            template<typename Column, typename Vector> void operator()( Column, Vector& col ) { col.push_back( Column::get( v ) ); }
+         };
+         struct store_field {
+            const value_type& v;
+            template<typename Column, typename Vector> void operator()( Column, Vector& col ) { col[v.id._id] = Column::get( v ); }
+         };
+         struct load_field {
+            value_type& v;
+            template<typename Column, typename Vector> void operator()( Column, const Vector& col ) { Column::get( v ) = col[v.id._id]; }
+         };
+         struct clear_field {
+            int64_t id;
+            template<typename Column, typename Vector> void operator()( Column, Vector& col ) { col[id] = typename Column::type(); }
+         };
+         struct resize_field {
+            size_t n;
+            template<typename Column, typename Vector> void operator()( Column, Vector& col ) { col.resize( n ); }
+         };
+         struct copy_columns {
+            const column_storage& other;
+            template<typename Column, typename Vector> void operator()( Column, Vector& col ) {
+               const auto& src = std::get< detail::column_position<Column, Columns...>::value >( other );
+               col.assign( src.begin(), src.end() );
+            }
+         };
+
+         template<typename F>
+         void for_each_column( F f ) {
+            detail::for_each_column_impl<0, column_storage, F, Columns...>::apply( _columns, f );
+         }
+
+         template<typename F>
+         void for_each_column( F f )const {
+            detail::for_each_column_impl<0, const column_storage, F, Columns...>::apply( _columns, f );
+         }
+
+         void push_back_row( const value_type& v ) { for_each_column( push_field{ v } ); }
+         void store( const value_type& v )         { for_each_column( store_field{ v } ); }
+
+         value_type load( id_type id )const {
+            value_type v( []( value_type& ){}, _live.get_allocator() );
+            v.id = id;
+            for_each_column( load_field{ v } );
+            return v;
+         }
+
+         void clear_slot( id_type id ) {
+            for_each_column( clear_field{ id._id } );
+            if( _live[id._id] ) {
+               _live[id._id] = 0;
+               --_live_count;
+            }
+         }
+
+         void clamp_range( int64_t& begin, int64_t& end )const {
+            const int64_t n = int64_t( _live.size() );
+            if( end < 0 || end > n ) end = n;
+            begin = std::max<int64_t>( 0, std::min( begin, end ) );
+         }
+
+         void resize_slots( size_t n ) {
+            _live.resize( n );
+            for_each_column( resize_field{ n } );
+         }
+
+         boost::interprocess::deque< undo_state_type, allocator<undo_state_type> > _stack;
+
+         int64_t                         _revision = 0;
+         id_type                         _next_id = 0;
+         uint64_t                        _live_count = 0;
+         live_vector_type                _live;
+         column_storage                  _columns;
+         uint32_t                        _size_of_row = 0;
+         uint32_t                        _size_of_this = 0;
+         index_counters                  _counters;
+   };
+
+   template<typename Object, typename... Columns>
+   struct index_storage_type< column_index<Object, Columns...> > { typedef column_index<Object, Columns...> type; };
+
+} // namespace chainbase
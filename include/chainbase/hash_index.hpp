@@ -0,0 +1,298 @@
+#pragma once
+
+#include <chainbase/chainbase.hpp>
+
+#include <boost/functional/hash.hpp>
+#include <boost/interprocess/containers/vector.hpp>
+
+#include <functional>
+#include <limits>
+#include <type_traits>
+
+namespace chainbase {
+
+   /**
+    *  A hash index over KeyExtractor of the objects of a table, stored in the segment next to the
+    *  table like secondary_index, that never rehashes all at once:
+    *
+    *  @code
+    *  typedef hash_index< account_index, member<account,uint64_t,&account::number> > account_by_number;
+    *  const auto& by_number = db.add_secondary_index< account_by_number >();
+    *  const account* a = by_number.find( 42 );
+    *  @endcode
+    *
+    *  A hashed_unique index of a multi_index_container rebuilds its whole bucket array inside the
+    *  insert that crosses the maximum load factor, which on a table of millions of objects holds
+    *  the write lock for a long time.  This index grows by linear hashing instead: it starts with
+    *  2^level buckets and each insert that would exceed max_load_factor splits the single bucket
+    *  at the split position into itself and a new bucket at the end, moving only the entries of
+    *  that bucket whose next hash bit is set.  When every bucket of the round has been split the
+    *  level goes up by one.  Buckets live in fixed size segments reached through a small directory,
+    *  so adding a bucket never moves the others.  The cost of growth is thus spread evenly, one
+    *  short chain per insert, and no insert pays for more.
+    *
+    *  The index follows every create, modify, remove and undo of the table as an index_observer
+    *  and is rebuilt when the table changed while it was not attached.  Keys are stored by value
+    *  and must be trivially copyable; keys do not have to be unique.
+    */
+   template<typename MultiIndexType, typename KeyExtractor,
+            typename Hash = boost::hash< typename std::decay< typename KeyExtractor::result_type >::type >,
+            typename KeyEqual = std::equal_to< typename std::decay< typename KeyExtractor::result_type >::type > >
+   class hash_index : public abstract_secondary_index,
+                      public index_observer< typename MultiIndexType::value_type >
+   {
+      public:
+         typedef generic_index<MultiIndexType>                                     table_type;
+         typedef typename table_type::value_type                                   value_type;
+         typedef typename std::decay< typename KeyExtractor::result_type >::type   key_type;
+
+         static_assert( std::is_trivially_copyable<key_type>::value, "hash index keys are stored in the segment by value" );
+
+         /** buckets per segment of the directory, also the number of buckets of an empty index */
+         static const uint32_t segment_buckets = 1024;
+         static const uint32_t initial_level   = 10;
+         static_assert( segment_buckets == 1u << initial_level, "the first round of buckets fills one segment" );
+
+         /** entries per bucket above which an insert splits a bucket */
+         static constexpr double max_load_factor = 1.0;
+
+         /** the index is built by a single thread, the argument of add_secondary_index() is ignored */
+         explicit hash_index( uint32_t = 1 ){}
+         ~hash_index() { detach(); }
+
+         virtual void attach( database& db ) override
+         {
+            const auto name = boost::core::demangle( typeid( hash_index ).name() );
+            auto       sm   = db.get_segment_manager();
+
+            if( db.is_read_only() ) {
+               _table   = const_cast<table_type*>( &db.get_index<MultiIndexType>() );
+               _storage = sm->find<storage>( name.c_str() ).first;
+               if( !_storage || _storage->synced_change_count != _table->change_count() )
+                  BOOST_THROW_EXCEPTION( std::runtime_error( name + " is missing or out of date in read only database" ) );
+               return;
+            }
+
+            _table   = &db.get_mutable_index<MultiIndexType>();
+            _storage = sm->find_or_construct<storage>( name.c_str() )( sm );
+            _rebuilt = _storage->synced_change_count != _table->change_count();
+            if( _rebuilt ) rebuild();
+            _table->add_observer( *this );
+            _observing = true;
+         }
+
+         virtual void detach() override
+         {
+            if( _observing ) _table->remove_observer( *this );
+            _observing = false;
+            _table     = nullptr;
+            _storage   = nullptr;
+         }
+
+         /** rebuilds the index from the table, with enough buckets up front that no bucket is split */
+         void rebuild()
+         {
+            clear();
+            storage& s = *_storage;
+            const uint64_t objects = _table->indices().size();
+            while( double( uint64_t( 1 ) << s.level ) * max_load_factor < double( objects ) ) {
+               ++s.level;
+               while( s.directory.size() < ( uint64_t( 1 ) << s.level ) / segment_buckets )
+                  add_segment();
+            }
+            for( const auto& obj : _table->indices() )
+               insert( obj );
+            _storage->synced_change_count = _table->change_count();
+         }
+
+         /** true if the last attach had to rebuild the index */
+         bool rebuilt_on_attach()const { return _rebuilt; }
+
+         size_t   size()const         { return _storage->size; }
+         uint64_t bucket_count()const { return ( uint64_t( 1 ) << _storage->level ) + _storage->split; }
+         double   load_factor()const  { return double( size() ) / double( bucket_count() ); }
+
+         /** the object with the lowest id among those with key k, or nullptr */
+         const value_type* find( const key_type& k )const
+         {
+            int64_t id = -1;
+            for_each_id( k, [&]( int64_t i ) { if( id < 0 || i < id ) id = i; } );
+            return id < 0 ? nullptr : &_table->get( typename value_type::id_type( id ) );
+         }
+
+         size_t count( const key_type& k )const
+         {
+            size_t result = 0;
+            for_each_id( k, [&]( int64_t ) { ++result; } );
+            return result;
+         }
+
+         /** calls f with the id of every object with key k, in no particular order */
+         template<typename F>
+         void for_each_id( const key_type& k, F&& f )const
+         {
+            const uint64_t h = hash_of( k );
+            for( const node* n = head( bucket_of( h ) ).get(); n; n = n->next.get() )
+               if( n->hash == h && KeyEqual()( n->key, k ) ) f( n->id );
+         }
+
+      private:
+         struct node
+         {
+            uint64_t              hash;
+            key_type              key;
+            int64_t               id;
+            bip::offset_ptr<node> next;
+         };
+
+         typedef bip::offset_ptr<node> node_ptr;
+
+         struct bucket_segment
+         {
+            node_ptr heads[ segment_buckets ];
+         };
+
+         typedef bip::managed_mapped_file::segment_manager                                segment_manager_type;
+         typedef bip::allocator< node, segment_manager_type >                             node_allocator;
+         typedef bip::allocator< bucket_segment, segment_manager_type >                   segment_allocator;
+         typedef bip::offset_ptr< bucket_segment >                                        segment_ptr;
+         typedef bip::vector< segment_ptr, bip::allocator< segment_ptr, segment_manager_type > > directory_type;
+
+         struct storage
+         {
+            storage( segment_manager_type* sm ):directory( typename directory_type::allocator_type( sm ) ){}
+
+            directory_type directory;
+            uint32_t       level = initial_level;   ///< 2^level buckets at the start of the round
+            uint64_t       split = 0;               ///< next bucket of the round to split
+            uint64_t       size = 0;
+            uint64_t       synced_change_count = std::numeric_limits<uint64_t>::max();
+         };
+
+         segment_manager_type* segment_manager()const { return _storage->directory.get_allocator().get_segment_manager(); }
+
+         uint64_t bucket_of( uint64_t h )const
+         {
+            const uint64_t b = h & ( ( uint64_t( 1 ) << _storage->level ) - 1 );
+            return b < _storage->split ? h & ( ( uint64_t( 2 ) << _storage->level ) - 1 ) : b;
+         }
+
+         /** boost::hash of an integer is the integer, the low bits that pick the bucket are mixed with the others */
+         static uint64_t hash_of( const key_type& k )
+         {
+            uint64_t h = Hash()( k );
+            h ^= h >> 32;
+            h *= 0x9e3779b97f4a7c15ull;
+            h ^= h >> 29;
+            return h;
+         }
+
+         node_ptr& head( uint64_t b )const
+         {
+            return _storage->directory[ b / segment_buckets ]->heads[ b % segment_buckets ];
+         }
+
+         void add_segment()
+         {
+            segment_allocator alloc( segment_manager() );
+            auto seg = alloc.allocate( 1 );
+            new( &*seg ) bucket_segment();
+            _storage->directory.push_back( seg );
+         }
+
+         void insert( const value_type& obj )
+         {
+            const key_type k = KeyExtractor()( obj );
+            node_allocator alloc( segment_manager() );
+            node_ptr n = alloc.allocate( 1 );
+            new( &*n ) node{ hash_of( k ), k, obj.id._id, node_ptr() };
+
+            node_ptr& h = head( bucket_of( n->hash ) );
+            n->next = h;
+            h       = n;
+            ++_storage->size;
+
+            if( double( _storage->size ) > double( bucket_count() ) * max_load_factor )
+               split_one();
+         }
+
+         void erase( const value_type& obj )
+         {
+            const key_type k = KeyExtractor()( obj );
+            const uint64_t h = hash_of( k );
+            for( node_ptr* link = &head( bucket_of( h ) ); *link; link = &(*link)->next ) {
+               node* n = link->get();
+               if( n->id != obj.id._id || n->hash != h ) continue;
+               *link = n->next;
+               node_allocator( segment_manager() ).deallocate( node_ptr( n ), 1 );
+               --_storage->size;
+               return;
+            }
+         }
+
+         /** splits bucket split into itself and bucket split + 2^level by the next bit of the hash */
+         void split_one()
+         {
+            storage&       s   = *_storage;
+            const uint64_t bit = uint64_t( 1 ) << s.level;
+            if( ( s.split + bit ) / segment_buckets == s.directory.size() )
+               add_segment();
+            node_ptr&      low = head( s.split );
+            node_ptr&      high = head( s.split + bit );
+
+            node_ptr keep, move;
+            for( node_ptr n = low; n; ) {
+               node_ptr next = n->next;
+               node_ptr& list = ( n->hash & bit ) ? move : keep;
+               n->next = list;
+               list    = n;
+               n       = next;
+            }
+            low  = keep;
+            high = move;
+
+            if( ++s.split == bit ) {
+               s.split = 0;
+               ++s.level;
+            }
+         }
+
+         void clear()
+         {
+            storage& s = *_storage;
+            node_allocator    nodes( segment_manager() );
+            segment_allocator segments( segment_manager() );
+            for( auto& seg : s.directory ) {
+               for( auto& h : seg->heads ) {
+                  for( node_ptr n = h; n; ) {
+                     node_ptr next = n->next;
+                     nodes.deallocate( n, 1 );
+                     n = next;
+                  }
+               }
+               segments.deallocate( seg, 1 );
+            }
+            s.directory.clear();
+            s.level = initial_level;
+            s.split = 0;
+            s.size  = 0;
+            add_segment();
+         }
+
+         void synced() { _storage->synced_change_count = _table->change_count(); }
+
+         virtual void on_create( const value_type& obj ) override    { insert( obj ); synced(); }
+         virtual void on_modifying( const value_type& obj ) override { erase( obj ); synced(); }
+         virtual void on_modified( const value_type& obj ) override  { insert( obj ); synced(); }
+         virtual void on_remove( const value_type& obj ) override    { erase( obj ); synced(); }
+
+         table_type*  _table = nullptr;
+         storage*     _storage = nullptr;
+         bool         _observing = false;
+         bool         _rebuilt = false;
+   };
+
+   template<typename MultiIndexType, typename KeyExtractor, typename Hash, typename KeyEqual>
+   constexpr double hash_index<MultiIndexType, KeyExtractor, Hash, KeyEqual>::max_load_factor;
+
+} // namespace chainbase
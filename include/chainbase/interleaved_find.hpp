@@ -0,0 +1,145 @@
+#pragma once
+
+#include <boost/version.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <numeric>
+#include <type_traits>
+#include <vector>
+
+/**
+ *  The interleaved descents below walk the nodes of Boost.MultiIndex ordered indices through
+ *  iterator::get_node(), node_type::from_impl() and the parent/left/right links, which are not
+ *  public interface.  They are only compiled for the Boost releases whose node layout they were
+ *  checked against; for any other release, or when built with CHAINBASE_INTERLEAVED_FIND=0,
+ *  find_many looks keys up one find() at a time.
+ */
+#ifndef CHAINBASE_INTERLEAVED_FIND
+#  if BOOST_VERSION >= 106700 && BOOST_VERSION < 108700
+#     define CHAINBASE_INTERLEAVED_FIND 1
+#  else
+#     define CHAINBASE_INTERLEAVED_FIND 0
+#  endif
+#endif
+
+namespace chainbase {
+
+   namespace detail {
+
+      inline void prefetch_read( const void* p )
+      {
+#if defined(__GNUC__)
+         __builtin_prefetch( p, 0, 3 );
+#else
+         (void)p;
+#endif
+      }
+
+      /** orders keys like the index does, or by std::less when its comparator only takes mixed arguments */
+      template<typename Compare, typename Key>
+      auto key_less( const Compare& comp, const Key& a, const Key& b, int ) -> decltype( comp( a, b ) )
+      {
+         return comp( a, b );
+      }
+
+      template<typename Compare, typename Key>
+      bool key_less( const Compare&, const Key& a, const Key& b, long )
+      {
+         return std::less<Key>()( a, b );
+      }
+
+#if CHAINBASE_INTERLEAVED_FIND
+      /**
+       *  Looks up keys in an ordered index with up to group tree descents in flight at once.  The
+       *  descents take one step each in turn and every step prefetches the node it moves to, so the
+       *  cache and TLB misses of one descent are overlapped with the steps of the others instead of
+       *  being paid one after another.  Keys are visited in index order so that neighbouring
+       *  descents share the upper levels of the tree.
+       *
+       *  This walks the nodes of the index directly, the same way ordered_index_find() does, and
+       *  returns the same object find() would: the first with an equivalent key.
+       */
+      template<typename OrderedIndex, typename Key, typename MayExist>
+      auto interleaved_find( const OrderedIndex& idx, const std::vector<Key>& keys,
+                             std::vector<const typename OrderedIndex::value_type*>& results,
+                             MayExist&& may_exist, size_t group, int )
+         -> decltype( idx.key_comp(), std::remove_pointer< decltype( idx.end().get_node() ) >::type::from_impl( idx.end().get_node()->parent() ), void() )
+      {
+         typedef typename std::remove_pointer< decltype( idx.end().get_node() ) >::type node_type;
+
+         const auto& key  = idx.key_extractor();
+         const auto& comp = idx.key_comp();
+
+         std::vector<uint32_t> order;
+         order.reserve( keys.size() );
+         for( uint32_t i = 0; i < keys.size(); ++i )
+            if( may_exist( keys[i] ) ) order.push_back( i );
+         std::sort( order.begin(), order.end(), [&]( uint32_t a, uint32_t b ) { return key_less( comp, keys[a], keys[b], 0 ); } );
+
+         node_type* const header = idx.end().get_node();
+         node_type* const root   = node_type::from_impl( header->parent() );
+         if( !root ) return;
+
+         struct descent
+         {
+            node_type* top;
+            node_type* y;
+            uint32_t   key;
+         };
+
+         std::vector<descent> active;
+         active.reserve( std::max<size_t>( 1, group ) );
+         size_t next = 0;
+         while( next < order.size() && active.size() < std::max<size_t>( 1, group ) )
+            active.push_back( descent{ root, header, order[next++] } );
+
+         while( !active.empty() ) {
+            for( size_t i = 0; i < active.size(); ) {
+               descent& d = active[i];
+               const Key& k = keys[ d.key ];
+               if( d.top ) {
+                  if( !comp( key( d.top->value() ), k ) ) {
+                     d.y   = d.top;
+                     d.top = node_type::from_impl( d.top->left() );
+                  } else {
+                     d.top = node_type::from_impl( d.top->right() );
+                  }
+                  if( d.top ) prefetch_read( d.top );
+                  ++i;
+                  continue;
+               }
+
+               if( d.y != header && !comp( k, key( d.y->value() ) ) )
+                  results[ d.key ] = &d.y->value();
+
+               if( next < order.size() ) {
+                  d = descent{ root, header, order[next++] };
+                  ++i;
+               } else {
+                  d = active.back();
+                  active.pop_back();
+               }
+            }
+         }
+      }
+
+#endif
+
+      /** indices without an order (hashed), or whose nodes are not known, are searched one key at a time */
+      template<typename Index, typename Key, typename MayExist>
+      void interleaved_find( const Index& idx, const std::vector<Key>& keys,
+                             std::vector<const typename Index::value_type*>& results,
+                             MayExist&& may_exist, size_t, long )
+      {
+         for( size_t i = 0; i < keys.size(); ++i ) {
+            if( !may_exist( keys[i] ) ) continue;
+            auto itr = idx.find( keys[i] );
+            if( itr != idx.end() ) results[i] = &*itr;
+         }
+      }
+
+   } // namespace detail
+
+} // namespace chainbase
@@ -0,0 +1,253 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#if defined(__SSE2__)
+   #include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+   #include <immintrin.h>
+#endif
+
+namespace chainbase {
+
+   template<typename T> class oid;
+
+   namespace detail {
+
+      inline uint64_t load_big_endian64( const char* p )
+      {
+         uint64_t w;
+         memcpy( &w, p, 8 );
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+         w = __builtin_bswap64( w );
+#endif
+         return w;
+      }
+
+      inline uint8_t  to_big_endian( uint8_t v )  { return v; }
+#if defined(__GNUC__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      inline uint16_t to_big_endian( uint16_t v ) { return __builtin_bswap16( v ); }
+      inline uint32_t to_big_endian( uint32_t v ) { return __builtin_bswap32( v ); }
+      inline uint64_t to_big_endian( uint64_t v ) { return __builtin_bswap64( v ); }
+      inline unsigned long long to_big_endian( unsigned long long v ) { return __builtin_bswap64( v ); }
+#else
+      template<typename U>
+      inline U to_big_endian( U v )
+      {
+         U result;
+         char* out = reinterpret_cast<char*>( &result );
+         for( size_t i = 0; i < sizeof(U); ++i )
+            out[i] = char( uint8_t( v >> ( 8 * ( sizeof(U) - 1 - i ) ) ) );
+         return result;
+      }
+#endif
+
+      inline int compare_at( const char* a, const char* b, size_t i )
+      {
+         return int( uint8_t( a[i] ) ) - int( uint8_t( b[i] ) );
+      }
+
+      /**
+       *  Three way, length aware comparison of two byte ranges with the same result as memcmp over
+       *  the common prefix followed by a length comparison.
+       *
+       *  The common prefix is scanned 32 (AVX2) or 16 (SSE2) bytes at a time, the first mismatch is
+       *  located from the equality mask.  Remaining bytes are compared as big endian 64 bit words and
+       *  finally one byte at a time.  Everything is inline so short keys do not pay for a call into
+       *  the C library.
+       */
+      inline int compare_bytes( const char* a, size_t a_size, const char* b, size_t b_size )
+      {
+         const size_t n = std::min( a_size, b_size );
+         size_t i = 0;
+
+#if defined(__AVX2__)
+         for( ; i + 32 <= n; i += 32 ) {
+            __m256i x = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( a + i ) );
+            __m256i y = _mm256_loadu_si256( reinterpret_cast<const __m256i*>( b + i ) );
+            uint32_t diff = ~uint32_t( _mm256_movemask_epi8( _mm256_cmpeq_epi8( x, y ) ) );
+            if( diff ) return compare_at( a, b, i + __builtin_ctz( diff ) );
+         }
+#endif
+#if defined(__SSE2__)
+         for( ; i + 16 <= n; i += 16 ) {
+            __m128i x = _mm_loadu_si128( reinterpret_cast<const __m128i*>( a + i ) );
+            __m128i y = _mm_loadu_si128( reinterpret_cast<const __m128i*>( b + i ) );
+            uint32_t diff = ~uint32_t( _mm_movemask_epi8( _mm_cmpeq_epi8( x, y ) ) ) & 0xffffu;
+            if( diff ) return compare_at( a, b, i + __builtin_ctz( diff ) );
+         }
+#endif
+         for( ; i + 8 <= n; i += 8 ) {
+            uint64_t x = load_big_endian64( a + i );
+            uint64_t y = load_big_endian64( b + i );
+            if( x != y ) return x < y ? -1 : 1;
+         }
+         for( ; i < n; ++i ) {
+            if( a[i] != b[i] ) return compare_at( a, b, i );
+         }
+         return a_size < b_size ? -1 : ( a_size > b_size ? 1 : 0 );
+      }
+
+      /**
+       *  compare_bytes for two ranges of the same, small and usually constant, size: big endian
+       *  words need no mismatch search, and with a constant size the loop unrolls to a few compares
+       */
+      inline int compare_fixed( const char* a, const char* b, size_t n )
+      {
+         size_t i = 0;
+         for( ; i + 8 <= n; i += 8 ) {
+            uint64_t x = load_big_endian64( a + i );
+            uint64_t y = load_big_endian64( b + i );
+            if( x != y ) return x < y ? -1 : 1;
+         }
+         if( i + 4 <= n ) {
+            uint32_t x, y;
+            memcpy( &x, a + i, 4 );
+            memcpy( &y, b + i, 4 );
+            x = to_big_endian( x );
+            y = to_big_endian( y );
+            if( x != y ) return x < y ? -1 : 1;
+            i += 4;
+         }
+         for( ; i < n; ++i ) {
+            if( a[i] != b[i] ) return compare_at( a, b, i );
+         }
+         return 0;
+      }
+
+      /** number of bytes key_encoder<T> produces */
+      template<typename... Ts> struct encoded_size_of;
+      template<> struct encoded_size_of<> { static const size_t value = 0; };
+
+   } // namespace detail
+
+   /**
+    *  Encodes a fixed width value into bytes whose unsigned lexicographic order matches the natural
+    *  order of the value (big endian, with the sign bit of signed integers flipped).
+    */
+   template<typename T, typename Enable = void>
+   struct key_encoder;
+
+   template<typename T>
+   struct key_encoder< T, typename std::enable_if< std::is_integral<T>::value >::type >
+   {
+      static const size_t size = sizeof(T);
+
+      static void encode( const T& v, char* out )
+      {
+         typedef typename std::make_unsigned<T>::type unsigned_type;
+         unsigned_type u = unsigned_type( v );
+         if( std::is_signed<T>::value ) u ^= unsigned_type( 1 ) << ( 8 * sizeof(T) - 1 );
+         u = detail::to_big_endian( u );
+         memcpy( out, &u, sizeof(T) );
+      }
+   };
+
+   template<typename T>
+   struct key_encoder< T, typename std::enable_if< std::is_enum<T>::value >::type >
+   {
+      typedef typename std::underlying_type<T>::type underlying_type;
+      static const size_t size = sizeof(underlying_type);
+      static void encode( const T& v, char* out ) { key_encoder<underlying_type>::encode( underlying_type( v ), out ); }
+   };
+
+   template<typename T>
+   struct key_encoder< oid<T> >
+   {
+      static const size_t size = sizeof(int64_t);
+      static void encode( const oid<T>& v, char* out ) { key_encoder<int64_t>::encode( v._id, out ); }
+   };
+
+   template<size_t N>
+   struct key_encoder< std::array<char, N> >
+   {
+      static const size_t size = N;
+      static void encode( const std::array<char, N>& v, char* out ) { memcpy( out, v.data(), N ); }
+   };
+
+   namespace detail {
+      template<typename T, typename... Ts> struct encoded_size_of<T, Ts...> {
+         static const size_t value = key_encoder<T>::size + encoded_size_of<Ts...>::value;
+      };
+   }
+
+   /**
+    *  A composite key flattened into N bytes by key_encoder, compared with a single compare_bytes.
+    */
+   template<size_t N>
+   struct normalized_key
+   {
+      std::array<char, N> data;
+
+      friend bool operator <  ( const normalized_key& a, const normalized_key& b ) { return detail::compare_fixed( a.data.data(), b.data.data(), N ) < 0; }
+      friend bool operator >  ( const normalized_key& a, const normalized_key& b ) { return b < a; }
+      friend bool operator == ( const normalized_key& a, const normalized_key& b ) { return memcmp( a.data.data(), b.data.data(), N ) == 0; }
+      friend bool operator != ( const normalized_key& a, const normalized_key& b ) { return !( a == b ); }
+   };
+
+   namespace detail {
+      inline void encode_fields( char* ) {}
+
+      template<typename T, typename... Ts>
+      void encode_fields( char* out, const T& v, const Ts&... rest )
+      {
+         key_encoder<T>::encode( v, out );
+         encode_fields( out + key_encoder<T>::size, rest... );
+      }
+
+      template<typename Value>
+      void extract_fields( const Value&, char* ) {}
+
+      template<typename Value, typename Extractor, typename... Extractors>
+      void extract_fields( const Value& v, char* out, const Extractor& e, const Extractors&... rest )
+      {
+         typedef typename std::decay< typename Extractor::result_type >::type field_type;
+         key_encoder<field_type>::encode( e( v ), out );
+         extract_fields( v, out + key_encoder<field_type>::size, rest... );
+      }
+   }
+
+   /**
+    *  Builds the normalized_key used to search an index keyed by normalized_composite_key, the
+    *  arguments must have the same types as the fields of the key.
+    */
+   template<typename... Ts>
+   normalized_key< detail::encoded_size_of<Ts...>::value > make_normalized_key( const Ts&... fields )
+   {
+      normalized_key< detail::encoded_size_of<Ts...>::value > k;
+      detail::encode_fields( k.data.data(), fields... );
+      return k;
+   }
+
+   /**
+    *  A boost::multi_index key extractor that concatenates the order preserving encodings of the
+    *  fields selected by KeyExtractors.  Ordering an index by it matches ordering by a composite_key
+    *  of the same fields with std::less, but every comparison is one fixed width byte compare
+    *  instead of a field by field walk.
+    *
+    *  @code
+    *  ordered_unique< tag<by_owner_date>,
+    *                  normalized_composite_key< book, member<book,int,&book::owner>, member<book,int,&book::date> > >
+    *  ...
+    *  idx.find( make_normalized_key( owner, date ) );
+    *  @endcode
+    */
+   template<typename Value, typename... KeyExtractors>
+   struct normalized_composite_key
+   {
+      typedef normalized_key< detail::encoded_size_of< typename std::decay< typename KeyExtractors::result_type >::type... >::value > result_type;
+
+      result_type operator()( const Value& v )const
+      {
+         result_type k;
+         detail::extract_fields( v, k.data.data(), KeyExtractors()... );
+         return k;
+      }
+   };
+
+} // namespace chainbase
@@ -0,0 +1,186 @@
+#pragma once
+
+#include <chainbase/chainbase.hpp>
+
+#include <boost/interprocess/containers/vector.hpp>
+
+#include <array>
+#include <limits>
+
+namespace chainbase {
+
+   /**
+    *  A counting Bloom filter over the keys of the index tagged Tag of a table, kept in the segment
+    *  and consulted by database::find< Object, Tag >() so that most lookups of keys that do not
+    *  exist return without walking the tree:
+    *
+    *  @code
+    *  db.add_secondary_index< key_filter< account_index, by_name > >();
+    *  db.find< account_object, by_name >( name ); // usually answered by one filter block
+    *  @endcode
+    *
+    *  The filter is blocked: all probes for a key fall in one 64 byte block, so a miss touches a
+    *  single cache line (and page) of the filter.  Each block holds 128 four bit counters and every
+    *  key sets seven of them, at about ten counters per key this gives a false positive rate near
+    *  one percent.  Counters that saturate are never decremented again, so removals can only leave
+    *  false positives behind, never false negatives.  The filter doubles (and is rebuilt from the
+    *  table) when it holds more keys than it was sized for.
+    *
+    *  It is maintained like a secondary_index, through create, modify, remove and undo, and is meant
+    *  for unique indices whose keys have a key_filter_hash.
+    */
+   template<typename MultiIndexType, typename Tag>
+   class key_filter : public abstract_secondary_index,
+                      public abstract_key_filter,
+                      public index_observer< typename MultiIndexType::value_type >
+   {
+      public:
+         typedef generic_index<MultiIndexType>                                     table_type;
+         typedef typename table_type::value_type                                   value_type;
+         typedef typename MultiIndexType::template index<Tag>::type                tagged_index_type;
+         typedef typename tagged_index_type::key_type                              key_type;
+
+         static_assert( key_filter_hash<key_type>::supported, "key_filter requires a key with a key_filter_hash" );
+
+         static const uint32_t counters_per_block = 128;
+         static const uint32_t probes             = 7;
+         static const uint32_t counters_per_key   = 10;
+         static const uint64_t min_capacity       = 1024;
+
+         explicit key_filter( uint32_t = 1 ){}
+         ~key_filter() { detach(); }
+
+         virtual void attach( database& db ) override
+         {
+            const auto name = boost::core::demangle( typeid( key_filter ).name() );
+            auto       sm   = db.get_segment_manager();
+
+            if( db.is_read_only() ) {
+               _table   = const_cast<table_type*>( &db.get_index<MultiIndexType>() );
+               _storage = sm->find<storage>( name.c_str() ).first;
+               if( !_storage || _storage->synced_change_count != _table->change_count() )
+                  BOOST_THROW_EXCEPTION( std::runtime_error( name + " is missing or out of date in read only database" ) );
+            } else {
+               _table   = &db.get_mutable_index<MultiIndexType>();
+               _storage = sm->find_or_construct<storage>( name.c_str() )( block_allocator( sm ) );
+               if( _storage->synced_change_count != _table->change_count() )
+                  rebuild( std::max<uint64_t>( uint64_t( min_capacity ), 2 * _table->indices().size() ) );
+               _table->add_observer( *this );
+               _observing = true;
+            }
+
+            _db = &db;
+            _db->set_key_filter( value_type::type_id, typeid( tagged_index_type ), this );
+         }
+
+         virtual void detach() override
+         {
+            if( _db ) _db->set_key_filter( value_type::type_id, typeid( tagged_index_type ), nullptr );
+            if( _observing ) _table->remove_observer( *this );
+            _observing = false;
+            _db        = nullptr;
+            _table     = nullptr;
+            _storage   = nullptr;
+         }
+
+         virtual bool may_contain( uint64_t hash )const override
+         {
+            const block& b = _storage->blocks[ hash & ( _storage->blocks.size() - 1 ) ];
+            uint64_t     h = mix( hash );
+            for( uint32_t i = 0; i < probes; ++i, h >>= 7 ) {
+               const uint32_t c = h & ( counters_per_block - 1 );
+               if( !( b[ c / 2 ] >> ( 4 * ( c & 1 ) ) & 0xf ) ) return false;
+            }
+            return true;
+         }
+
+         bool may_contain( const key_type& k )const { return may_contain( key_filter_hash<key_type>::hash( k ) ); }
+
+         /** number of keys in the filter and the number it is sized for */
+         uint64_t keys()const     { return _storage->keys; }
+         uint64_t capacity()const { return _storage->blocks.size() * counters_per_block / counters_per_key; }
+         uint64_t bytes()const    { return _storage->blocks.size() * sizeof(block); }
+
+         /** resizes the filter for capacity keys and refills it from the table */
+         void rebuild( uint64_t capacity )
+         {
+            uint64_t blocks = 1;
+            while( blocks * counters_per_block < capacity * counters_per_key ) blocks *= 2;
+
+            _storage->blocks.clear();
+            _storage->blocks.resize( blocks, block() );
+            _storage->keys = 0;
+            for( const auto& obj : _table->indices().template get<Tag>() )
+               add( obj );
+            _storage->synced_change_count = _table->change_count();
+         }
+
+      private:
+         typedef std::array<uint8_t, counters_per_block / 2>                       block;
+         typedef bip::allocator< block, bip::managed_mapped_file::segment_manager > block_allocator;
+
+         struct storage
+         {
+            storage( const block_allocator& a ):blocks( a ){}
+
+            bip::vector< block, block_allocator > blocks;
+            uint64_t                              keys = 0;
+            uint64_t                              synced_change_count = std::numeric_limits<uint64_t>::max();
+         };
+
+         /** second, independent hash selecting the counters inside the block */
+         static uint64_t mix( uint64_t h )
+         {
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 33;
+            return h;
+         }
+
+         uint64_t hash_of( const value_type& obj )const
+         {
+            return key_filter_hash<key_type>::hash( _table->indices().template get<Tag>().key_extractor()( obj ) );
+         }
+
+         void update( const value_type& obj, bool insert )
+         {
+            const uint64_t hash = hash_of( obj );
+            block&         b    = _storage->blocks[ hash & ( _storage->blocks.size() - 1 ) ];
+            uint64_t       h    = mix( hash );
+            for( uint32_t i = 0; i < probes; ++i, h >>= 7 ) {
+               const uint32_t c     = h & ( counters_per_block - 1 );
+               const uint32_t shift = 4 * ( c & 1 );
+               uint8_t&       byte  = b[ c / 2 ];
+               const uint32_t count = byte >> shift & 0xf;
+               if( count == 0xf ) continue; // saturated, the true count is unknown
+               if( insert )     byte += uint8_t( 1 << shift );
+               else if( count ) byte -= uint8_t( 1 << shift );
+            }
+            if( insert ) ++_storage->keys; else --_storage->keys;
+         }
+
+         void add( const value_type& obj )    { update( obj, true ); }
+         void remove( const value_type& obj ) { update( obj, false ); }
+
+         void synced() { _storage->synced_change_count = _table->change_count(); }
+
+         virtual void on_create( const value_type& obj ) override
+         {
+            if( _storage->keys >= capacity() ) {
+               rebuild( 2 * capacity() ); // obj is already in the table
+               return;
+            }
+            add( obj );
+            synced();
+         }
+         virtual void on_modifying( const value_type& obj ) override { remove( obj ); synced(); }
+         virtual void on_modified( const value_type& obj ) override  { add( obj ); synced(); }
+         virtual void on_remove( const value_type& obj ) override    { remove( obj ); synced(); }
+
+         database*    _db = nullptr;
+         table_type*  _table = nullptr;
+         storage*     _storage = nullptr;
+         bool         _observing = false;
+   };
+
+} // namespace chainbase
@@ -0,0 +1,329 @@
+#pragma once
+
+#include <boost/interprocess/managed_mapped_file.hpp>
+#include <boost/interprocess/containers/map.hpp>
+#include <boost/interprocess/allocators/allocator.hpp>
+#include <boost/interprocess/offset_ptr.hpp>
+
+#include <chainbase/key_compare.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+namespace chainbase {
+
+   namespace bip = boost::interprocess;
+
+   namespace detail {
+
+      /** cheap, deterministic 64 bit hash used to bucket pooled strings */
+      inline uint64_t string_hash( const char* data, size_t size )
+      {
+         const uint64_t m = 0x9E3779B97F4A7C15ull;
+         uint64_t h = size * m;
+         size_t i = 0;
+         for( ; i + 8 <= size; i += 8 ) {
+            uint64_t w;
+            memcpy( &w, data + i, 8 );
+            h = ( h ^ w ) * m;
+            h ^= h >> 29;
+         }
+         uint64_t tail = 0;
+         memcpy( &tail, data + i, size - i );
+         h = ( h ^ tail ) * m;
+         return h ^ ( h >> 32 );
+      }
+
+      /** first 8 bytes in big endian order (zero padded) so integer comparison matches memcmp order */
+      inline uint64_t string_prefix( const char* data, size_t size )
+      {
+         uint64_t p = 0;
+         size_t n = std::min<size_t>( size, 8 );
+         for( size_t i = 0; i < n; ++i )
+            p |= uint64_t( uint8_t( data[i] ) ) << ( 56 - 8 * i );
+         return p;
+      }
+
+   } // namespace detail
+
+   /**
+    *  A string type for objects stored in the database segment.
+    *
+    *  Strings of up to inline_capacity bytes are stored inside the object itself.  Longer strings are
+    *  interned in a reference counted pool kept in the segment: every pooled_string with the same
+    *  contents points at the same buffer, so copies (including the copies made by the undo history)
+    *  cost a reference count increment and equality between two long strings is a pointer compare.
+    *
+    *  Long strings cache their first eight bytes next to the pointer so most ordering comparisons
+    *  are decided without touching the pooled buffer.  Comparison is length aware, embedded nulls
+    *  are allowed.
+    *
+    *  All mutation must happen under the database write lock, reference counts are not atomic.
+    */
+   class pooled_string
+   {
+      public:
+         typedef bip::managed_mapped_file::segment_manager segment_manager_type;
+         typedef const char*                               const_iterator;
+
+         static const uint32_t inline_capacity = 19;
+
+         template<typename Allocator>
+         explicit pooled_string( const Allocator& a )
+         :_segment_manager( a.get_segment_manager() ) { clear_storage(); }
+
+         template<typename Allocator>
+         pooled_string( const char* s, const Allocator& a )
+         :_segment_manager( a.get_segment_manager() ) { clear_storage(); assign( s, strlen( s ) ); }
+
+         template<typename Allocator>
+         pooled_string( const std::string& s, const Allocator& a )
+         :_segment_manager( a.get_segment_manager() ) { clear_storage(); assign( s.data(), s.size() ); }
+
+         pooled_string( const pooled_string& o )
+         :_segment_manager( o._segment_manager )
+         {
+            clear_storage();
+            *this = o;
+         }
+
+         pooled_string( pooled_string&& o )
+         :_segment_manager( o._segment_manager )
+         {
+            clear_storage();
+            steal( o );
+         }
+
+         ~pooled_string() { release(); }
+
+         pooled_string& operator = ( const pooled_string& o )
+         {
+            if( this == &o ) return *this;
+            if( o.is_inline() || _segment_manager != o._segment_manager ) {
+               assign( o.data(), o.size() );
+            } else {
+               ++o._long.ptr->refcount;
+               release();
+               _size = o._size;
+               _long.ptr  = o._long.ptr;
+               _long.prefix = o._long.prefix;
+            }
+            return *this;
+         }
+
+         pooled_string& operator = ( pooled_string&& o )
+         {
+            if( this == &o ) return *this;
+            if( _segment_manager != o._segment_manager ) return *this = static_cast<const pooled_string&>( o );
+            release();
+            steal( o );
+            return *this;
+         }
+
+         pooled_string& operator = ( const std::string& s ) { assign( s.data(), s.size() ); return *this; }
+         pooled_string& operator = ( const char* s )        { assign( s, strlen( s ) ); return *this; }
+
+         void assign( const char* s, size_t n )
+         {
+            if( n <= inline_capacity ) {
+               // s may point into our own pooled buffer, only release after the copy
+               char tmp[inline_capacity + 1];
+               memcpy( tmp, s, n );
+               release();
+               memcpy( _inline, tmp, n );
+               _inline[n] = '\0';
+               _size = uint32_t( n );
+               return;
+            }
+            entry* e = intern( s, n );
+            release();
+            _size = uint32_t( n );
+            _long.ptr  = e;
+            _long.prefix = detail::string_prefix( s, n );
+         }
+
+         void clear() { release(); }
+
+         const char*    data()const   { return is_inline() ? _inline : _long.ptr->data(); }
+         const char*    c_str()const  { return data(); }
+         size_t         size()const   { return _size; }
+         size_t         length()const { return _size; }
+         bool           empty()const  { return _size == 0; }
+         const_iterator begin()const  { return data(); }
+         const_iterator end()const    { return data() + _size; }
+         std::string    str()const    { return std::string( data(), _size ); }
+
+         bool           is_inline()const { return _size <= inline_capacity; }
+
+         /** number of pooled_strings sharing this buffer, 0 for inline strings */
+         uint32_t       use_count()const { return is_inline() ? 0 : _long.ptr->refcount; }
+
+         segment_manager_type* get_segment_manager()const { return _segment_manager.get(); }
+
+         int compare( const char* s, size_t n )const
+         {
+            return detail::compare_bytes( data(), _size, s, n );
+         }
+
+         int compare( const pooled_string& o )const
+         {
+            if( !is_inline() && !o.is_inline() ) {
+               if( _long.ptr == o._long.ptr ) return 0;
+               if( _long.prefix != o._long.prefix ) return _long.prefix < o._long.prefix ? -1 : 1;
+            }
+            return detail::compare_bytes( data(), _size, o.data(), o._size );
+         }
+
+         friend bool operator == ( const pooled_string& a, const pooled_string& b )
+         {
+            if( a._size != b._size ) return false;
+            if( a.is_inline() ) return memcmp( a._inline, b._inline, a._size ) == 0;
+            // interned: equal contents in the same segment always share an entry
+            if( a._segment_manager == b._segment_manager ) return a._long.ptr == b._long.ptr;
+            return a._long.prefix == b._long.prefix && memcmp( a.data(), b.data(), a._size ) == 0;
+         }
+         friend bool operator != ( const pooled_string& a, const pooled_string& b ) { return !( a == b ); }
+         friend bool operator <  ( const pooled_string& a, const pooled_string& b ) { return a.compare( b ) < 0; }
+
+         friend bool operator == ( const pooled_string& a, const std::string& b ) { return a.compare( b.data(), b.size() ) == 0; }
+         friend bool operator == ( const std::string& a, const pooled_string& b ) { return b == a; }
+         friend bool operator <  ( const pooled_string& a, const std::string& b ) { return a.compare( b.data(), b.size() ) < 0; }
+         friend bool operator <  ( const std::string& a, const pooled_string& b ) { return b.compare( a.data(), a.size() ) > 0; }
+
+         /**
+          *  Number of distinct long strings currently interned in the segment
+          */
+         static size_t pool_size( segment_manager_type* sm )
+         {
+            auto p = sm->find< string_pool >( bip::unique_instance ).first;
+            return p ? p->entries.size() : 0;
+         }
+
+      private:
+         struct string_pool;
+
+         struct entry
+         {
+            uint32_t                     refcount;
+            uint32_t                     size;
+            uint64_t                     hash;
+            bip::offset_ptr<string_pool> pool;
+
+            char*       data()       { return reinterpret_cast<char*>( this + 1 ); }
+            const char* data()const  { return reinterpret_cast<const char*>( this + 1 ); }
+         };
+
+         struct pool_key
+         {
+            uint64_t                     hash;
+            uint32_t                     size;
+            bip::offset_ptr<const char>  data;
+         };
+
+         struct pool_key_less
+         {
+            bool operator()( const pool_key& a, const pool_key& b )const
+            {
+               if( a.hash != b.hash ) return a.hash < b.hash;
+               if( a.size != b.size ) return a.size < b.size;
+               return memcmp( a.data.get(), b.data.get(), a.size ) < 0;
+            }
+         };
+
+         typedef std::pair< const pool_key, bip::offset_ptr<entry> >                     pool_value_type;
+         typedef bip::allocator< pool_value_type, segment_manager_type >                  pool_allocator_type;
+         typedef bip::map< pool_key, bip::offset_ptr<entry>, pool_key_less, pool_allocator_type > pool_map_type;
+
+         struct string_pool
+         {
+            string_pool( segment_manager_type* sm )
+            :entries( pool_allocator_type( sm ) ){}
+
+            pool_map_type entries;
+         };
+
+         entry* intern( const char* s, size_t n )
+         {
+            auto sm = _segment_manager.get();
+            auto pool = sm->find_or_construct< string_pool >( bip::unique_instance )( sm );
+
+            pool_key key;
+            key.hash = detail::string_hash( s, n );
+            key.size = uint32_t( n );
+            key.data = s;
+
+            auto itr = pool->entries.find( key );
+            if( itr != pool->entries.end() ) {
+               ++itr->second->refcount;
+               return itr->second.get();
+            }
+
+            entry* e = static_cast<entry*>( sm->allocate( sizeof(entry) + n + 1 ) );
+            e->refcount = 1;
+            e->size     = uint32_t( n );
+            e->hash     = key.hash;
+            new( &e->pool ) bip::offset_ptr<string_pool>( pool );
+            memcpy( e->data(), s, n );
+            e->data()[n] = '\0';
+
+            key.data = e->data();
+            try {
+               pool->entries.emplace( key, bip::offset_ptr<entry>( e ) );
+            } catch( ... ) {
+               sm->deallocate( e );
+               throw;
+            }
+            return e;
+         }
+
+         void release()
+         {
+            if( !is_inline() ) {
+               entry* e = _long.ptr.get();
+               if( --e->refcount == 0 ) {
+                  pool_key key;
+                  key.hash = e->hash;
+                  key.size = e->size;
+                  key.data = e->data();
+                  e->pool->entries.erase( key );
+                  _segment_manager->deallocate( e );
+               }
+            }
+            clear_storage();
+         }
+
+         void steal( pooled_string& o )
+         {
+            _size = o._size;
+            if( o.is_inline() ) {
+               memcpy( _inline, o._inline, o._size + 1 );
+            } else {
+               _long.ptr  = o._long.ptr;
+               _long.prefix = o._long.prefix;
+            }
+            o.clear_storage();
+         }
+
+         void clear_storage()
+         {
+            _size = 0;
+            memset( _inline, 0, sizeof(_inline) );
+         }
+
+         struct long_storage
+         {
+            bip::offset_ptr<entry>  ptr;
+            uint64_t                prefix;
+         };
+
+         bip::offset_ptr<segment_manager_type>  _segment_manager;
+         uint32_t                               _size = 0;
+         union {
+            char                                _inline[inline_capacity + 1];
+            long_storage                        _long;
+         };
+   };
+
+} // namespace chainbase
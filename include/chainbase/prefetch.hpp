@@ -0,0 +1,153 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace chainbase {
+
+   /**
+    *  Tuning of prefetched_for_each()
+    */
+   struct prefetch_options
+   {
+      /** how many objects the read ahead may run ahead of the visitor */
+      uint32_t window = 1024;
+      /** how many objects are gathered before their pages are advised */
+      uint32_t batch = 64;
+      /** walk ahead on a helper thread, otherwise batches are read ahead inline */
+      bool     helper_thread = true;
+   };
+
+   namespace detail {
+
+      inline uintptr_t page_size()
+      {
+         static const uintptr_t size = uintptr_t( sysconf( _SC_PAGESIZE ) );
+         return size;
+      }
+
+      /**
+       *  Records the pages covering one object of the mapped segment and issues MADV_WILLNEED for
+       *  them a batch at a time, coalescing adjacent pages into one call.
+       */
+      class page_advisor
+      {
+         public:
+            explicit page_advisor( size_t batch ):_batch( batch ){ _pages.reserve( 2 * batch ); }
+            ~page_advisor() { flush(); }
+
+            void add( const void* obj, size_t size )
+            {
+               const uintptr_t mask  = ~( page_size() - 1 );
+               const uintptr_t first = uintptr_t( obj ) & mask;
+               const uintptr_t last  = ( uintptr_t( obj ) + size - 1 ) & mask;
+               for( uintptr_t p = first; p <= last; p += page_size() )
+                  _pages.push_back( p );
+               if( ++_objects >= _batch ) flush();
+            }
+
+            void flush()
+            {
+               _objects = 0;
+               if( _pages.empty() ) return;
+               std::sort( _pages.begin(), _pages.end() );
+               _pages.erase( std::unique( _pages.begin(), _pages.end() ), _pages.end() );
+
+               uintptr_t start = _pages.front();
+               uintptr_t stop  = start + page_size();
+               for( size_t i = 1; i <= _pages.size(); ++i ) {
+                  if( i < _pages.size() && _pages[i] == stop ) {
+                     stop += page_size();
+                     continue;
+                  }
+                  madvise( reinterpret_cast<void*>( start ), stop - start, MADV_WILLNEED );
+                  if( i < _pages.size() ) {
+                     start = _pages[i];
+                     stop  = start + page_size();
+                  }
+               }
+               _pages.clear();
+            }
+
+         private:
+            size_t                 _batch;
+            size_t                 _objects = 0;
+            std::vector<uintptr_t> _pages;
+      };
+
+   } // namespace detail
+
+   /**
+    *  Visits every object in [begin, end) in order like a plain loop, but reads ahead of the visitor
+    *  so that iterating a range of a cold (not yet paged in) database overlaps page faults with the
+    *  work done by visit.
+    *
+    *  Tree nodes are scattered through the segment and the address of the next node is only known
+    *  once the current one is resident, so the read ahead has to walk the range itself.  With a
+    *  helper thread the walk (and the page faults it takes) runs up to window objects ahead of the
+    *  visitor; inline, each batch is walked and advised before it is visited, which only helps
+    *  objects that span more pages than the one the walk faults in to reach them (chainbase_bench
+    *  prefetched_scans measures both).  The pages of every object are passed to
+    *  madvise( MADV_WILLNEED ) in batches.
+    *
+    *  The caller must hold the read lock for the duration of the call and visit must not modify the
+    *  index being iterated.
+    */
+   template<typename Iterator, typename Visitor>
+   void prefetched_for_each( Iterator begin, Iterator end, Visitor&& visit, const prefetch_options& options = prefetch_options() )
+   {
+      typedef typename std::iterator_traits<Iterator>::value_type value_type;
+      const size_t batch = std::max<size_t>( 1, options.batch );
+
+      if( !options.helper_thread ) {
+         std::vector<Iterator> ahead;
+         ahead.reserve( batch );
+         while( begin != end ) {
+            {
+               detail::page_advisor advisor( batch );
+               for( auto itr = begin; itr != end && ahead.size() < batch; ++itr ) {
+                  advisor.add( &*itr, sizeof(value_type) );
+                  ahead.push_back( itr );
+               }
+            }
+            for( const auto& itr : ahead ) visit( *itr );
+            begin = ++ahead.back();
+            ahead.clear();
+         }
+         return;
+      }
+
+      std::atomic<uint64_t> visited( 0 );
+      std::atomic<bool>     stop( false );
+      const uint64_t        window = std::max<uint64_t>( batch, options.window );
+
+      std::thread helper( [&]() {
+         detail::page_advisor advisor( batch );
+         uint64_t n = 0;
+         for( auto itr = begin; itr != end && !stop.load( std::memory_order_relaxed ); ++itr, ++n ) {
+            while( n > visited.load( std::memory_order_relaxed ) + window && !stop.load( std::memory_order_relaxed ) )
+               std::this_thread::yield();
+            advisor.add( &*itr, sizeof(value_type) );
+         }
+      });
+
+      struct join_on_exit {
+         std::thread&       t;
+         std::atomic<bool>& s;
+         ~join_on_exit() { s = true; t.join(); }
+      } joiner{ helper, stop };
+
+      uint64_t n = 0;
+      for( auto itr = begin; itr != end; ++itr ) {
+         visit( *itr );
+         visited.store( ++n, std::memory_order_relaxed );
+      }
+   }
+
+} // namespace chainbase
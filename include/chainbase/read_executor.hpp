@@ -0,0 +1,236 @@
+#pragma once
+
+#include <chainbase/chainbase.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace chainbase {
+
+   /**
+    *  How a read_executor forms batches
+    */
+   struct read_executor_options
+   {
+      /** threads running batches */
+      uint32_t threads = 2;
+      /** most reads run under one acquisition of the lock */
+      uint32_t max_batch_size = 256;
+      /** longest a read waits for others to share its batch, 0 runs whatever is queued right away */
+      uint64_t max_batch_latency_micro = 200;
+      /** longest a batch holds the lock, the rest of the batch waits for the next acquisition */
+      uint64_t max_hold_micro = 2000;
+      /** how long to wait for the read lock, 0 waits forever, see database::with_read_lock() */
+      uint64_t wait_micro = 1000000;
+   };
+
+   struct read_executor_stats
+   {
+      uint64_t reads = 0;
+      uint64_t batches = 0;
+      uint64_t yielded = 0;   ///< batches cut short for a waiting writer or by max_hold_micro
+   };
+
+   namespace detail {
+
+      struct read_task
+      {
+         virtual ~read_task(){}
+         virtual void run() = 0;
+         virtual void fail( std::exception_ptr e ) = 0;
+      };
+
+      template<typename Result, typename F>
+      struct read_task_impl : read_task
+      {
+         read_task_impl( F&& f ):callback( std::move( f ) ){}
+
+         virtual void run() override
+         {
+            try { promise.set_value( callback() ); }
+            catch( ... ) { promise.set_exception( std::current_exception() ); }
+         }
+
+         virtual void fail( std::exception_ptr e ) override { promise.set_exception( e ); }
+
+         F                     callback;
+         std::promise<Result>  promise;
+      };
+
+      template<typename F>
+      struct read_task_impl<void, F> : read_task
+      {
+         read_task_impl( F&& f ):callback( std::move( f ) ){}
+
+         virtual void run() override
+         {
+            try { callback(); promise.set_value(); }
+            catch( ... ) { promise.set_exception( std::current_exception() ); }
+         }
+
+         virtual void fail( std::exception_ptr e ) override { promise.set_exception( e ); }
+
+         F                   callback;
+         std::promise<void>  promise;
+      };
+
+   } // namespace detail
+
+   /**
+    *  Runs read only callbacks against a database on a small pool of threads, many of them under
+    *  each acquisition of the read lock, and hands back their results as futures:
+    *
+    *  @code
+    *  read_executor reads( db );
+    *  auto balance = reads.submit( [&]() { return db.get< account, by_name >( name ).balance; } );
+    *  use( balance.get() );
+    *  @endcode
+    *
+    *  Serving many small queries one with_read_lock() each pays for the lock and for waking the
+    *  calling thread every time.  Here a batch starts once max_batch_size reads are queued or the
+    *  oldest one has waited max_batch_latency_micro, and runs under one read lock.  The lock
+    *  prefers writers; so that batches do not hold a waiting writer off for long, a batch stops
+    *  between reads when a writer is waiting or when it has held the lock for max_hold_micro, and
+    *  the reads left over go back to the front of the queue.
+    *
+    *  Callbacks must only read, and must not take the lock themselves.  The destructor runs every
+    *  read still queued before it returns.
+    */
+   class read_executor
+   {
+      public:
+         explicit read_executor( database& db, const read_executor_options& options = read_executor_options() )
+         :_db( db ),_options( options )
+         {
+            for( uint32_t i = 0; i < std::max<uint32_t>( 1, _options.threads ); ++i )
+               _threads.emplace_back( [this]() { work(); } );
+         }
+
+         ~read_executor()
+         {
+            {
+               std::lock_guard<std::mutex> guard( _mutex );
+               _stopping = true;
+            }
+            _queued.notify_all();
+            for( auto& t : _threads ) t.join();
+         }
+
+         read_executor( const read_executor& ) = delete;
+         read_executor& operator=( const read_executor& ) = delete;
+
+         template<typename F>
+         auto submit( F&& callback ) -> std::future< decltype( callback() ) >
+         {
+            typedef decltype( callback() )                                               result_type;
+            typedef detail::read_task_impl< result_type, typename std::decay<F>::type >  task_type;
+
+            std::unique_ptr<task_type> task( new task_type( typename std::decay<F>::type( std::forward<F>( callback ) ) ) );
+            auto result = task->promise.get_future();
+            {
+               std::lock_guard<std::mutex> guard( _mutex );
+               _queue.push_back( queued{ std::move( task ), clock::now() } );
+               // the first read wakes a thread to time the batch, later ones only when it is full
+               if( _options.max_batch_latency_micro && _queue.size() > 1 && _queue.size() < _options.max_batch_size ) return result;
+            }
+            _queued.notify_one();
+            return result;
+         }
+
+         read_executor_stats get_stats()const
+         {
+            read_executor_stats stats;
+            stats.reads   = _reads.load( std::memory_order_relaxed );
+            stats.batches = _batches.load( std::memory_order_relaxed );
+            stats.yielded = _yielded.load( std::memory_order_relaxed );
+            return stats;
+         }
+
+      private:
+         typedef std::chrono::steady_clock clock;
+
+         struct queued
+         {
+            std::unique_ptr<detail::read_task> task;
+            clock::time_point                  enqueued;
+         };
+
+         void work()
+         {
+            std::unique_lock<std::mutex> guard( _mutex );
+            while( true ) {
+               if( _queue.empty() ) {
+                  if( _stopping ) return;
+                  _queued.wait( guard );
+                  continue;
+               }
+
+               const auto deadline = _queue.front().enqueued + std::chrono::microseconds( _options.max_batch_latency_micro );
+               if( _queue.size() < _options.max_batch_size && !_stopping && clock::now() < deadline ) {
+                  _queued.wait_until( guard, deadline );
+                  continue;
+               }
+
+               std::vector<queued> batch;
+               const size_t n = std::min<size_t>( _queue.size(), std::max<uint32_t>( 1, _options.max_batch_size ) );
+               batch.reserve( n );
+               for( size_t i = 0; i < n; ++i ) {
+                  batch.push_back( std::move( _queue.front() ) );
+                  _queue.pop_front();
+               }
+               if( !_queue.empty() ) _queued.notify_one();
+
+               guard.unlock();
+               const size_t done = run( batch );
+               guard.lock();
+
+               if( done < batch.size() ) {
+                  ++_yielded;
+                  for( size_t i = batch.size(); i > done; --i )
+                     _queue.push_front( std::move( batch[i - 1] ) );
+               }
+            }
+         }
+
+         /** runs reads from the front of batch under one read lock, returns how many ran */
+         size_t run( std::vector<queued>& batch )
+         {
+            size_t done = 0;
+            ++_batches;
+            try {
+               _db.with_read_lock( [&]() {
+                  const auto stop = clock::now() + std::chrono::microseconds( _options.max_hold_micro );
+                  do {
+                     ++_reads;
+                     batch[ done++ ].task->run();
+                  } while( done < batch.size() && !_db.writer_waiting() && clock::now() < stop );
+               }, _options.wait_micro );
+            } catch( ... ) {
+               // the lock could not be acquired, the reads fail with the same error
+               for( ; done < batch.size(); ++done )
+                  batch[done].task->fail( std::current_exception() );
+            }
+            return done;
+         }
+
+         database&                  _db;
+         read_executor_options      _options;
+         mutable std::mutex         _mutex;
+         std::condition_variable    _queued;
+         std::deque<queued>         _queue;
+         std::atomic<uint64_t>      _reads{ 0 };
+         std::atomic<uint64_t>      _batches{ 0 };
+         std::atomic<uint64_t>      _yielded{ 0 };
+         bool                       _stopping = false;
+         std::vector<std::thread>   _threads;
+   };
+
+} // namespace chainbase
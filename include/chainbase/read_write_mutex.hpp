@@ -0,0 +1,550 @@
+#pragma once
+
+#include <boost/throw_exception.hpp>
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+   #include <linux/futex.h>
+   #include <sys/syscall.h>
+#endif
+
+#ifndef CHAINBASE_NUM_LOCK_SLOTS
+   #define CHAINBASE_NUM_LOCK_SLOTS 64
+#endif
+
+#ifndef CHAINBASE_LOCK_HISTOGRAM_BUCKETS
+   #define CHAINBASE_LOCK_HISTOGRAM_BUCKETS 40
+#endif
+
+namespace chainbase {
+
+   namespace detail {
+
+      /**
+       *  Blocks while *addr == expected or until timeout_ns elapses.  The word lives in a file mapped
+       *  by several processes, so the shared (non-private) futex operations are used.  Platforms
+       *  without futexes fall back to a short sleep, callers always re-check the word afterwards.
+       */
+      inline void futex_wait( std::atomic<uint32_t>& addr, uint32_t expected, int64_t timeout_ns )
+      {
+#ifdef __linux__
+         struct timespec ts;
+         ts.tv_sec  = timeout_ns / 1000000000;
+         ts.tv_nsec = timeout_ns % 1000000000;
+         syscall( SYS_futex, reinterpret_cast<uint32_t*>( &addr ), FUTEX_WAIT, expected, &ts, nullptr, 0 );
+#else
+         if( addr.load( std::memory_order_relaxed ) == expected )
+            std::this_thread::sleep_for( std::chrono::nanoseconds( std::min<int64_t>( timeout_ns, 50000 ) ) );
+#endif
+      }
+
+      inline void futex_wake_all( std::atomic<uint32_t>& addr )
+      {
+#ifdef __linux__
+         syscall( SYS_futex, reinterpret_cast<uint32_t*>( &addr ), FUTEX_WAKE, INT32_MAX, nullptr, nullptr, 0 );
+#else
+         (void)addr;
+#endif
+      }
+
+      inline int64_t steady_now_ns()
+      {
+         return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+      }
+
+      /**
+       *  getpid() of the calling process, cached; a fork handler refreshes it in the child so that a
+       *  child never takes its parent's pid for its own
+       */
+      inline int32_t current_pid()
+      {
+         struct cache
+         {
+            static std::atomic<int32_t>& pid()
+            {
+               static std::atomic<int32_t> value( init() );
+               return value;
+            }
+
+            static int32_t init()
+            {
+               pthread_atfork( nullptr, nullptr, []() { pid().store( ::getpid(), std::memory_order_relaxed ); } );
+               return ::getpid();
+            }
+         };
+         return cache::pid().load( std::memory_order_relaxed );
+      }
+
+      inline bool process_is_dead( int32_t pid )
+      {
+         return pid > 0 && ::kill( pid, 0 ) == -1 && errno == ESRCH;
+      }
+
+      /** histogram bucket i counts values in [2^(i-1), 2^i) with bucket 0 reserved for zero */
+      inline uint32_t log2_bucket( uint64_t value, uint32_t num_buckets )
+      {
+         uint32_t b = 0;
+         while( value && b + 1 < num_buckets ) { value >>= 1; ++b; }
+         return b;
+      }
+
+      inline void atomic_max( std::atomic<uint64_t>& target, uint64_t value )
+      {
+         auto cur = target.load( std::memory_order_relaxed );
+         while( cur < value && !target.compare_exchange_weak( cur, value, std::memory_order_relaxed ) ) {}
+      }
+
+   } // namespace detail
+
+   /**
+    *  Contention counters for one side (read or write) of a read_write_mutex.  All times are in
+    *  nanoseconds.  Wait time is only measured once the uncontended fast path has failed, so
+    *  wait_histogram[0] is derived from the number of uncontended acquisitions.
+    */
+   struct lock_stats
+   {
+      typedef std::array< uint64_t, CHAINBASE_LOCK_HISTOGRAM_BUCKETS > histogram_type;
+
+      /** lower bound in nanoseconds of the waits counted in wait_histogram[bucket] */
+      static uint64_t bucket_floor_ns( uint32_t bucket ) { return bucket ? uint64_t(1) << (bucket - 1) : 0; }
+
+      uint64_t acquisitions = 0;
+      uint64_t contended    = 0;
+      uint64_t timeouts     = 0;
+      uint64_t wait_ns      = 0;
+      uint64_t max_wait_ns  = 0;
+      uint64_t hold_ns      = 0;
+      uint64_t max_hold_ns  = 0;
+      histogram_type wait_histogram = histogram_type();
+   };
+
+   /**
+    *  A writer preferring reader/writer lock designed to live inside the shared_memory.meta file and
+    *  be shared by every process that has the database open.
+    *
+    *  The whole lock state is a single 32 bit word:
+    *
+    *    bit  31     : a writer holds the lock
+    *    bits 16..30 : number of writers waiting for the lock
+    *    bit  15     : one or more readers are parked waiting for the writer to finish
+    *    bits  0..14 : number of readers holding the lock
+    *
+    *  Uncontended acquisition and release is a single compare and swap / fetch_sub.  Contended
+    *  waiters block on the word with a futex.  New readers are refused while any writer is waiting
+    *  so that a steady stream of readers cannot starve the writer.
+    *
+    *  Each database instance registers an owner slot recording its pid and how many read locks,
+    *  write locks and pending writes it has outstanding.  When a wait times out the waiter scans the
+    *  slots for processes that no longer exist and backs their contribution out of the lock word,
+    *  so a process that crashes while holding the lock does not wedge every other process.  A
+    *  forked child inherits the slot of its parent's database but does not own it: its locks are
+    *  counted as if it had no slot, and the write lock it holds is only recovered by its own pid.
+    */
+   class read_write_mutex
+   {
+      public:
+         static const uint32_t writer_bit    = 0x80000000u;
+         static const uint32_t waiter_one    = 0x00010000u;
+         static const uint32_t waiter_mask   = 0x7fff0000u;
+         static const uint32_t parked_bit    = 0x00008000u;
+         static const uint32_t reader_mask   = 0x00007fffu;
+
+         /** slot handed to callers that could not register, its locks cannot be recovered */
+         static const int32_t  anonymous_slot = -1;
+
+         read_write_mutex()
+         {
+            _state = 0;
+            _writer_pid = 0;
+            _recoveries = 0;
+            for( auto& s : _slots ) s.clear();
+            _read_stats.clear();
+            _write_stats.clear();
+         }
+
+         read_write_mutex( const read_write_mutex& ) = delete;
+         read_write_mutex& operator = ( const read_write_mutex& ) = delete;
+
+         /**
+          *  Claims an owner slot for the calling process, returns anonymous_slot if all are in use
+          */
+         int32_t register_owner()
+         {
+            const int32_t pid = detail::current_pid();
+            for( int pass = 0; pass < 2; ++pass ) {
+               for( int32_t i = 0; i < CHAINBASE_NUM_LOCK_SLOTS; ++i ) {
+                  int32_t expected = 0;
+                  if( _slots[i].pid.compare_exchange_strong( expected, pid ) )
+                     return i;
+               }
+               recover_abandoned();
+            }
+            return anonymous_slot;
+         }
+
+         void unregister_owner( int32_t slot )
+         {
+            if( slot == anonymous_slot ) return;
+            _slots[slot].clear();
+         }
+
+         bool try_lock_shared( int32_t slot )
+         {
+            slot = owned( slot );
+            auto s = _state.load( std::memory_order_relaxed );
+            if( (s & (writer_bit | waiter_mask)) || (s & reader_mask) == reader_mask ) return false;
+            if( !_state.compare_exchange_strong( s, s + 1, std::memory_order_acquire, std::memory_order_relaxed ) ) return false;
+            if( slot != anonymous_slot ) _slots[slot].readers.fetch_add( 1, std::memory_order_relaxed );
+            return true;
+         }
+
+         /**
+          *  Acquires a shared lock, giving up after timeout_ns (negative waits forever)
+          *  @return false on timeout
+          */
+         bool lock_shared( int32_t slot, int64_t timeout_ns = -1 )
+         {
+            if( BOOST_LIKELY( try_lock_shared( slot ) ) ) {
+               ++_read_stats.acquisitions;
+               return true;
+            }
+
+            const int64_t start = detail::steady_now_ns();
+            ++_read_stats.contended;
+            while( true ) {
+               auto s = _state.load( std::memory_order_relaxed );
+               if( !(s & (writer_bit | waiter_mask)) && (s & reader_mask) != reader_mask ) {
+                  if( try_lock_shared( slot ) ) break;
+                  continue;
+               }
+               if( !(s & parked_bit) ) {
+                  if( !_state.compare_exchange_weak( s, s | parked_bit, std::memory_order_relaxed ) ) continue;
+                  s |= parked_bit;
+               }
+               if( !wait_for_change( s, start, timeout_ns ) ) {
+                  ++_read_stats.timeouts;
+                  return false;
+               }
+            }
+            ++_read_stats.acquisitions;
+            record_wait( _read_stats, detail::steady_now_ns() - start );
+            return true;
+         }
+
+         void unlock_shared( int32_t slot )
+         {
+            slot = owned( slot );
+            if( slot != anonymous_slot ) _slots[slot].readers.fetch_sub( 1, std::memory_order_relaxed );
+            auto prev = _state.fetch_sub( 1, std::memory_order_release );
+            if( (prev & reader_mask) == 1 && (prev & waiter_mask) )
+               detail::futex_wake_all( _state );
+         }
+
+         bool try_lock( int32_t slot )
+         {
+            uint32_t expected = 0;
+            if( !_state.compare_exchange_strong( expected, writer_bit, std::memory_order_acquire, std::memory_order_relaxed ) )
+               return false;
+            set_writer( slot );
+            return true;
+         }
+
+         /**
+          *  Acquires the exclusive lock, giving up after timeout_ns (negative waits forever)
+          *  @return false on timeout
+          */
+         bool lock( int32_t slot, int64_t timeout_ns = -1 )
+         {
+            if( BOOST_LIKELY( try_lock( slot ) ) ) {
+               ++_write_stats.acquisitions;
+               return true;
+            }
+
+            const int64_t start = detail::steady_now_ns();
+            ++_write_stats.contended;
+            slot = owned( slot );
+            if( slot != anonymous_slot ) _slots[slot].waiting_writers.fetch_add( 1, std::memory_order_relaxed );
+            _state.fetch_add( waiter_one, std::memory_order_relaxed );
+
+            bool acquired = false;
+            while( true ) {
+               auto s = _state.load( std::memory_order_relaxed );
+               if( !(s & (writer_bit | reader_mask)) ) {
+                  if( _state.compare_exchange_weak( s, (s - waiter_one) | writer_bit, std::memory_order_acquire, std::memory_order_relaxed ) ) {
+                     acquired = true;
+                     break;
+                  }
+                  continue;
+               }
+               if( !wait_for_change( s, start, timeout_ns ) )
+                  break;
+            }
+
+            if( slot != anonymous_slot ) _slots[slot].waiting_writers.fetch_sub( 1, std::memory_order_relaxed );
+
+            if( !acquired ) {
+               auto prev = _state.fetch_sub( waiter_one, std::memory_order_relaxed );
+               // parked readers may have been held off only by us
+               if( (prev & waiter_mask) == waiter_one && (prev & parked_bit) ) detail::futex_wake_all( _state );
+               ++_write_stats.timeouts;
+               return false;
+            }
+
+            set_writer( slot );
+            ++_write_stats.acquisitions;
+            record_wait( _write_stats, detail::steady_now_ns() - start );
+            return true;
+         }
+
+         void unlock( int32_t slot )
+         {
+            slot = owned( slot );
+            if( slot != anonymous_slot ) _slots[slot].writers.fetch_sub( 1, std::memory_order_relaxed );
+            _writer_pid.store( 0, std::memory_order_relaxed );
+            auto prev = _state.fetch_and( ~(writer_bit | parked_bit), std::memory_order_release );
+            if( prev & (waiter_mask | parked_bit) )
+               detail::futex_wake_all( _state );
+         }
+
+         /**
+          *  Releases any read locks, write lock or pending write requests held by processes which
+          *  have exited without releasing them.
+          *
+          *  @return the number of owner slots that were reclaimed
+          */
+         uint32_t recover_abandoned()
+         {
+            uint32_t recovered = 0;
+            for( auto& slot : _slots ) {
+               int32_t pid = slot.pid.load( std::memory_order_relaxed );
+               if( !detail::process_is_dead( pid ) ) continue;
+               // only one process may reclaim the slot
+               if( !slot.pid.compare_exchange_strong( pid, -1 ) ) continue;
+
+               uint32_t readers = slot.readers.exchange( 0 );
+               uint32_t waiting = slot.waiting_writers.exchange( 0 );
+               uint32_t writers = slot.writers.exchange( 0 );
+               if( readers ) _state.fetch_sub( readers, std::memory_order_relaxed );
+               if( waiting ) _state.fetch_sub( waiting * waiter_one, std::memory_order_relaxed );
+               // only the writer itself, not a child that shared its slot, gives up the write lock
+               int32_t writer = pid;
+               if( writers && _writer_pid.compare_exchange_strong( writer, 0 ) )
+                  _state.fetch_and( ~writer_bit, std::memory_order_relaxed );
+               slot.pid.store( 0 );
+               ++recovered;
+            }
+
+            // a writer that died before it could register a slot is identified by its pid alone
+            int32_t wpid = _writer_pid.load( std::memory_order_relaxed );
+            if( detail::process_is_dead( wpid ) && _writer_pid.compare_exchange_strong( wpid, 0 ) ) {
+               _state.fetch_and( ~writer_bit, std::memory_order_relaxed );
+               ++recovered;
+            }
+
+            if( recovered ) {
+               _recoveries.fetch_add( recovered, std::memory_order_relaxed );
+               detail::futex_wake_all( _state );
+            }
+            return recovered;
+         }
+
+         /**
+          *  Called by lock guards on release so that hold time can be tracked
+          */
+         void record_read_hold( int64_t ns )  { record_hold( _read_stats, ns ); }
+         void record_write_hold( int64_t ns ) { record_hold( _write_stats, ns ); }
+
+         lock_stats read_stats()const   { return _read_stats.snapshot(); }
+         lock_stats write_stats()const  { return _write_stats.snapshot(); }
+         uint64_t   recoveries()const   { return _recoveries.load( std::memory_order_relaxed ); }
+         uint32_t   state()const        { return _state.load( std::memory_order_relaxed ); }
+
+         /** true while a writer waits for the lock, readers holding it should let go soon */
+         bool       writer_waiting()const { return state() & waiter_mask; }
+
+      private:
+         struct owner_slot
+         {
+            std::atomic<int32_t>  pid;
+            std::atomic<uint32_t> readers;
+            std::atomic<uint32_t> writers;
+            std::atomic<uint32_t> waiting_writers;
+
+            void clear()
+            {
+               readers = 0;
+               writers = 0;
+               waiting_writers = 0;
+               pid = 0;
+            }
+         };
+
+         struct shared_lock_stats
+         {
+            std::atomic<uint64_t> acquisitions;
+            std::atomic<uint64_t> contended;
+            std::atomic<uint64_t> timeouts;
+            std::atomic<uint64_t> wait_ns;
+            std::atomic<uint64_t> max_wait_ns;
+            std::atomic<uint64_t> hold_ns;
+            std::atomic<uint64_t> max_hold_ns;
+            std::array< std::atomic<uint64_t>, CHAINBASE_LOCK_HISTOGRAM_BUCKETS > wait_histogram;
+
+            void clear()
+            {
+               acquisitions = 0; contended = 0; timeouts = 0;
+               wait_ns = 0; max_wait_ns = 0; hold_ns = 0; max_hold_ns = 0;
+               for( auto& b : wait_histogram ) b = 0;
+            }
+
+            lock_stats snapshot()const
+            {
+               lock_stats s;
+               s.acquisitions = acquisitions.load( std::memory_order_relaxed );
+               s.contended    = contended.load( std::memory_order_relaxed );
+               s.timeouts     = timeouts.load( std::memory_order_relaxed );
+               s.wait_ns      = wait_ns.load( std::memory_order_relaxed );
+               s.max_wait_ns  = max_wait_ns.load( std::memory_order_relaxed );
+               s.hold_ns      = hold_ns.load( std::memory_order_relaxed );
+               s.max_hold_ns  = max_hold_ns.load( std::memory_order_relaxed );
+               for( uint32_t i = 0; i < wait_histogram.size(); ++i )
+                  s.wait_histogram[i] = wait_histogram[i].load( std::memory_order_relaxed );
+               // uncontended acquisitions never touch the histogram
+               uint64_t waited = 0;
+               for( auto c : s.wait_histogram ) waited += c;
+               if( s.acquisitions > waited ) s.wait_histogram[0] += s.acquisitions - waited;
+               return s;
+            }
+         };
+
+         /** how long a waiter sleeps before it checks for abandoned owners */
+         static const int64_t recovery_interval_ns = 100 * 1000 * 1000;
+
+         void set_writer( int32_t slot )
+         {
+            slot = owned( slot );
+            if( slot != anonymous_slot ) _slots[slot].writers.fetch_add( 1, std::memory_order_relaxed );
+            _writer_pid.store( detail::current_pid(), std::memory_order_relaxed );
+         }
+
+         /** slot if the calling process registered it, anonymous_slot in a child that inherited it */
+         int32_t owned( int32_t slot )const
+         {
+            if( slot == anonymous_slot || _slots[slot].pid.load( std::memory_order_relaxed ) == detail::current_pid() ) return slot;
+            return anonymous_slot;
+         }
+
+         /**
+          *  Sleeps until the lock word changes from observed or the deadline / recovery interval passes.
+          *  @return false once the caller's timeout has expired
+          */
+         bool wait_for_change( uint32_t observed, int64_t start, int64_t timeout_ns )
+         {
+            int64_t slice = recovery_interval_ns;
+            if( timeout_ns >= 0 ) {
+               int64_t remaining = timeout_ns - ( detail::steady_now_ns() - start );
+               if( remaining <= 0 ) return false;
+               slice = std::min( slice, remaining );
+            }
+
+            const int64_t before = detail::steady_now_ns();
+            detail::futex_wait( _state, observed, slice );
+            if( detail::steady_now_ns() - before >= slice && _state.load( std::memory_order_relaxed ) == observed )
+               recover_abandoned();
+            return true;
+         }
+
+         static void record_wait( shared_lock_stats& s, int64_t ns )
+         {
+            s.wait_ns.fetch_add( ns, std::memory_order_relaxed );
+            detail::atomic_max( s.max_wait_ns, ns );
+            s.wait_histogram[ detail::log2_bucket( ns, CHAINBASE_LOCK_HISTOGRAM_BUCKETS ) ].fetch_add( 1, std::memory_order_relaxed );
+         }
+
+         static void record_hold( shared_lock_stats& s, int64_t ns )
+         {
+            s.hold_ns.fetch_add( ns, std::memory_order_relaxed );
+            detail::atomic_max( s.max_hold_ns, ns );
+         }
+
+         std::atomic<uint32_t>                                    _state;
+         std::atomic<int32_t>                                     _writer_pid;
+         std::atomic<uint64_t>                                    _recoveries;
+         shared_lock_stats                                        _read_stats;
+         shared_lock_stats                                        _write_stats;
+         std::array< owner_slot, CHAINBASE_NUM_LOCK_SLOTS >       _slots;
+   };
+
+   /**
+    *  Scoped shared lock on a read_write_mutex, throws if it cannot be acquired within the timeout
+    */
+   class read_lock
+   {
+      public:
+         read_lock( read_write_mutex& m, int32_t slot, int64_t timeout_ns = -1 )
+         :_mutex(m),_slot(slot)
+         {
+            if( !_mutex.lock_shared( _slot, timeout_ns ) )
+               BOOST_THROW_EXCEPTION( std::runtime_error( "unable to acquire lock" ) );
+            _acquired = detail::steady_now_ns();
+         }
+
+         ~read_lock()
+         {
+            _mutex.record_read_hold( detail::steady_now_ns() - _acquired );
+            _mutex.unlock_shared( _slot );
+         }
+
+         read_lock( const read_lock& ) = delete;
+         read_lock& operator = ( const read_lock& ) = delete;
+
+      private:
+         read_write_mutex& _mutex;
+         int32_t           _slot;
+         int64_t           _acquired = 0;
+   };
+
+   /**
+    *  Scoped exclusive lock on a read_write_mutex.  A timeout does not abandon the request, it is
+    *  reported through on_timeout (which may throw to give up) and the wait continues.
+    */
+   class write_lock
+   {
+      public:
+         template<typename OnTimeout>
+         write_lock( read_write_mutex& m, int32_t slot, int64_t timeout_ns, OnTimeout&& on_timeout )
+         :_mutex(m),_slot(slot)
+         {
+            while( !_mutex.lock( _slot, timeout_ns ) )
+               on_timeout();
+            _acquired = detail::steady_now_ns();
+         }
+
+         ~write_lock()
+         {
+            _mutex.record_write_hold( detail::steady_now_ns() - _acquired );
+            _mutex.unlock( _slot );
+         }
+
+         write_lock( const write_lock& ) = delete;
+         write_lock& operator = ( const write_lock& ) = delete;
+
+      private:
+         read_write_mutex& _mutex;
+         int32_t           _slot;
+         int64_t           _acquired = 0;
+   };
+
+} // namespace chainbase
@@ -0,0 +1,148 @@
+#pragma once
+
+#include <boost/throw_exception.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+namespace chainbase {
+
+   /**
+    *  Read position in a buffer written by record_encoder / put_varint()
+    */
+   struct record_reader
+   {
+      record_reader( const char* data, size_t size ):pos( data ),end( data + size ){}
+
+      bool done()const { return pos == end; }
+
+      const char* take( size_t n )
+      {
+         if( size_t( end - pos ) < n ) BOOST_THROW_EXCEPTION( std::runtime_error( "truncated record stream" ) );
+         const char* p = pos;
+         pos += n;
+         return p;
+      }
+
+      const char* pos;
+      const char* end;
+   };
+
+   /** appends v to out using seven bits per byte */
+   template<typename Buffer>
+   void put_varint( Buffer& out, uint64_t v )
+   {
+      char   bytes[10];
+      size_t n = 0;
+      do {
+         bytes[n++] = char( ( v & 0x7f ) | ( v > 0x7f ? 0x80 : 0 ) );
+         v >>= 7;
+      } while( v );
+      out.insert( out.end(), bytes, bytes + n );
+   }
+
+   inline uint64_t get_varint( record_reader& in )
+   {
+      uint64_t v = 0;
+      for( uint32_t shift = 0; shift < 64; shift += 7 ) {
+         const uint8_t b = uint8_t( *in.take( 1 ) );
+         v |= uint64_t( b & 0x7f ) << shift;
+         if( !( b & 0x80 ) ) return v;
+      }
+      BOOST_THROW_EXCEPTION( std::runtime_error( "malformed varint in record stream" ) );
+   }
+
+   /**
+    *  A fast codec for a sequence of fixed size records, such as the saved objects of an undo level
+    *  or the rows of a table being exported.
+    *
+    *  Each record is XORed with the record before it, the first one with a dictionary record that
+    *  is typical of the type, and the result is written eight bytes at a time as a mask byte naming
+    *  the non zero bytes followed by those bytes.  Records of one type sorted by id mostly differ
+    *  from their neighbours in a few fields, so they shrink to little more than one byte per eight,
+    *  and encoding or decoding is a handful of word operations per group.  The output is appended
+    *  to any byte container with insert(), so the same encoder can fill an undo level in the
+    *  segment or the buffer of an export stream.
+    */
+   class record_encoder
+   {
+      public:
+         /** dictionary points to record_size bytes, or is null to start from all zero bytes */
+         record_encoder( size_t record_size, const char* dictionary = nullptr )
+         :_prev( record_size, 0 )
+         {
+            if( dictionary ) memcpy( _prev.data(), dictionary, record_size );
+         }
+
+         template<typename Buffer>
+         void put( const char* record, Buffer& out )
+         {
+            const size_t size = _prev.size();
+            char*        prev = _prev.data();
+            for( size_t i = 0; i < size; i += 8 ) {
+               const size_t n = std::min<size_t>( 8, size - i );
+               if( n == 8 ) {
+                  uint64_t a, b;
+                  memcpy( &a, record + i, 8 );
+                  memcpy( &b, prev + i, 8 );
+                  if( a == b ) {
+                     out.insert( out.end(), char( 0 ) );
+                     continue;
+                  }
+               }
+
+               char    group[9];
+               size_t  len  = 1;
+               uint8_t mask = 0;
+               for( size_t j = 0; j < n; ++j ) {
+                  const char x = char( record[i + j] ^ prev[i + j] );
+                  if( x ) {
+                     mask |= uint8_t( 1 << j );
+                     group[len++] = x;
+                  }
+               }
+               group[0] = char( mask );
+               out.insert( out.end(), group, group + len );
+            }
+            memcpy( prev, record, size );
+         }
+
+      private:
+         std::vector<char> _prev;
+   };
+
+   /**
+    *  Reverses record_encoder, it must be given the same record size and dictionary
+    */
+   class record_decoder
+   {
+      public:
+         record_decoder( size_t record_size, const char* dictionary = nullptr )
+         :_prev( record_size, 0 )
+         {
+            if( dictionary ) memcpy( _prev.data(), dictionary, record_size );
+         }
+
+         void get( record_reader& in, char* record )
+         {
+            const size_t size = _prev.size();
+            char*        prev = _prev.data();
+            for( size_t i = 0; i < size; i += 8 ) {
+               const uint8_t mask = uint8_t( *in.take( 1 ) );
+               if( !mask ) continue;
+               const size_t n = std::min<size_t>( 8, size - i );
+               if( mask >> n ) BOOST_THROW_EXCEPTION( std::runtime_error( "malformed record stream" ) );
+               for( size_t j = 0; j < n; ++j )
+                  if( mask & ( 1 << j ) ) prev[i + j] ^= *in.take( 1 );
+            }
+            memcpy( record, prev, size );
+         }
+
+      private:
+         std::vector<char> _prev;
+   };
+
+} // namespace chainbase
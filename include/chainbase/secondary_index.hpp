@@ -0,0 +1,190 @@
+#pragma once
+
+#include <chainbase/chainbase.hpp>
+
+#include <boost/interprocess/containers/set.hpp>
+
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <type_traits>
+
+namespace chainbase {
+
+   namespace detail {
+
+      /**
+       *  Sorts v by splitting it into up to threads runs that are sorted concurrently and then merged
+       *  pairwise, each round of merges also running concurrently.
+       */
+      template<typename T, typename Less>
+      void parallel_sort( vector<T>& v, Less less, uint32_t threads )
+      {
+         const size_t min_items_per_thread = 1 << 16;
+         const size_t parts = std::max<size_t>( 1, std::min<size_t>( threads, v.size() / min_items_per_thread ) );
+
+         vector<size_t> bounds( parts + 1 );
+         for( size_t p = 0; p <= parts; ++p ) bounds[p] = v.size() * p / parts;
+
+         run_parallel( uint32_t( parts ), [&]( uint32_t p ) {
+            std::sort( v.begin() + bounds[p], v.begin() + bounds[p + 1], less );
+         });
+
+         for( size_t width = 1; width < parts; width *= 2 ) {
+            vector<size_t> firsts;
+            for( size_t p = 0; p + width < parts; p += 2 * width ) firsts.push_back( p );
+            run_parallel( uint32_t( firsts.size() ), [&]( uint32_t i ) {
+               const size_t p = firsts[i];
+               std::inplace_merge( v.begin() + bounds[p], v.begin() + bounds[p + width],
+                                   v.begin() + bounds[ std::min( p + 2 * width, parts ) ], less );
+            });
+         }
+      }
+
+   } // namespace detail
+
+   /**
+    *  An ordered, non unique index over KeyExtractor of the objects of a table, stored in the segment
+    *  next to the table rather than inside its multi_index_container.  Adding one to an existing
+    *  database does not change the table's type, so no replay is needed:
+    *
+    *  @code
+    *  typedef secondary_index< book_index, member<book,int,&book::b> > book_by_b;
+    *  auto& by_b = db.add_secondary_index< book_by_b >( 8 );
+    *  for( auto itr = by_b.lower_bound( 10 ); itr != by_b.upper_bound( 20 ); ++itr )
+    *     use( by_b.get( *itr ) );
+    *  @endcode
+    *
+    *  The index is bulk built from a parallel sort of the table and then follows every create,
+    *  modify, remove and undo of the table as an index_observer.  The table's change_count() is
+    *  recorded with the index so a table that changed while no process had it attached is detected
+    *  and the index rebuilt.  Keys are stored by value and must be trivially copyable.
+    */
+   template<typename MultiIndexType, typename KeyExtractor,
+            typename Compare = std::less< typename std::decay< typename KeyExtractor::result_type >::type > >
+   class secondary_index : public abstract_secondary_index,
+                           public index_observer< typename MultiIndexType::value_type >
+   {
+      public:
+         typedef generic_index<MultiIndexType>                                     table_type;
+         typedef typename table_type::value_type                                   value_type;
+         typedef typename std::decay< typename KeyExtractor::result_type >::type   key_type;
+
+         static_assert( std::is_trivially_copyable<key_type>::value, "secondary index keys are stored in the segment by value" );
+
+         struct entry
+         {
+            key_type key;
+            int64_t  id;
+         };
+
+         struct entry_less
+         {
+            bool operator()( const entry& a, const entry& b )const
+            {
+               Compare c;
+               if( c( a.key, b.key ) ) return true;
+               if( c( b.key, a.key ) ) return false;
+               return a.id < b.id;
+            }
+         };
+
+         typedef bip::allocator< entry, bip::managed_mapped_file::segment_manager > entry_allocator;
+         typedef bip::set< entry, entry_less, entry_allocator >                     entry_set;
+         typedef typename entry_set::const_iterator                                 const_iterator;
+
+         explicit secondary_index( uint32_t threads = 1 ):_threads( threads ){}
+         ~secondary_index() { detach(); }
+
+         virtual void attach( database& db ) override
+         {
+            const auto name = boost::core::demangle( typeid( secondary_index ).name() );
+            auto       sm   = db.get_segment_manager();
+
+            if( db.is_read_only() ) {
+               _table   = const_cast<table_type*>( &db.get_index<MultiIndexType>() );
+               _storage = sm->find<storage>( name.c_str() ).first;
+               if( !_storage || _storage->synced_change_count != _table->change_count() )
+                  BOOST_THROW_EXCEPTION( std::runtime_error( name + " is missing or out of date in read only database" ) );
+               return;
+            }
+
+            _table   = &db.get_mutable_index<MultiIndexType>();
+            _storage = sm->find_or_construct<storage>( name.c_str() )( entry_allocator( sm ) );
+            _rebuilt = _storage->synced_change_count != _table->change_count();
+            if( _rebuilt ) rebuild( _threads );
+            _table->add_observer( *this );
+            _observing = true;
+         }
+
+         virtual void detach() override
+         {
+            if( _observing ) _table->remove_observer( *this );
+            _observing = false;
+            _table     = nullptr;
+            _storage   = nullptr;
+         }
+
+         /** rebuilds the index from the table using up to threads threads for sorting */
+         void rebuild( uint32_t threads )
+         {
+            vector<entry> entries;
+            entries.reserve( _table->indices().size() );
+            KeyExtractor key;
+            for( const auto& obj : _table->indices() )
+               entries.push_back( entry{ key( obj ), obj.id._id } );
+
+            detail::parallel_sort( entries, entry_less(), threads );
+
+            entry_set sorted( boost::container::ordered_unique_range, entries.begin(), entries.end(),
+                              entry_less(), _storage->entries.get_allocator() );
+            _storage->entries.swap( sorted );
+            _storage->synced_change_count = _table->change_count();
+         }
+
+         /** true if the last attach had to rebuild the index */
+         bool rebuilt_on_attach()const { return _rebuilt; }
+
+         size_t         size()const  { return _storage->entries.size(); }
+         const_iterator begin()const { return _storage->entries.begin(); }
+         const_iterator end()const   { return _storage->entries.end(); }
+
+         const_iterator lower_bound( const key_type& k )const { return _storage->entries.lower_bound( entry{ k, std::numeric_limits<int64_t>::min() } ); }
+         const_iterator upper_bound( const key_type& k )const { return _storage->entries.upper_bound( entry{ k, std::numeric_limits<int64_t>::max() } ); }
+         std::pair<const_iterator, const_iterator> equal_range( const key_type& k )const { return { lower_bound( k ), upper_bound( k ) }; }
+
+         /** the object with the lowest id among those with key k, or nullptr */
+         const value_type* find( const key_type& k )const
+         {
+            auto itr = lower_bound( k );
+            if( itr == end() || Compare()( k, itr->key ) ) return nullptr;
+            return &get( *itr );
+         }
+
+         const value_type& get( const entry& e )const { return _table->get( typename value_type::id_type( e.id ) ); }
+
+      private:
+         struct storage
+         {
+            storage( const entry_allocator& a ):entries( a ){}
+
+            entry_set entries;
+            uint64_t  synced_change_count = std::numeric_limits<uint64_t>::max();
+         };
+
+         entry make_entry( const value_type& obj )const { return entry{ KeyExtractor()( obj ), obj.id._id }; }
+         void  synced() { _storage->synced_change_count = _table->change_count(); }
+
+         virtual void on_create( const value_type& obj ) override    { _storage->entries.insert( make_entry( obj ) ); synced(); }
+         virtual void on_modifying( const value_type& obj ) override { _storage->entries.erase( make_entry( obj ) ); synced(); }
+         virtual void on_modified( const value_type& obj ) override  { _storage->entries.insert( make_entry( obj ) ); synced(); }
+         virtual void on_remove( const value_type& obj ) override    { _storage->entries.erase( make_entry( obj ) ); synced(); }
+
+         uint32_t     _threads;
+         table_type*  _table = nullptr;
+         storage*     _storage = nullptr;
+         bool         _observing = false;
+         bool         _rebuilt = false;
+   };
+
+} // namespace chainbase
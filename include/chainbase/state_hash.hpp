@@ -0,0 +1,235 @@
+#pragma once
+
+#include <chainbase/chainbase.hpp>
+
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+namespace chainbase {
+
+   /**
+    *  Streams the bytes of one object into a 256 bit hash, four independently seeded 64 bit lanes
+    *  that each fold in eight bytes at a time.  Objects describe themselves to it through
+    *  state_hash_serializer.  The hash detects divergent state, it is not meant to resist
+    *  deliberately constructed collisions.
+    */
+   class state_hash_writer
+   {
+      public:
+         explicit state_hash_writer( uint64_t type_id )
+         {
+            for( size_t i = 0; i < _lanes.size(); ++i )
+               _lanes[i] = seeds()[i] ^ ( type_id * 0x9e3779b97f4a7c15ull );
+         }
+
+         void write( const void* data, size_t size )
+         {
+            const char* p = static_cast<const char*>( data );
+            _length += size;
+            if( _tail_size ) {
+               const size_t n = std::min( size, sizeof(_tail) - _tail_size );
+               memcpy( _tail + _tail_size, p, n );
+               _tail_size += n; p += n; size -= n;
+               if( _tail_size < sizeof(_tail) ) return;
+               consume( _tail );
+               _tail_size = 0;
+            }
+            for( ; size >= 8; p += 8, size -= 8 )
+               consume( p );
+            memcpy( _tail, p, size );
+            _tail_size = size;
+         }
+
+         template<typename T>
+         void write_value( const T& v )
+         {
+            static_assert( std::is_arithmetic<T>::value || std::is_enum<T>::value, "write_value takes numbers, use write for other types" );
+            write( &v, sizeof(v) );
+         }
+
+         /** writes the size before the bytes so that adjacent strings cannot run into each other */
+         void write_string( const char* data, size_t size )
+         {
+            write_value( uint64_t( size ) );
+            write( data, size );
+         }
+
+         state_digest finish()
+         {
+            memset( _tail + _tail_size, 0, sizeof(_tail) - _tail_size );
+            consume( _tail );
+            state_digest result;
+            for( size_t i = 0; i < _lanes.size(); ++i )
+               result.words[i] = mix( _lanes[i] ^ _length );
+            return result;
+         }
+
+      private:
+         static const std::array<uint64_t, 4>& seeds()
+         {
+            static const std::array<uint64_t, 4> s{{ 0x243f6a8885a308d3ull, 0x13198a2e03707344ull,
+                                                     0xa4093822299f31d0ull, 0x082efa98ec4e6c89ull }};
+            return s;
+         }
+
+         static uint64_t mix( uint64_t h )
+         {
+            h ^= h >> 33;
+            h *= 0xff51afd7ed558ccdull;
+            h ^= h >> 33;
+            h *= 0xc4ceb9fe1a85ec53ull;
+            h ^= h >> 33;
+            return h;
+         }
+
+         void consume( const char* p )
+         {
+            uint64_t w;
+            memcpy( &w, p, 8 );
+            for( size_t i = 0; i < _lanes.size(); ++i ) {
+               const uint64_t h = _lanes[i] ^ mix( w + seeds()[i] );
+               _lanes[i] = ( h << 27 | h >> 37 ) * 0x9fb21c651e98df25ull;
+            }
+         }
+
+         std::array<uint64_t, 4> _lanes;
+         char                    _tail[8];
+         size_t                  _tail_size = 0;
+         uint64_t                _length = 0;
+   };
+
+   /**
+    *  Describes an object to state_hash_writer.  The default hashes the bytes of trivially copyable
+    *  objects, which is only deterministic for types without padding; other object types (or types
+    *  with padding) specialize it and write their fields one by one:
+    *
+    *  @code
+    *  template<> struct state_hash_serializer< account > {
+    *     static void write( const account& a, state_hash_writer& w ) {
+    *        w.write_value( a.id._id );
+    *        w.write_string( a.name.data(), a.name.size() );
+    *        w.write_value( a.balance );
+    *     }
+    *  };
+    *  @endcode
+    */
+   template<typename Object>
+   struct state_hash_serializer
+   {
+      static_assert( std::is_trivially_copyable<Object>::value, "specialize state_hash_serializer for objects that are not trivially copyable" );
+
+      static void write( const Object& o, state_hash_writer& w ) { w.write( &o, sizeof(o) ); }
+   };
+
+   /**
+    *  A digest of every object of a table, kept in the segment and updated in constant time by each
+    *  create, modify, remove and undo instead of recomputed by walking the table:
+    *
+    *  @code
+    *  db.add_secondary_index< state_hash< account_index > >();
+    *  auto digest = db.get_state_digest();   // sum over every attached state_hash
+    *  @endcode
+    *
+    *  The digest is the state_digest sum of the hashes of the objects, so it does not depend on the
+    *  order in which objects were changed and undo restores it exactly.  Like secondary_index it
+    *  follows the table as an index_observer and is recomputed (using up to threads threads) when
+    *  the table changed while it was not attached.
+    */
+   template<typename MultiIndexType>
+   class state_hash : public abstract_secondary_index,
+                      public abstract_state_hash,
+                      public index_observer< typename MultiIndexType::value_type >
+   {
+      public:
+         typedef generic_index<MultiIndexType>   table_type;
+         typedef typename table_type::value_type value_type;
+
+         explicit state_hash( uint32_t threads = 1 ):_threads( threads ){}
+         ~state_hash() { detach(); }
+
+         virtual void attach( database& db ) override
+         {
+            const auto name = boost::core::demangle( typeid( state_hash ).name() );
+            auto       sm   = db.get_segment_manager();
+
+            if( db.is_read_only() ) {
+               _table   = const_cast<table_type*>( &db.get_index<MultiIndexType>() );
+               _storage = sm->find<storage>( name.c_str() ).first;
+               if( !_storage || _storage->synced_change_count != _table->change_count() )
+                  BOOST_THROW_EXCEPTION( std::runtime_error( name + " is missing or out of date in read only database" ) );
+               return;
+            }
+
+            _table   = &db.get_mutable_index<MultiIndexType>();
+            _storage = sm->find_or_construct<storage>( name.c_str() )();
+            if( _storage->synced_change_count != _table->change_count() ) rebuild( _threads );
+            _table->add_observer( *this );
+            _observing = true;
+         }
+
+         virtual void detach() override
+         {
+            if( _observing ) _table->remove_observer( *this );
+            _observing = false;
+            _table     = nullptr;
+            _storage   = nullptr;
+         }
+
+         virtual state_digest digest()const override { return _storage->digest; }
+
+         static state_digest hash( const value_type& obj )
+         {
+            state_hash_writer w( value_type::type_id );
+            state_hash_serializer<value_type>::write( obj, w );
+            return w.finish();
+         }
+
+         /** recomputes the digest from the table, splitting it into id ranges walked by up to threads threads */
+         void rebuild( uint32_t threads )
+         {
+            const auto&    objects = _table->indices();
+            const uint64_t min_objects_per_thread = 4096;
+            const uint32_t parts = uint32_t( std::max<uint64_t>( 1, std::min<uint64_t>( threads, objects.size() / min_objects_per_thread ) ) );
+
+            int64_t first = 0, last = 0;
+            if( objects.size() ) {
+               first = objects.begin()->id._id;
+               last  = objects.rbegin()->id._id + 1;
+            }
+
+            vector<state_digest> digests( parts );
+            detail::run_parallel( parts, [&]( uint32_t p ) {
+               typedef typename value_type::id_type id_type;
+               auto itr = objects.lower_bound( id_type( first + ( last - first ) * int64_t( p ) / int64_t( parts ) ) );
+               auto end = objects.lower_bound( id_type( first + ( last - first ) * int64_t( p + 1 ) / int64_t( parts ) ) );
+               for( ; itr != end; ++itr )
+                  digests[p] += hash( *itr );
+            });
+
+            _storage->digest = state_digest();
+            for( const auto& d : digests ) _storage->digest += d;
+            _storage->synced_change_count = _table->change_count();
+         }
+
+      private:
+         struct storage
+         {
+            state_digest digest;
+            uint64_t     synced_change_count = std::numeric_limits<uint64_t>::max();
+         };
+
+         void synced() { _storage->synced_change_count = _table->change_count(); }
+
+         virtual void on_create( const value_type& obj ) override    { _storage->digest += hash( obj ); synced(); }
+         virtual void on_modifying( const value_type& obj ) override { _storage->digest -= hash( obj ); synced(); }
+         virtual void on_modified( const value_type& obj ) override  { _storage->digest += hash( obj ); synced(); }
+         virtual void on_remove( const value_type& obj ) override    { _storage->digest -= hash( obj ); synced(); }
+
+         uint32_t     _threads;
+         table_type*  _table = nullptr;
+         storage*     _storage = nullptr;
+         bool         _observing = false;
+   };
+
+} // namespace chainbase
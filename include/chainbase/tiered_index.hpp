@@ -0,0 +1,398 @@
+#pragma once
+
+#include <chainbase/chainbase.hpp>
+
+#include <boost/interprocess/containers/map.hpp>
+
+#include <cerrno>
+#include <cstring>
+#include <type_traits>
+
+#include <unistd.h>
+
+namespace chainbase {
+
+   namespace detail {
+
+      inline void pwrite_all( int fd, const char* data, size_t size, uint64_t offset )
+      {
+         while( size ) {
+            auto n = ::pwrite( fd, data, size, off_t( offset ) );
+            if( n < 0 && errno == EINTR ) continue;
+            if( n <= 0 ) BOOST_THROW_EXCEPTION( std::runtime_error( "unable to write to cold store" ) );
+            data += n; size -= size_t( n ); offset += uint64_t( n );
+         }
+      }
+
+      inline void pread_all( int fd, char* data, size_t size, uint64_t offset )
+      {
+         while( size ) {
+            auto n = ::pread( fd, data, size, off_t( offset ) );
+            if( n < 0 && errno == EINTR ) continue;
+            if( n <= 0 ) BOOST_THROW_EXCEPTION( std::runtime_error( "unable to read from cold store" ) );
+            data += n; size -= size_t( n ); offset += uint64_t( n );
+         }
+      }
+
+   } // namespace detail
+
+   /**
+    *  A table for trivially copyable objects that keeps recently used (hot) objects in the segment
+    *  and moves the others to an append only file next to it, cold-<type_id>.dat, leaving an eight
+    *  byte file offset behind as a stub.  Tables that are mostly history or dormant rows then only
+    *  need their hot part resident.
+    *
+    *  Objects are addressed by id.  get() reads evicted objects from the file without changing the
+    *  table, so it works under a read lock and from read only processes.  fetch() and modify() bring
+    *  an evicted object back into the segment.  Access tracking is a single reference flag per hot
+    *  object, set when it is created, fetched or modified; evict() runs the CLOCK algorithm over
+    *  the flags, so only objects that went unused for a full sweep are written out.
+    *
+    *  Eviction does not change the content of the table, so it is not recorded in the undo history
+    *  and can happen at any revision.  Undo, squash and commit work as in generic_index whichever
+    *  tier an object is in.  Records of objects that were brought back or removed stay in the file
+    *  as dead bytes (see cold_dead_bytes()).
+    *
+    *  The descriptor of the cold store is process local and registered in detail::cold_store_registry
+    *  when the table is opened.
+    *
+    *  The table is added with add_index<tiered_index<Object>>() and reached through get_index /
+    *  get_mutable_index; database::create / modify / find do not apply to it.
+    */
+   template<typename Object>
+   class tiered_index
+   {
+      public:
+         typedef bip::managed_mapped_file::segment_manager             segment_manager_type;
+         typedef Object                                                value_type;
+         typedef typename value_type::id_type                          id_type;
+         typedef bip::allocator< tiered_index, segment_manager_type >  allocator_type;
+         typedef undo_state< value_type >                              undo_state_type;
+         typedef undo_session< tiered_index >                          session;
+
+         static_assert( std::is_trivially_copyable<value_type>::value, "tiered_index requires a trivially copyable object type" );
+
+         struct hot_entry
+         {
+            typename std::aligned_storage< sizeof(value_type), alignof(value_type) >::type bytes;
+            uint8_t                                                                      referenced = 1;
+         };
+
+         typedef std::pair< const int64_t, hot_entry >                                   hot_value_type;
+         typedef std::pair< const int64_t, uint64_t >                                    cold_value_type;
+         typedef bip::map< int64_t, hot_entry, std::less<int64_t>, allocator<hot_value_type> >  hot_map_type;
+         typedef bip::map< int64_t, uint64_t, std::less<int64_t>, allocator<cold_value_type> > cold_map_type;
+
+         /** size of one record in the cold store: the id followed by the object */
+         static const size_t record_size = sizeof(int64_t) + sizeof(value_type);
+
+         tiered_index( allocator<value_type> a )
+         :_stack(a),_hot( allocator<hot_value_type>( a ) ),_cold( allocator<cold_value_type>( a ) ),
+          _size_of_value_type( sizeof(value_type) ),_size_of_this( sizeof(*this) ){}
+
+         void validate()const {
+            if( sizeof(value_type) != _size_of_value_type || sizeof(*this) != _size_of_this )
+               BOOST_THROW_EXCEPTION( std::runtime_error("content of memory does not match data expected by executable") );
+         }
+
+         /** called when the table is opened, @see index_opened */
+         void set_cold_store( int fd )const { detail::cold_store_registry::instance().set( this, fd ); }
+
+         template<typename Constructor>
+         id_type emplace( Constructor&& c ) {
+            auto new_id = _next_id;
+            value_type v( [&]( value_type& o ) {
+               o.id = new_id;
+               c( o );
+            }, _hot.get_allocator() );
+            v.id = new_id;
+
+            store_hot( v );
+            ++_next_id;
+            ++_counters.creates;
+            on_create( v );
+            return new_id;
+         }
+
+         template<typename Modifier>
+         void modify( id_type id, Modifier&& m ) {
+            value_type v = get( id );
+            ++_counters.modifies;
+            on_modify( v );
+            m( v );
+            v.id = id;
+            store_hot( v );
+         }
+
+         void remove( id_type id ) {
+            value_type v = get( id );
+            ++_counters.removes;
+            on_remove( v );
+            erase( id );
+         }
+
+         bool contains( id_type id )const { return _hot.count( id._id ) || _cold.count( id._id ); }
+         bool is_hot( id_type id )const   { return _hot.count( id._id ); }
+
+         /** the object with id, read from the cold store if it has been evicted */
+         value_type get( id_type id )const {
+            auto h = _hot.find( id._id );
+            if( h != _hot.end() ) return load( h->second );
+
+            auto c = _cold.find( id._id );
+            if( c == _cold.end() ) BOOST_THROW_EXCEPTION( std::out_of_range("key not found") );
+            return read_cold( id, c->second );
+         }
+
+         /** like get(), but marks the object as used and brings it back into the segment if it was evicted */
+         value_type fetch( id_type id ) {
+            auto h = _hot.find( id._id );
+            if( h != _hot.end() ) {
+               h->second.referenced = 1;
+               return load( h->second );
+            }
+            value_type v = get( id );
+            store_hot( v );
+            return v;
+         }
+
+         /**
+          *  Moves objects that were not used since the clock hand last passed them to the cold store
+          *  until at most max_hot objects remain in the segment.
+          *
+          *  @return the number of objects evicted
+          */
+         size_t evict( size_t max_hot ) {
+            if( _hot.size() <= max_hot ) return 0;
+            const int fd = cold_store();
+
+            vector<char>    records;
+            vector<int64_t> ids;
+            auto itr = _hot.lower_bound( _clock_hand );
+            while( _hot.size() - ids.size() > max_hot ) {
+               if( itr == _hot.end() ) itr = _hot.begin();
+               if( itr->second.referenced ) {
+                  itr->second.referenced = 0;
+               } else {
+                  records.resize( records.size() + record_size );
+                  char* r = records.data() + records.size() - record_size;
+                  memcpy( r, &itr->first, sizeof(int64_t) );
+                  memcpy( r + sizeof(int64_t), &itr->second.bytes, sizeof(value_type) );
+                  ids.push_back( itr->first );
+               }
+               ++itr;
+            }
+            _clock_hand = itr == _hot.end() ? 0 : itr->first;
+
+            // write all records before any stub refers to them
+            detail::pwrite_all( fd, records.data(), records.size(), _cold_bytes );
+            for( size_t i = 0; i < ids.size(); ++i ) {
+               _hot.erase( ids[i] );
+               _cold.emplace_hint( _cold.end(), ids[i], _cold_bytes + i * record_size );
+            }
+            _cold_bytes += records.size();
+            return ids.size();
+         }
+
+         /** number of objects, in the segment and in the cold store */
+         size_t size()const          { return _hot.size() + _cold.size(); }
+         size_t hot_size()const      { return _hot.size(); }
+         size_t cold_size()const     { return _cold.size(); }
+         uint64_t cold_bytes()const      { return _cold_bytes; }
+         uint64_t cold_dead_bytes()const { return _cold_dead_bytes; }
+
+         session start_undo_session( bool enabled ) {
+            if( enabled ) {
+               _stack.emplace_back( _hot.get_allocator() );
+               _stack.back().old_next_id = _next_id;
+               _stack.back().revision = ++_revision;
+               return session( *this, _revision );
+            } else {
+               return session( *this, -1 );
+            }
+         }
+
+         int64_t revision()const { return _revision; }
+
+         void undo() {
+            if( !enabled() ) return;
+            scoped_timer timer( _counters.undo_time );
+
+            const auto& head = _stack.back();
+
+            for( auto& item : head.old_values )
+               store_hot( item.second );
+
+            for( auto id : head.new_ids )
+               erase( id );
+            _next_id = head.old_next_id;
+
+            for( auto& item : head.removed_values )
+               store_hot( item.second );
+
+            _stack.pop_back();
+            --_revision;
+         }
+
+         void squash() {
+            if( !enabled() ) return;
+            scoped_timer timer( _counters.squash_time );
+            if( _stack.size() == 1 ) {
+               _stack.pop_front();
+               return;
+            }
+
+            squash_undo_states( _stack[_stack.size()-2], _stack.back() );
+
+            _stack.pop_back();
+            --_revision;
+         }
+
+         /** @see generic_index::squash_to */
+         void squash_to( int64_t revision ) {
+            if( !enabled() || revision >= _revision ) return;
+            scoped_timer timer( _counters.squash_time );
+            squash_undo_stack( _stack, revision );
+            _revision = revision;
+         }
+
+         void commit( int64_t revision ) {
+            scoped_timer timer( _counters.commit_time );
+            while( _stack.size() && _stack[0].revision <= revision )
+               _stack.pop_front();
+         }
+
+         void undo_all() {
+            while( enabled() )
+               undo();
+         }
+
+         void set_revision( uint64_t revision ) {
+            if( _stack.size() != 0 ) BOOST_THROW_EXCEPTION( std::logic_error("cannot set revision while there is an existing undo stack") );
+            _revision = revision;
+         }
+
+         void remove_object( int64_t id ) {
+            if( !contains( id_type(id) ) ) BOOST_THROW_EXCEPTION( std::out_of_range( boost::lexical_cast<std::string>(id) ) );
+            remove( id_type(id) );
+         }
+
+         const index_counters& counters()const { return _counters; }
+
+         void get_statistics( index_statistics& stats )const {
+            stats.type_id      = value_type::type_id;
+            stats.object_count = size();
+            stats.node_size    = sizeof(typename hot_map_type::value_type);
+            stats.node_bytes   = _hot.size() * stats.node_size + _cold.size() * sizeof(cold_value_type);
+            stats.revision     = _revision;
+            stats.counters     = _counters;
+            get_undo_statistics( _stack, stats );
+         }
+
+         /**
+          *  @see generic_index::copy_from, the cold store file is shared with other, so other must not
+          *  be used afterwards
+          */
+         void copy_from( const tiered_index& other ) {
+            if( other._stack.size() )
+               BOOST_THROW_EXCEPTION( std::logic_error( "cannot copy an index with undo history, commit it first" ) );
+            if( size() || _stack.size() )
+               BOOST_THROW_EXCEPTION( std::logic_error( "can only copy into an empty index" ) );
+
+            for( const auto& item : other._hot )  _hot.emplace_hint( _hot.end(), item.first, item.second );
+            for( const auto& item : other._cold ) _cold.emplace_hint( _cold.end(), item.first, item.second );
+            _cold_bytes      = other._cold_bytes;
+            _cold_dead_bytes = other._cold_dead_bytes;
+            _clock_hand      = other._clock_hand;
+            _revision        = other._revision;
+            _next_id         = other._next_id;
+            _counters        = other._counters;
+            set_cold_store( detail::cold_store_registry::instance().get( &other ) );
+         }
+
+      private:
+         bool enabled()const { return _stack.size(); }
+
+         int cold_store()const {
+            int fd = detail::cold_store_registry::instance().get( this );
+            if( fd < 0 ) BOOST_THROW_EXCEPTION( std::logic_error( "cold store is not open" ) );
+            return fd;
+         }
+
+         void on_modify( const value_type& v ) {
+            if( !enabled() ) return;
+            _stack.back().record_modify( v );
+         }
+
+         void on_remove( const value_type& v ) {
+            if( !enabled() ) return;
+            _stack.back().record_remove( v );
+         }
+
+         void on_create( const value_type& v ) {
+            if( !enabled() ) return;
+            _stack.back().record_create( v );
+         }
+
+         value_type load( const hot_entry& e )const {
+            value_type v( []( value_type& ){}, _hot.get_allocator() );
+            memcpy( static_cast<void*>( &v ), &e.bytes, sizeof(value_type) );
+            return v;
+         }
+
+         value_type read_cold( id_type id, uint64_t offset )const {
+            char record[ record_size ];
+            detail::pread_all( cold_store(), record, record_size, offset );
+
+            int64_t stored_id;
+            memcpy( &stored_id, record, sizeof(int64_t) );
+            if( stored_id != id._id ) BOOST_THROW_EXCEPTION( std::runtime_error( "cold store does not match its index" ) );
+
+            value_type v( []( value_type& ){}, _hot.get_allocator() );
+            memcpy( static_cast<void*>( &v ), record + sizeof(int64_t), sizeof(value_type) );
+            return v;
+         }
+
+         /** writes v into the segment, dropping any cold copy */
+         void store_hot( const value_type& v ) {
+            drop_cold( v.id._id );
+            hot_entry& e = _hot[ v.id._id ];
+            memcpy( &e.bytes, &v, sizeof(value_type) );
+            e.referenced = 1;
+         }
+
+         void erase( id_type id ) {
+            if( !_hot.erase( id._id ) ) drop_cold( id._id );
+         }
+
+         void drop_cold( int64_t id ) {
+            if( _cold.erase( id ) ) _cold_dead_bytes += record_size;
+         }
+
+         boost::interprocess::deque< undo_state_type, allocator<undo_state_type> > _stack;
+
+         int64_t                         _revision = 0;
+         id_type                         _next_id = 0;
+         hot_map_type                    _hot;
+         cold_map_type                   _cold;          ///< id to offset of its record in the cold store
+         uint64_t                        _cold_bytes = 0;
+         uint64_t                        _cold_dead_bytes = 0;
+         int64_t                         _clock_hand = 0;
+         uint32_t                        _size_of_value_type = 0;
+         uint32_t                        _size_of_this = 0;
+         index_counters                  _counters;
+   };
+
+   template<typename Object>
+   const size_t tiered_index<Object>::record_size;
+
+   template<typename Object>
+   struct index_storage_type< tiered_index<Object> > { typedef tiered_index<Object> type; };
+
+   template<typename Object>
+   void index_opened( tiered_index<Object>& idx, database& db )
+   {
+      idx.set_cold_store( db.cold_store_file( Object::type_id ) );
+   }
+
+} // namespace chainbase
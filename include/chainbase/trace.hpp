@@ -0,0 +1,170 @@
+#pragma once
+
+#include <chainbase/record_codec.hpp>
+
+#include <boost/filesystem.hpp>
+#include <boost/throw_exception.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+namespace chainbase {
+
+   namespace bfs = boost::filesystem;
+
+   /**
+    *  Operations recorded by database::start_trace().  Session operations refer to the innermost
+    *  session that has not been pushed, squashed or undone yet, sessions are assumed to end in the
+    *  reverse order of their start as they do when they are scoped.
+    */
+   enum class trace_op : uint8_t {
+      start_session  = 1,  ///< value: 1 if enabled
+      session_push   = 2,
+      session_squash = 3,
+      session_undo   = 4,
+      undo           = 5,  ///< database::undo()
+      squash         = 6,  ///< database::squash()
+      squash_to      = 7,  ///< value: revision() minus the revision passed
+      commit         = 8,  ///< value: revision() minus the revision passed
+      create         = 9,  ///< type_id, id, value: object size
+      modify         = 10, ///< type_id, id, value: object size
+      remove         = 11, ///< type_id, id
+      find           = 12, ///< type_id, id of the result or -1, value: 1 if looked up by a key other than id
+      get            = 13  ///< type_id, id of the result or -1, value: 1 if looked up by a key other than id
+   };
+
+   struct trace_record
+   {
+      trace_op op       = trace_op::undo;
+      uint16_t type_id  = 0;
+      int64_t  id       = -1;
+      int64_t  value    = 0;
+
+      bool has_object()const { return op >= trace_op::create; }
+   };
+
+   /**
+    *  Appends trace_records to a file, a header followed by an op byte and varints per record
+    *  (ids as the difference to the previous id of the same operation, which is small for scans
+    *  and hot spots).  Records are buffered and written in large blocks; any thread may call
+    *  write().
+    */
+   class trace_writer
+   {
+      public:
+         static const uint32_t version = 1;
+         static const size_t   magic_size = 8;
+
+         static const char* magic() { return "CBTRACE"; } // with its terminator, magic_size bytes
+
+         explicit trace_writer( const bfs::path& file )
+         :_out( file.generic_string(), std::ios::binary | std::ios::trunc )
+         {
+            if( !_out ) BOOST_THROW_EXCEPTION( std::runtime_error( "unable to create trace file " + file.generic_string() ) );
+            _buffer.insert( _buffer.end(), magic(), magic() + magic_size );
+            put_varint( _buffer, version );
+         }
+
+         ~trace_writer() { flush(); }
+
+         trace_writer( const trace_writer& ) = delete;
+         trace_writer& operator=( const trace_writer& ) = delete;
+
+         void write( const trace_record& r )
+         {
+            std::lock_guard<std::mutex> guard( _mutex );
+            _buffer.push_back( char( r.op ) );
+            if( r.has_object() ) {
+               int64_t& last = _last_id[ uint8_t( r.op ) ];
+               put_varint( _buffer, r.type_id );
+               put_varint( _buffer, zigzag( r.id - last ) );
+               last = r.id;
+            }
+            put_varint( _buffer, zigzag( r.value ) );
+            ++_records;
+            if( _buffer.size() >= flush_size ) write_buffer();
+         }
+
+         void flush()
+         {
+            std::lock_guard<std::mutex> guard( _mutex );
+            write_buffer();
+            _out.flush();
+         }
+
+         uint64_t records()const { return _records; }
+
+      private:
+         static const size_t flush_size = 1 << 20;
+
+         static uint64_t zigzag( int64_t v ) { return ( uint64_t( v ) << 1 ) ^ uint64_t( v >> 63 ); }
+
+         void write_buffer()
+         {
+            _out.write( _buffer.data(), _buffer.size() );
+            _buffer.clear();
+         }
+
+         std::ofstream     _out;
+         std::vector<char> _buffer;
+         int64_t           _last_id[16] = {};
+         uint64_t          _records = 0;
+         std::mutex        _mutex;
+   };
+
+   /**
+    *  Reads a file written by trace_writer, the whole file is loaded up front so that reading
+    *  records does not show up in measurements taken while replaying them.
+    */
+   class trace_reader
+   {
+      public:
+         explicit trace_reader( const bfs::path& file )
+         {
+            std::ifstream in( file.generic_string(), std::ios::binary );
+            if( !in ) BOOST_THROW_EXCEPTION( std::runtime_error( "unable to open trace file " + file.generic_string() ) );
+            _data.assign( std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() );
+            reset();
+         }
+
+         /** starts over at the first record */
+         void reset()
+         {
+            _in = record_reader( _data.data(), _data.size() );
+            if( memcmp( _in.take( trace_writer::magic_size ), trace_writer::magic(), trace_writer::magic_size ) )
+               BOOST_THROW_EXCEPTION( std::runtime_error( "not a chainbase trace file" ) );
+            if( get_varint( _in ) != uint64_t( trace_writer::version ) )
+               BOOST_THROW_EXCEPTION( std::runtime_error( "unsupported trace file version" ) );
+            memset( _last_id, 0, sizeof(_last_id) );
+         }
+
+         /** reads the next record, false at the end of the trace */
+         bool next( trace_record& r )
+         {
+            if( _in.done() ) return false;
+            r.op = trace_op( *_in.take( 1 ) );
+            if( r.op < trace_op::start_session || r.op > trace_op::get )
+               BOOST_THROW_EXCEPTION( std::runtime_error( "malformed trace file" ) );
+            r.type_id = 0;
+            r.id      = -1;
+            if( r.has_object() ) {
+               r.type_id = uint16_t( get_varint( _in ) );
+               r.id      = _last_id[ uint8_t( r.op ) ] += unzigzag( get_varint( _in ) );
+            }
+            r.value = unzigzag( get_varint( _in ) );
+            return true;
+         }
+
+      private:
+         static int64_t unzigzag( uint64_t v ) { return int64_t( v >> 1 ) ^ -int64_t( v & 1 ); }
+
+         std::vector<char> _data;
+         record_reader     _in{ nullptr, 0 };
+         int64_t           _last_id[16];
+   };
+
+} // namespace chainbase
@@ -0,0 +1,131 @@
+#pragma once
+
+#include <boost/interprocess/managed_mapped_file.hpp>
+#include <boost/interprocess/offset_ptr.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+namespace chainbase {
+
+   namespace bip = boost::interprocess;
+
+   /**
+    *  Bump allocator for the undo records of one revision, a chain of chunks allocated from the
+    *  segment.  Undo data lives exactly as long as its revision, so nothing is freed one record at a
+    *  time: the chunks are handed back together when the revision is undone, committed or squashed
+    *  away.  Chunks start small, since most revisions touch a table only a few times, and double up
+    *  to max_chunk_size.
+    */
+   class undo_arena
+   {
+      public:
+         typedef bip::managed_mapped_file::segment_manager segment_manager_type;
+
+         static const size_t first_chunk_size = 1024;
+         static const size_t max_chunk_size   = 256 * 1024;
+
+         explicit undo_arena( segment_manager_type* sm ):_segment_manager( sm ){}
+         ~undo_arena() { release(); }
+
+         undo_arena( const undo_arena& ) = delete;
+         undo_arena& operator=( const undo_arena& ) = delete;
+
+         void* allocate( size_t size, size_t align )
+         {
+            if( _head ) {
+               if( void* p = _head->take( size, align ) ) return p;
+            }
+
+            size_t capacity = _head ? std::min( 2 * _head->size, size_t( max_chunk_size ) ) : size_t( first_chunk_size );
+            capacity = std::max( capacity, size + align );
+            auto c = static_cast<chunk*>( _segment_manager->allocate( sizeof(chunk) + capacity ) );
+            new( c ) chunk{ _head, capacity, 0 };
+            _head      = c;
+            _reserved += capacity;
+            ++_chunks;
+            return _head->take( size, align );
+         }
+
+         /** returns every chunk to the segment, everything allocated from the arena must be dead */
+         void release()
+         {
+            while( _head ) {
+               chunk* c = _head.get();
+               _head = c->next;
+               _segment_manager->deallocate( c );
+            }
+            _reserved = 0;
+            _chunks   = 0;
+         }
+
+         /** bytes held in chunks, used or not */
+         size_t reserved_bytes()const { return _reserved; }
+         size_t chunks()const         { return _chunks; }
+
+      private:
+         struct chunk
+         {
+            bip::offset_ptr<chunk> next;
+            size_t                 size;
+            size_t                 used;
+
+            void* take( size_t n, size_t align )
+            {
+               char*           data  = reinterpret_cast<char*>( this + 1 );
+               const uintptr_t start = ( uintptr_t( data + used ) + align - 1 ) & ~uintptr_t( align - 1 );
+               if( start + n > uintptr_t( data + size ) ) return nullptr;
+               used = start + n - uintptr_t( data );
+               return reinterpret_cast<void*>( start );
+            }
+         };
+
+         bip::offset_ptr<segment_manager_type> _segment_manager;
+         bip::offset_ptr<chunk>                _head;
+         size_t                                _reserved = 0;
+         size_t                                _chunks = 0;
+   };
+
+   /**
+    *  Allocator handing out memory of an undo_arena.  Deallocation does nothing, the memory comes
+    *  back when the arena is released.
+    */
+   template<typename T>
+   class arena_allocator
+   {
+      public:
+         typedef T                        value_type;
+         typedef bip::offset_ptr<T>       pointer;
+         typedef bip::offset_ptr<const T> const_pointer;
+         typedef T&                       reference;
+         typedef const T&                 const_reference;
+         typedef size_t                   size_type;
+         typedef ptrdiff_t                difference_type;
+
+         template<typename U>
+         struct rebind { typedef arena_allocator<U> other; };
+
+         explicit arena_allocator( undo_arena* a ):_arena( a ){}
+
+         template<typename U>
+         arena_allocator( const arena_allocator<U>& o ):_arena( o.arena() ){}
+
+         pointer allocate( size_type n ) { return pointer( static_cast<T*>( _arena->allocate( n * sizeof(T), alignof(T) ) ) ); }
+         void    deallocate( const pointer&, size_type ) {}
+
+         size_type max_size()const { return std::numeric_limits<size_type>::max() / sizeof(T); }
+
+         undo_arena* arena()const { return _arena.get(); }
+
+         template<typename U>
+         bool operator==( const arena_allocator<U>& o )const { return _arena == o.arena(); }
+         template<typename U>
+         bool operator!=( const arena_allocator<U>& o )const { return _arena != o.arena(); }
+
+      private:
+         bip::offset_ptr<undo_arena> _arena;
+   };
+
+} // namespace chainbase
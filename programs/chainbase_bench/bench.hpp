@@ -0,0 +1,169 @@
+#pragma once
+
+#include <chainbase/chainbase.hpp>
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+/**
+ *  Helpers shared by the cases of chainbase_bench.  Each case lives in a file of its own and
+ *  registers itself with a static bench::registrar.
+ */
+namespace bench {
+
+   namespace bfs = boost::filesystem;
+
+   struct options
+   {
+      uint64_t  scale = 1000000;   ///< objects or keys per case, --scale
+      bfs::path dir;               ///< where scratch databases are made, --dir
+      uint32_t  seed = 1;
+   };
+
+   typedef std::function<void( const options& )> case_function;
+
+   struct bench_case
+   {
+      std::string   name;
+      std::string   description;
+      case_function run;
+   };
+
+   inline std::vector<bench_case>& cases()
+   {
+      static std::vector<bench_case> all;
+      return all;
+   }
+
+   struct registrar
+   {
+      registrar( const char* name, const char* description, case_function f )
+      {
+         cases().push_back( bench_case{ name, description, std::move( f ) } );
+      }
+   };
+
+   inline int64_t now_ns() { return chainbase::detail::steady_now_ns(); }
+
+   /** keeps the compiler from dropping a computation whose result is otherwise unused */
+   template<typename T>
+   inline void keep( const T& v )
+   {
+      asm volatile( "" : : "g"( &v ) : "memory" );
+   }
+
+   /** latencies of single operations, reported as percentiles */
+   class latencies
+   {
+      public:
+         void reserve( size_t n ) { _samples.reserve( n ); }
+         void add( int64_t ns )   { _samples.push_back( uint64_t( std::max<int64_t>( ns, 0 ) ) ); }
+
+         uint64_t percentile( double p )
+         {
+            if( _samples.empty() ) return 0;
+            auto nth = _samples.begin() + ptrdiff_t( p * double( _samples.size() - 1 ) );
+            std::nth_element( _samples.begin(), nth, _samples.end() );
+            return *nth;
+         }
+
+         uint64_t max()const  { return _samples.empty() ? 0 : *std::max_element( _samples.begin(), _samples.end() ); }
+         uint64_t mean()const
+         {
+            if( _samples.empty() ) return 0;
+            uint64_t total = 0;
+            for( auto s : _samples ) total += s;
+            return total / _samples.size();
+         }
+
+      private:
+         std::vector<uint64_t> _samples;
+   };
+
+   inline void print_header( const char* title )
+   {
+      printf( "\n== %s ==\n", title );
+   }
+
+   /** one line of a result table: what was measured, how many operations and how long each took */
+   inline void print_rate( const std::string& what, uint64_t operations, int64_t elapsed_ns )
+   {
+      printf( "  %-44s %12llu ops %10.1f ns/op %12.0f ops/s\n", what.c_str(), (unsigned long long)operations,
+              double( elapsed_ns ) / double( std::max<uint64_t>( operations, 1 ) ),
+              double( operations ) * 1e9 / double( std::max<int64_t>( elapsed_ns, 1 ) ) );
+   }
+
+   inline void print_latencies( const std::string& what, latencies& l )
+   {
+      printf( "  %-44s mean %8llu  p50 %8llu  p99 %8llu  p99.9 %8llu  max %10llu ns\n", what.c_str(),
+              (unsigned long long)l.mean(), (unsigned long long)l.percentile( 0.5 ), (unsigned long long)l.percentile( 0.99 ),
+              (unsigned long long)l.percentile( 0.999 ), (unsigned long long)l.max() );
+   }
+
+   /**
+    *  A database in a new directory of its own under options::dir, removed again with the object.
+    *  Only the directory made here is ever removed.
+    */
+   class scratch_database
+   {
+      public:
+         scratch_database( const options& o, uint64_t size_mb )
+         :_dir( ( o.dir.empty() ? bfs::temp_directory_path() : o.dir ) / bfs::unique_path( "chainbase-bench-%%%%-%%%%-%%%%" ) )
+         {
+            db.open( _dir, chainbase::database::read_write, size_mb * 1024 * 1024 );
+         }
+
+         ~scratch_database()
+         {
+            db.close();
+            boost::system::error_code ec;
+            bfs::remove_all( _dir, ec );
+         }
+
+         scratch_database( const scratch_database& ) = delete;
+         scratch_database& operator=( const scratch_database& ) = delete;
+
+         const bfs::path& dir()const { return _dir; }
+
+         /**
+          *  Writes the segments back and drops their pages from this process and from the page
+          *  cache, so the next accesses fault them in from the file as after a restart
+          */
+         void evict()
+         {
+            db.flush();
+
+            std::ifstream maps( "/proc/self/maps" );
+            std::string   line;
+            while( std::getline( maps, line ) ) {
+               auto path = line.find( _dir.native() );
+               if( path == std::string::npos ) continue;
+               unsigned long long begin = 0, end = 0;
+               if( sscanf( line.c_str(), "%llx-%llx", &begin, &end ) == 2 )
+                  madvise( reinterpret_cast<void*>( begin ), end - begin, MADV_DONTNEED );
+            }
+
+            for( bfs::directory_iterator itr( _dir ), last; itr != last; ++itr ) {
+               int fd = ::open( itr->path().c_str(), O_RDONLY );
+               if( fd < 0 ) continue;
+               fdatasync( fd );
+               posix_fadvise( fd, 0, 0, POSIX_FADV_DONTNEED );
+               ::close( fd );
+            }
+         }
+
+         chainbase::database db;
+
+      private:
+         bfs::path _dir;
+   };
+
+} // namespace bench
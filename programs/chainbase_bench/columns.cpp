@@ -0,0 +1,134 @@
+/**
+ *  Row against column storage: summing one field of a wide object over a generic_index, where
+ *  every visit touches a whole multi_index node, and over a column_index, where the scan reads
+ *  only that field's vector.
+ */
+#include "bench.hpp"
+
+#include <chainbase/column_index.hpp>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include <random>
+#include <thread>
+
+namespace {
+
+   using namespace boost::multi_index;
+
+   struct position : public chainbase::object<0, position>
+   {
+      template<typename Constructor, typename Allocator>
+      position( Constructor&& c, Allocator&& ) { c( *this ); }
+
+      id_type id;
+      int64_t owner    = 0;
+      int64_t price    = 0;
+      int64_t quantity = 0;
+      int64_t opened   = 0;
+      int64_t fee      = 0;
+      int64_t flags    = 0;
+   };
+
+   typedef multi_index_container<
+      position,
+      indexed_by< ordered_unique< member<position,position::id_type,&position::id> > >,
+      chainbase::allocator<position>
+   > position_rows;
+
+   typedef chainbase::column<position,int64_t,&position::owner>    owner_column;
+   typedef chainbase::column<position,int64_t,&position::price>    price_column;
+   typedef chainbase::column<position,int64_t,&position::quantity> quantity_column;
+   typedef chainbase::column<position,int64_t,&position::opened>   opened_column;
+   typedef chainbase::column<position,int64_t,&position::fee>      fee_column;
+   typedef chainbase::column<position,int64_t,&position::flags>    flags_column;
+
+   typedef chainbase::column_index< position, owner_column, price_column, quantity_column,
+                                    opened_column, fee_column, flags_column > position_columns;
+
+} // namespace
+
+CHAINBASE_SET_INDEX_TYPE( position, position_rows )
+
+namespace {
+
+   void fill( position& p, std::mt19937_64& rng )
+   {
+      p.owner    = int64_t( rng() % 100000 );
+      p.price    = int64_t( rng() % 10000 );
+      p.quantity = int64_t( rng() % 100 );
+      p.opened   = int64_t( rng() );
+      p.fee      = p.price / 100;
+      p.flags    = int64_t( rng() % 8 );
+   }
+
+   void row_column_scan( const bench::options& o )
+   {
+      const uint64_t count  = std::max<uint64_t>( o.scale, 1000 );
+      const uint64_t size_mb = 64 + count * 512 / ( 1024 * 1024 );
+      const int      passes = 5;
+
+      // both tables would claim position's type id, so each gets a database of its own
+      bench::scratch_database row_db( o, size_mb );
+      bench::scratch_database column_db( o, size_mb );
+      auto& db = row_db.db;
+      db.add_index< position_rows >();
+      column_db.db.add_index< position_columns >();
+      auto& columns = column_db.db.get_mutable_index< position_columns >();
+
+      std::mt19937_64 rng( o.seed );
+      for( uint64_t i = 0; i < count; ++i ) {
+         position p( []( position& ) {}, 0 );
+         fill( p, rng );
+         db.create<position>( [&]( position& r ) { auto id = r.id; r = p; r.id = id; } );
+         columns.emplace( [&]( position& c ) { auto id = c.id; c = p; c.id = id; } );
+      }
+      for( uint64_t i = 0; i < count; i += 16 ) {
+         db.remove( db.get<position>( position::id_type( i ) ) );
+         columns.remove( position::id_type( i ) );
+      }
+
+      const uint64_t visits = columns.size() * passes;
+      int64_t expected = 0;
+      int64_t start = bench::now_ns();
+      for( int p = 0; p < passes; ++p ) {
+         int64_t sum = 0;
+         for( const auto& r : db.get_index< position_rows >().indices() )
+            sum += r.price;
+         expected = sum;
+      }
+      bench::print_rate( "generic_index sum of price", visits, bench::now_ns() - start );
+      bench::keep( expected );
+
+      int64_t sum = 0;
+      start = bench::now_ns();
+      for( int p = 0; p < passes; ++p ) {
+         sum = 0;
+         const int64_t* price = columns.column_data< price_column >();
+         const uint8_t* live  = columns.live_data();
+         for( size_t i = 0; i < columns.slots(); ++i )
+            sum += live[i] ? price[i] : 0;
+      }
+      bench::print_rate( "column_index column_data sum of price", visits, bench::now_ns() - start );
+      if( sum != expected ) BOOST_THROW_EXCEPTION( std::logic_error( "row and column sums differ" ) );
+
+      auto all = []( int64_t ) { return true; };
+      start = bench::now_ns();
+      for( int p = 0; p < passes; ++p )
+         sum = columns.aggregate< price_column >( all ).sum;
+      bench::print_rate( "column_index aggregate of price", visits, bench::now_ns() - start );
+      if( sum != expected ) BOOST_THROW_EXCEPTION( std::logic_error( "row and column sums differ" ) );
+
+      const uint32_t threads = std::max( 1u, std::thread::hardware_concurrency() );
+      start = bench::now_ns();
+      for( int p = 0; p < passes; ++p )
+         sum = columns.aggregate< price_column >( all, 0, -1, threads ).sum;
+      bench::print_rate( "column_index aggregate of price, " + std::to_string( threads ) + " threads", visits, bench::now_ns() - start );
+      if( sum != expected ) BOOST_THROW_EXCEPTION( std::logic_error( "row and column sums differ" ) );
+   }
+
+   bench::registrar scan( "row_column_scan", "sum of one field of a wide object, generic_index against column_index", row_column_scan );
+
+} // namespace
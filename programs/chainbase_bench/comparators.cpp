@@ -0,0 +1,127 @@
+/**
+ *  Key comparison: strcmp against the length aware compare_bytes on strings with a long common
+ *  prefix, and composite_key against normalized_composite_key, on their own and as the key of an
+ *  ordered index.
+ */
+#include "bench.hpp"
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/composite_key.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include <cstring>
+#include <random>
+
+namespace {
+
+   using namespace boost::multi_index;
+
+   struct row
+   {
+      int64_t  owner;
+      uint32_t kind;
+      int64_t  serial;
+   };
+
+   typedef composite_key< row, member<row,int64_t,&row::owner>, member<row,uint32_t,&row::kind>, member<row,int64_t,&row::serial> > row_key;
+   typedef chainbase::normalized_composite_key< row, member<row,int64_t,&row::owner>, member<row,uint32_t,&row::kind>, member<row,int64_t,&row::serial> > row_normalized_key;
+
+   typedef multi_index_container< row, indexed_by< ordered_unique< row_key > > >            composite_rows;
+   typedef multi_index_container< row, indexed_by< ordered_unique< row_normalized_key > > > normalized_rows;
+
+   void compare_strings( const bench::options& o )
+   {
+      std::mt19937_64 rng( o.seed );
+      const size_t    count = 1 << 14;
+      const uint64_t  compares = std::max<uint64_t>( o.scale, 1000 ) * 4;
+
+      for( size_t prefix : { 0, 16, 64, 256 } ) {
+         std::vector<std::string> keys( count );
+         for( auto& k : keys ) {
+            k.assign( prefix, 'p' );
+            for( int i = 0; i < 8; ++i ) k.push_back( char( 'a' + rng() % 26 ) );
+         }
+         std::vector<std::pair<uint32_t, uint32_t>> pairs( 1 << 16 );
+         for( auto& p : pairs ) p = std::make_pair( uint32_t( rng() % count ), uint32_t( rng() % count ) );
+
+         int64_t result = 0;
+         int64_t start = bench::now_ns();
+         for( uint64_t i = 0; i < compares; ++i ) {
+            const auto& p = pairs[ i & ( pairs.size() - 1 ) ];
+            result += std::strcmp( keys[p.first].c_str(), keys[p.second].c_str() ) < 0;
+         }
+         bench::print_rate( "strcmp, prefix " + std::to_string( prefix ), compares, bench::now_ns() - start );
+         bench::keep( result );
+
+         start = bench::now_ns();
+         for( uint64_t i = 0; i < compares; ++i ) {
+            const auto& p = pairs[ i & ( pairs.size() - 1 ) ];
+            const auto& a = keys[p.first];
+            const auto& b = keys[p.second];
+            result += chainbase::detail::compare_bytes( a.data(), a.size(), b.data(), b.size() ) < 0;
+         }
+         bench::print_rate( "compare_bytes, prefix " + std::to_string( prefix ), compares, bench::now_ns() - start );
+         bench::keep( result );
+      }
+   }
+
+   template<typename Container>
+   void index_lookups( const char* name, const std::vector<row>& rows, const std::vector<uint32_t>& order )
+   {
+      Container c;
+      int64_t start = bench::now_ns();
+      for( const auto& r : rows ) c.insert( r );
+      bench::print_rate( std::string( name ) + " insert", rows.size(), bench::now_ns() - start );
+
+      int64_t found = 0;
+      const auto& idx = c.template get<0>();
+      const auto  key = typename Container::template nth_index<0>::type::key_from_value();
+      start = bench::now_ns();
+      for( auto i : order )
+         found += idx.find( key( rows[i] ) ) != idx.end();
+      bench::print_rate( std::string( name ) + " find", order.size(), bench::now_ns() - start );
+      bench::keep( found );
+   }
+
+   void compare_composite_keys( const bench::options& o )
+   {
+      std::mt19937_64 rng( o.seed );
+      std::vector<row> rows( std::max<uint64_t>( o.scale, 1000 ) );
+      for( size_t i = 0; i < rows.size(); ++i )
+         rows[i] = row{ int64_t( rng() % 1000 ), uint32_t( rng() % 4 ), int64_t( i ) };
+      std::vector<uint32_t> order( rows.size() );
+      for( size_t i = 0; i < order.size(); ++i ) order[i] = uint32_t( i );
+      std::shuffle( order.begin(), order.end(), rng );
+
+      const row_key            composite = row_key();
+      const row_normalized_key normalized = row_normalized_key();
+      const uint64_t           compares = rows.size() * 4;
+
+      int64_t result = 0;
+      int64_t start = bench::now_ns();
+      for( uint64_t i = 0; i < compares; ++i ) {
+         const row& a = rows[ order[ i % order.size() ] ];
+         const row& b = rows[ order[ ( i + 1 ) % order.size() ] ];
+         result += composite( a ) < composite( b );
+      }
+      bench::print_rate( "composite_key compare", compares, bench::now_ns() - start );
+      bench::keep( result );
+
+      start = bench::now_ns();
+      for( uint64_t i = 0; i < compares; ++i ) {
+         const row& a = rows[ order[ i % order.size() ] ];
+         const row& b = rows[ order[ ( i + 1 ) % order.size() ] ];
+         result += normalized( a ) < normalized( b );
+      }
+      bench::print_rate( "normalized_composite_key compare", compares, bench::now_ns() - start );
+      bench::keep( result );
+
+      index_lookups<composite_rows>( "composite_key index", rows, order );
+      index_lookups<normalized_rows>( "normalized_composite_key index", rows, order );
+   }
+
+   bench::registrar strings( "compare_strings", "strcmp against compare_bytes on keys with a common prefix", compare_strings );
+   bench::registrar composite( "compare_composite", "composite_key against normalized_composite_key, alone and in an index", compare_composite_keys );
+
+} // namespace
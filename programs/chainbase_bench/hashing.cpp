@@ -0,0 +1,93 @@
+/**
+ *  Insert latency of a table with a hash index on a key: a hashed_unique index of the
+ *  multi_index_container, which rehashes every bucket inside the insert that crosses its load
+ *  factor, against hash_index, which splits one bucket per insert.
+ */
+#include "bench.hpp"
+
+#include <chainbase/hash_index.hpp>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/hashed_index.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include <random>
+
+namespace {
+
+   using namespace boost::multi_index;
+
+   struct by_number;
+
+   struct holder : public chainbase::object<0, holder>
+   {
+      template<typename Constructor, typename Allocator>
+      holder( Constructor&& c, Allocator&& ) { c( *this ); }
+
+      id_type  id;
+      uint64_t number  = 0;
+      int64_t  balance = 0;
+   };
+
+   typedef multi_index_container<
+      holder,
+      indexed_by< ordered_unique< member<holder,holder::id_type,&holder::id> > >,
+      chainbase::allocator<holder>
+   > holder_index;
+
+   typedef multi_index_container<
+      holder,
+      indexed_by<
+         ordered_unique< member<holder,holder::id_type,&holder::id> >,
+         hashed_unique< tag<by_number>, member<holder,uint64_t,&holder::number> >
+      >,
+      chainbase::allocator<holder>
+   > hashed_holder_index;
+
+   typedef chainbase::hash_index< holder_index, member<holder,uint64_t,&holder::number> > holder_by_number;
+
+   template<typename MultiIndexType>
+   void inserts( chainbase::database& db, const std::string& what, uint64_t count, uint32_t seed )
+   {
+      auto& table = db.get_mutable_index< MultiIndexType >();
+      std::mt19937_64 rng( seed );
+      bench::latencies l;
+      l.reserve( count );
+      int64_t begin = bench::now_ns();
+      for( uint64_t i = 0; i < count; ++i ) {
+         const uint64_t number = rng();
+         int64_t start = bench::now_ns();
+         table.emplace( [&]( holder& h ) { h.number = number; } );
+         l.add( bench::now_ns() - start );
+      }
+      bench::print_rate( what, count, bench::now_ns() - begin );
+      bench::print_latencies( what, l );
+   }
+
+   void hash_inserts( const bench::options& o )
+   {
+      const uint64_t count   = std::max<uint64_t>( o.scale, 1000 );
+      const uint64_t size_mb = 64 + count * 512 / ( 1024 * 1024 );
+      {
+         bench::scratch_database s( o, size_mb );
+         s.db.add_index< holder_index >();
+         inserts< holder_index >( s.db, "no hash index", count, o.seed );
+      }
+      {
+         bench::scratch_database s( o, size_mb );
+         s.db.add_index< hashed_holder_index >();
+         inserts< hashed_holder_index >( s.db, "hashed_unique", count, o.seed );
+      }
+      {
+         bench::scratch_database s( o, size_mb );
+         s.db.add_index< holder_index >();
+         const auto& by_number = s.db.add_secondary_index< holder_by_number >();
+         inserts< holder_index >( s.db, "hash_index", count, o.seed );
+         printf( "  hash_index of %llu entries in %llu buckets\n", (unsigned long long)by_number.size(), (unsigned long long)by_number.bucket_count() );
+      }
+   }
+
+   bench::registrar hashing( "hash_inserts", "insert latency with hashed_unique against hash_index on a key", hash_inserts );
+
+} // namespace
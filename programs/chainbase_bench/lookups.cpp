@@ -0,0 +1,146 @@
+/**
+ *  Point lookups: keys that do not exist, with and without a key_filter in front of the index,
+ *  while the segment is in memory and right after its pages were dropped, and batches of keys
+ *  looked up with find_many against a loop of find calls.
+ */
+#include "bench.hpp"
+
+#include <chainbase/key_filter.hpp>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include <random>
+
+namespace {
+
+   using namespace boost::multi_index;
+
+   struct by_key;
+
+   struct entry : public chainbase::object<0, entry>
+   {
+      template<typename Constructor, typename Allocator>
+      entry( Constructor&& c, Allocator&& ) { c( *this ); }
+
+      id_type  id;
+      uint64_t key   = 0;
+      int64_t  value = 0;
+   };
+
+   typedef multi_index_container<
+      entry,
+      indexed_by<
+         ordered_unique< member<entry,entry::id_type,&entry::id> >,
+         ordered_unique< tag<by_key>, member<entry,uint64_t,&entry::key> >
+      >,
+      chainbase::allocator<entry>
+   > entry_index;
+
+} // namespace
+
+CHAINBASE_SET_INDEX_TYPE( entry, entry_index )
+
+namespace {
+
+   typedef chainbase::key_filter< entry_index, by_key > entry_filter;
+
+   /** keys of existing entries are even, so key | 1 never exists */
+   uint64_t key_of( uint64_t i ) { return ( i * 0x9e3779b97f4a7c15ull ) & ~1ull; }
+
+   void measure( chainbase::database& db, const std::string& what, const std::vector<uint64_t>& keys )
+   {
+      bench::latencies l;
+      l.reserve( keys.size() );
+      uint64_t found = 0;
+      for( auto k : keys ) {
+         int64_t start = bench::now_ns();
+         found += db.find< entry, by_key >( k ) != nullptr;
+         l.add( bench::now_ns() - start );
+      }
+      bench::print_latencies( what, l );
+      bench::keep( found );
+   }
+
+   /** rounds of lookups, each started with every page of the database dropped */
+   void measure_cold( bench::scratch_database& s, const std::string& what, const std::vector<uint64_t>& keys )
+   {
+      const size_t per_round = 256;
+      bench::latencies l;
+      uint64_t found = 0;
+      for( size_t r = 0; r * per_round < keys.size(); ++r ) {
+         s.evict();
+         for( size_t i = r * per_round; i < std::min( keys.size(), ( r + 1 ) * per_round ); ++i ) {
+            int64_t start = bench::now_ns();
+            found += s.db.find< entry, by_key >( keys[i] ) != nullptr;
+            l.add( bench::now_ns() - start );
+         }
+      }
+      bench::print_latencies( what, l );
+      bench::keep( found );
+   }
+
+   void miss_latency( const bench::options& o )
+   {
+      const uint64_t count = std::max<uint64_t>( o.scale, 1000 );
+      bench::scratch_database s( o, 64 + count * 256 / ( 1024 * 1024 ) );
+      auto& db = s.db;
+      db.add_index< entry_index >();
+      for( uint64_t i = 0; i < count; ++i )
+         db.create< entry >( [&]( entry& e ) { e.key = key_of( i ); e.value = int64_t( i ); } );
+
+      std::mt19937_64 rng( o.seed );
+      std::vector<uint64_t> hits( std::min<uint64_t>( count, 200000 ) ), misses( hits.size() ), cold( 4096 );
+      for( auto& k : hits )   k = key_of( rng() % count );
+      for( auto& k : misses ) k = key_of( rng() % count ) | 1;
+      for( auto& k : cold )   k = key_of( rng() % count ) | 1;
+
+      measure( db, "find hit", hits );
+      measure( db, "find miss", misses );
+      measure_cold( s, "find miss, cold", cold );
+
+      const auto& filter = db.add_secondary_index< entry_filter >();
+      printf( "  key_filter of %llu keys sized for %llu\n", (unsigned long long)filter.keys(), (unsigned long long)filter.capacity() );
+
+      measure( db, "find hit, key_filter", hits );
+      measure( db, "find miss, key_filter", misses );
+      measure_cold( s, "find miss, key_filter, cold", cold );
+   }
+
+   void batched_lookups( const bench::options& o )
+   {
+      const uint64_t count = std::max<uint64_t>( o.scale, 1000 );
+      bench::scratch_database s( o, 64 + count * 256 / ( 1024 * 1024 ) );
+      auto& db = s.db;
+      db.add_index< entry_index >();
+      for( uint64_t i = 0; i < count; ++i )
+         db.create< entry >( [&]( entry& e ) { e.key = key_of( i ); e.value = int64_t( i ); } );
+
+      std::mt19937_64 rng( o.seed );
+      const size_t lookups = std::min<uint64_t>( count, 1000000 );
+      for( size_t batch : { 16, 256, 4096 } ) {
+         std::vector<std::vector<uint64_t>> batches( ( lookups + batch - 1 ) / batch, std::vector<uint64_t>( batch ) );
+         for( auto& b : batches )
+            for( auto& k : b ) k = key_of( rng() % count ) | ( rng() % 4 == 0 );   // a quarter miss
+
+         uint64_t found = 0;
+         int64_t start = bench::now_ns();
+         for( const auto& b : batches )
+            for( auto k : b ) found += db.find< entry, by_key >( k ) != nullptr;
+         bench::print_rate( "find loop, batches of " + std::to_string( batch ), batches.size() * batch, bench::now_ns() - start );
+
+         uint64_t found_many = 0;
+         start = bench::now_ns();
+         for( const auto& b : batches )
+            for( auto obj : db.find_many< entry, by_key >( b ) ) found_many += obj != nullptr;
+         bench::print_rate( "find_many, batches of " + std::to_string( batch ), batches.size() * batch, bench::now_ns() - start );
+
+         if( found != found_many ) BOOST_THROW_EXCEPTION( std::logic_error( "find_many and find disagree" ) );
+      }
+   }
+
+   bench::registrar misses( "miss_latency", "latency of finding keys that do not exist, with and without key_filter, warm and cold", miss_latency );
+   bench::registrar batches( "find_many", "find_many against a loop of find over batches of random keys", batched_lookups );
+
+} // namespace
@@ -0,0 +1,60 @@
+/**
+ *  Microbenchmarks of chainbase tables, indices and undo, one case per feature.
+ *
+ *    chainbase_bench [--scale <n>] [--dir <path>] [--seed <n>] [--list] [case ...]
+ *
+ *  Without case names every case runs.  --scale sets the number of objects or keys a case works
+ *  on.  Cases that need a database make one in a new directory under --dir (the system temporary
+ *  directory by default) and remove that directory when they are done.
+ */
+#include "bench.hpp"
+
+#include <iostream>
+
+int main( int argc, char** argv )
+{
+   bench::options           options;
+   std::vector<std::string> selected;
+   bool                     list = false;
+
+   for( int i = 1; i < argc; ++i ) {
+      const std::string arg = argv[i];
+      if( arg == "--scale" && i + 1 < argc )     options.scale = std::stoull( argv[++i] );
+      else if( arg == "--dir" && i + 1 < argc )  options.dir = argv[++i];
+      else if( arg == "--seed" && i + 1 < argc ) options.seed = uint32_t( std::stoul( argv[++i] ) );
+      else if( arg == "--list" )                 list = true;
+      else if( arg[0] != '-' )                   selected.push_back( arg );
+      else {
+         std::cerr << "usage: chainbase_bench [--scale <n>] [--dir <path>] [--seed <n>] [--list] [case ...]\n";
+         return 1;
+      }
+   }
+
+   auto& cases = bench::cases();
+   std::sort( cases.begin(), cases.end(), []( const bench::bench_case& a, const bench::bench_case& b ) { return a.name < b.name; } );
+
+   if( list ) {
+      for( const auto& c : cases )
+         printf( "%-20s %s\n", c.name.c_str(), c.description.c_str() );
+      return 0;
+   }
+
+   for( const auto& name : selected ) {
+      if( std::none_of( cases.begin(), cases.end(), [&]( const bench::bench_case& c ) { return c.name == name; } ) ) {
+         std::cerr << "unknown case " << name << ", see --list\n";
+         return 1;
+      }
+   }
+
+   try {
+      for( const auto& c : cases ) {
+         if( !selected.empty() && std::find( selected.begin(), selected.end(), c.name ) == selected.end() ) continue;
+         bench::print_header( c.name.c_str() );
+         c.run( options );
+      }
+   } catch( const std::exception& e ) {
+      std::cerr << e.what() << "\n";
+      return 1;
+   }
+   return 0;
+}
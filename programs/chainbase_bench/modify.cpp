@@ -0,0 +1,97 @@
+/**
+ *  Changing a field that no index uses, in a table with four secondary indices: modify, which
+ *  checks and relinks the object in every index, against modify_fields, which only compares keys.
+ */
+#include "bench.hpp"
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/composite_key.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include <random>
+
+namespace {
+
+   using namespace boost::multi_index;
+
+   struct by_owner;
+   struct by_symbol;
+   struct by_expiry;
+   struct by_owner_symbol;
+
+   struct order : public chainbase::object<0, order>
+   {
+      template<typename Constructor, typename Allocator>
+      order( Constructor&& c, Allocator&& ) { c( *this ); }
+
+      id_type  id;
+      uint64_t owner   = 0;
+      uint64_t symbol  = 0;
+      int64_t  expiry  = 0;
+      int64_t  price   = 0;
+      int64_t  filled  = 0;
+   };
+
+   typedef multi_index_container<
+      order,
+      indexed_by<
+         ordered_unique< member<order,order::id_type,&order::id> >,
+         ordered_non_unique< tag<by_owner>, member<order,uint64_t,&order::owner> >,
+         ordered_non_unique< tag<by_symbol>, member<order,uint64_t,&order::symbol> >,
+         ordered_non_unique< tag<by_expiry>, member<order,int64_t,&order::expiry> >,
+         ordered_unique< tag<by_owner_symbol>,
+            composite_key< order, member<order,uint64_t,&order::owner>, member<order,uint64_t,&order::symbol>, member<order,order::id_type,&order::id> >
+         >
+      >,
+      chainbase::allocator<order>
+   > order_index;
+
+} // namespace
+
+CHAINBASE_SET_INDEX_TYPE( order, order_index )
+
+namespace {
+
+   void non_key_modify( const bench::options& o )
+   {
+      const uint64_t count = std::max<uint64_t>( o.scale, 1000 );
+      bench::scratch_database s( o, 64 + count * 512 / ( 1024 * 1024 ) );
+      auto& db = s.db;
+      db.add_index< order_index >();
+
+      std::mt19937_64 rng( o.seed );
+      for( uint64_t i = 0; i < count; ++i )
+         db.create< order >( [&]( order& r ) {
+            r.owner  = rng() % 10000;
+            r.symbol = rng() % 500;
+            r.expiry = int64_t( rng() % 1000000 );
+            r.price  = int64_t( rng() % 100000 );
+         });
+
+      std::vector<order::id_type> ids( count );
+      for( auto& id : ids ) id = order::id_type( int64_t( rng() % count ) );
+
+      // with undo enabled each session is undone as it goes out of scope
+      for( bool undo : { false, true } ) {
+         const std::string suffix = undo ? ", in undo session" : "";
+         {
+            auto session = db.start_undo_session( undo );
+            int64_t start = bench::now_ns();
+            for( auto id : ids )
+               db.modify( db.get( id ), []( order& r ) { ++r.filled; } );
+            bench::print_rate( "modify" + suffix, ids.size(), bench::now_ns() - start );
+         }
+         {
+            auto session = db.start_undo_session( undo );
+            int64_t start = bench::now_ns();
+            for( auto id : ids )
+               db.modify_fields( db.get( id ), []( order& r ) { ++r.filled; } );
+            bench::print_rate( "modify_fields" + suffix, ids.size(), bench::now_ns() - start );
+         }
+      }
+   }
+
+   bench::registrar modify( "non_key_modify", "modify against modify_fields of a non key field with four secondary indices", non_key_modify );
+
+} // namespace
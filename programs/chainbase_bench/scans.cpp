@@ -0,0 +1,168 @@
+/**
+ *  Range scans over a table whose objects are scattered through a fragmented segment: before and
+ *  after database::compact() lays them out again in id order, and with the pages evicted, plain
+ *  against prefetched_for_each().
+ */
+#include "bench.hpp"
+
+#include <chainbase/prefetch.hpp>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include <random>
+
+namespace {
+
+   using namespace boost::multi_index;
+
+   struct by_account;
+
+   struct trade : public chainbase::object<0, trade>
+   {
+      template<typename Constructor, typename Allocator>
+      trade( Constructor&& c, Allocator&& ) { c( *this ); }
+
+      id_type  id;
+      uint64_t account  = 0;
+      int64_t  price    = 0;
+      int64_t  quantity = 0;
+   };
+
+   /** objects created between trades and removed again, leaving holes behind */
+   struct churn : public chainbase::object<1, churn>
+   {
+      template<typename Constructor, typename Allocator>
+      churn( Constructor&& c, Allocator&& ) { c( *this ); }
+
+      id_type id;
+      char    payload[88];
+   };
+
+   typedef multi_index_container<
+      trade,
+      indexed_by<
+         ordered_unique< member<trade,trade::id_type,&trade::id> >,
+         ordered_non_unique< tag<by_account>, member<trade,uint64_t,&trade::account> >
+      >,
+      chainbase::allocator<trade>
+   > trade_index;
+
+   typedef multi_index_container<
+      churn,
+      indexed_by< ordered_unique< member<churn,churn::id_type,&churn::id> > >,
+      chainbase::allocator<churn>
+   > churn_index;
+
+} // namespace
+
+CHAINBASE_SET_INDEX_TYPE( trade, trade_index )
+CHAINBASE_SET_INDEX_TYPE( churn, churn_index )
+
+namespace {
+
+   /** sums the price of every trade in id order and in account order, warm and after eviction */
+   void scans( bench::scratch_database& s, const std::string& state )
+   {
+      auto& db = s.db;
+      const auto& trades = db.get_index< trade_index >().indices();
+
+      for( bool cold : { false, true } ) {
+         if( cold ) s.evict();
+         const std::string suffix = state + ( cold ? ", cold" : "" );
+
+         int64_t sum = 0;
+         int64_t start = bench::now_ns();
+         for( const auto& t : trades ) sum += t.price;
+         bench::print_rate( "scan by id" + suffix, trades.size(), bench::now_ns() - start );
+         bench::keep( sum );
+
+         if( cold ) s.evict();
+         sum = 0;
+         start = bench::now_ns();
+         for( const auto& t : trades.get<by_account>() ) sum += t.price;
+         bench::print_rate( "scan by account" + suffix, trades.size(), bench::now_ns() - start );
+         bench::keep( sum );
+      }
+   }
+
+   void print_free_space( chainbase::database& db )
+   {
+      auto report = db.get_memory_report();
+      printf( "  free %llu MiB, largest free block %llu MiB, %llu bytes in small fragments\n",
+              (unsigned long long)( report.free_bytes >> 20 ), (unsigned long long)( report.largest_free_block >> 20 ),
+              (unsigned long long)report.small_fragment_bytes );
+   }
+
+   /** count trades created in between objects of another table that are then removed */
+   void fragmented_trades( bench::scratch_database& s, const bench::options& o, uint64_t count )
+   {
+      auto& db = s.db;
+      db.add_index< trade_index >();
+      db.add_index< churn_index >();
+
+      std::mt19937_64 rng( o.seed );
+      for( uint64_t i = 0; i < count; ++i ) {
+         db.create< trade >( [&]( trade& t ) {
+            t.account  = rng() % 10000;
+            t.price    = int64_t( rng() % 100000 );
+            t.quantity = int64_t( rng() % 100 );
+         });
+         for( int c = int( rng() % 4 ); c > 0; --c )
+            db.create< churn >( []( churn& ) {} );
+      }
+      auto& churns = db.get_mutable_index< churn_index >();
+      while( !churns.indices().empty() ) churns.remove( *churns.indices().begin() );
+   }
+
+   void compacted_scans( const bench::options& o )
+   {
+      const uint64_t count = std::max<uint64_t>( o.scale, 1000 );
+      bench::scratch_database s( o, 64 + count * 512 / ( 1024 * 1024 ) );
+      auto& db = s.db;
+      fragmented_trades( s, o, count );
+
+      print_free_space( db );
+      scans( s, ", fragmented" );
+
+      int64_t start = bench::now_ns();
+      db.compact();
+      printf( "  compact() of %llu trades took %.1f ms\n", (unsigned long long)count, double( bench::now_ns() - start ) / 1e6 );
+
+      print_free_space( db );
+      scans( s, ", compacted" );
+   }
+
+   void prefetched_scans( const bench::options& o )
+   {
+      const uint64_t count = std::max<uint64_t>( o.scale, 1000 );
+      bench::scratch_database s( o, 64 + count * 512 / ( 1024 * 1024 ) );
+      fragmented_trades( s, o, count );
+
+      const auto& accounts = s.db.get_index< trade_index >().indices().get<by_account>();
+      auto run = [&]( const std::string& what, const std::function<void( const std::function<void( const trade& )>& )>& scan ) {
+         s.evict();
+         int64_t sum = 0;
+         int64_t start = bench::now_ns();
+         scan( [&]( const trade& t ) { sum += t.price; } );
+         bench::print_rate( what, accounts.size(), bench::now_ns() - start );
+         bench::keep( sum );
+      };
+
+      run( "cold scan by account", [&]( const std::function<void( const trade& )>& visit ) {
+         for( const auto& t : accounts ) visit( t );
+      });
+      for( bool helper : { false, true } ) {
+         chainbase::prefetch_options options;
+         options.helper_thread = helper;
+         run( std::string( "cold prefetched_for_each, " ) + ( helper ? "helper thread" : "inline" ), [&]( const std::function<void( const trade& )>& visit ) {
+            chainbase::prefetched_for_each( accounts.begin(), accounts.end(), visit, options );
+         });
+      }
+   }
+
+   bench::registrar compaction( "compacted_scans", "scans of a fragmented table before and after compact()", compacted_scans );
+   bench::registrar prefetch( "prefetched_scans", "cold scans of a fragmented table, plain against prefetched_for_each", prefetched_scans );
+
+} // namespace
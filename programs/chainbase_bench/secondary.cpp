@@ -0,0 +1,96 @@
+/**
+ *  Adding an index to a table that is already full: the bulk build of a secondary_index from a
+ *  parallel sort, against the cost the same index adds to every insert when it is part of the
+ *  multi_index_container from the start.
+ */
+#include "bench.hpp"
+
+#include <chainbase/secondary_index.hpp>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include <random>
+#include <thread>
+
+namespace {
+
+   using namespace boost::multi_index;
+
+   struct by_holder;
+
+   struct note : public chainbase::object<0, note>
+   {
+      template<typename Constructor, typename Allocator>
+      note( Constructor&& c, Allocator&& ) { c( *this ); }
+
+      id_type  id;
+      uint64_t holder = 0;
+      int64_t  amount = 0;
+   };
+
+   typedef multi_index_container<
+      note,
+      indexed_by< ordered_unique< member<note,note::id_type,&note::id> > >,
+      chainbase::allocator<note>
+   > note_index;
+
+   typedef multi_index_container<
+      note,
+      indexed_by<
+         ordered_unique< member<note,note::id_type,&note::id> >,
+         ordered_non_unique< tag<by_holder>, member<note,uint64_t,&note::holder> >
+      >,
+      chainbase::allocator<note>
+   > note_by_holder_index;
+
+   typedef chainbase::secondary_index< note_index, member<note,uint64_t,&note::holder> > note_by_holder;
+
+   template<typename MultiIndexType>
+   int64_t fill( chainbase::database& db, uint64_t count, uint32_t seed )
+   {
+      auto& table = db.get_mutable_index< MultiIndexType >();
+      std::mt19937_64 rng( seed );
+      int64_t start = bench::now_ns();
+      for( uint64_t i = 0; i < count; ++i )
+         table.emplace( [&]( note& n ) { n.holder = rng() % ( count / 4 + 1 ); n.amount = int64_t( i ); } );
+      return bench::now_ns() - start;
+   }
+
+   void secondary_build( const bench::options& o )
+   {
+      const uint64_t count   = std::max<uint64_t>( o.scale, 1000 );
+      const uint64_t size_mb = 64 + count * 512 / ( 1024 * 1024 );
+
+      int64_t without = 0;
+      {
+         bench::scratch_database s( o, size_mb );
+         s.db.add_index< note_index >();
+         without = fill< note_index >( s.db, count, o.seed );
+         bench::print_rate( "inserts, id index only", count, without );
+      }
+      {
+         bench::scratch_database s( o, size_mb );
+         s.db.add_index< note_by_holder_index >();
+         int64_t with = fill< note_by_holder_index >( s.db, count, o.seed );
+         bench::print_rate( "inserts, with ordered_non_unique by holder", count, with );
+         printf( "  %-44s %.1f ms over %llu inserts\n", "added by the index", double( with - without ) / 1e6, (unsigned long long)count );
+      }
+
+      std::vector<uint32_t> thread_counts{ 1 };
+      if( std::thread::hardware_concurrency() > 1 ) thread_counts.push_back( std::thread::hardware_concurrency() );
+      for( uint32_t threads : thread_counts ) {
+         bench::scratch_database s( o, size_mb );
+         s.db.add_index< note_index >();
+         fill< note_index >( s.db, count, o.seed );
+         int64_t start = bench::now_ns();
+         const auto& by_holder = s.db.add_secondary_index< note_by_holder >( threads );
+         const int64_t elapsed = bench::now_ns() - start;
+         bench::print_rate( "secondary_index build, " + std::to_string( threads ) + " threads", by_holder.size(), elapsed );
+      }
+   }
+
+   bench::registrar build( "secondary_build", "bulk build of a secondary_index against maintaining the index from the start", secondary_build );
+
+} // namespace
@@ -0,0 +1,84 @@
+/**
+ *  A tiered_index holding most of its objects in the cold store: the cost of evict(), the segment
+ *  memory it frees and the latency of get() and fetch() for hot and evicted objects.
+ */
+#include "bench.hpp"
+
+#include <chainbase/tiered_index.hpp>
+
+#include <random>
+
+namespace {
+
+   struct ledger_entry : public chainbase::object<0, ledger_entry>
+   {
+      template<typename Constructor, typename Allocator>
+      ledger_entry( Constructor&& c, Allocator&& ) { c( *this ); }
+
+      id_type  id;
+      uint64_t account = 0;
+      int64_t  amount  = 0;
+      int64_t  time    = 0;
+      char     memo[32] = {};
+   };
+
+   typedef chainbase::tiered_index< ledger_entry > ledger_tiers;
+
+   template<typename Lookup>
+   void lookups( const std::string& what, const std::vector<ledger_entry::id_type>& ids, Lookup&& lookup )
+   {
+      bench::latencies l;
+      l.reserve( ids.size() );
+      int64_t sum = 0;
+      for( auto id : ids ) {
+         int64_t start = bench::now_ns();
+         sum += lookup( id ).amount;
+         l.add( bench::now_ns() - start );
+      }
+      bench::print_latencies( what, l );
+      bench::keep( sum );
+   }
+
+   void tiered_lookups( const bench::options& o )
+   {
+      const uint64_t count = std::max<uint64_t>( o.scale, 1000 );
+      const uint64_t hot   = count / 10;
+      bench::scratch_database s( o, 64 + count * 512 / ( 1024 * 1024 ) );
+      auto& db = s.db;
+      db.add_index< ledger_tiers >();
+      auto& table = db.get_mutable_index< ledger_tiers >();
+
+      std::mt19937_64 rng( o.seed );
+      for( uint64_t i = 0; i < count; ++i )
+         table.emplace( [&]( ledger_entry& e ) {
+            e.account = rng() % 100000;
+            e.amount  = int64_t( rng() % 1000000 );
+            e.time    = int64_t( i );
+         });
+
+      const auto free_before = db.get_free_memory();
+      int64_t start = bench::now_ns();
+      size_t evicted = table.evict( hot );
+      // a first pass only clears the reference flags set by emplace
+      evicted += table.evict( hot );
+      bench::print_rate( "evict", evicted, bench::now_ns() - start );
+      printf( "  %llu hot, %llu cold, %llu MiB of segment freed, %llu MiB cold store\n",
+              (unsigned long long)table.hot_size(), (unsigned long long)table.cold_size(),
+              (unsigned long long)( ( db.get_free_memory() - free_before ) >> 20 ), (unsigned long long)( table.cold_bytes() >> 20 ) );
+
+      std::vector<ledger_entry::id_type> hot_ids, cold_ids;
+      while( hot_ids.size() < 100000 && hot_ids.size() < table.hot_size() ) {
+         ledger_entry::id_type id( int64_t( rng() % count ) );
+         ( table.is_hot( id ) ? hot_ids : cold_ids ).push_back( id );
+      }
+
+      lookups( "get, hot", hot_ids, [&]( ledger_entry::id_type id ) { return table.get( id ); } );
+      lookups( "get, cold", cold_ids, [&]( ledger_entry::id_type id ) { return table.get( id ); } );
+      s.evict();
+      lookups( "get, cold, store evicted from page cache", cold_ids, [&]( ledger_entry::id_type id ) { return table.get( id ); } );
+      lookups( "fetch, cold", cold_ids, [&]( ledger_entry::id_type id ) { return table.fetch( id ); } );
+   }
+
+   bench::registrar tiers( "tiered_lookups", "evict() and get() / fetch() of hot and evicted objects of a tiered_index", tiered_lookups );
+
+} // namespace
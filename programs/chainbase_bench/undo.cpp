@@ -0,0 +1,167 @@
+/**
+ *  Unwinding a fork: undoing many levels of modifications at once, for a trivially copyable
+ *  object, whose saved values undo copies back in place when no key changed, and for the same
+ *  object with a destructor, which undo always passes through multi_index_container::modify().
+ *  And the segment memory held by deep undo histories with and without packed levels.
+ */
+#include "bench.hpp"
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include <random>
+
+namespace {
+
+   using namespace boost::multi_index;
+
+   struct by_owner;
+   struct by_symbol;
+   struct by_expiry;
+
+   struct balance_row : public chainbase::object<0, balance_row>
+   {
+      template<typename Constructor, typename Allocator>
+      balance_row( Constructor&& c, Allocator&& ) { c( *this ); }
+
+      id_type  id;
+      uint64_t owner   = 0;
+      uint64_t symbol  = 0;
+      int64_t  expiry  = 0;
+      int64_t  amount  = 0;
+   };
+
+   /** balance_row that is not trivially copyable */
+   struct tracked_balance_row : public chainbase::object<1, tracked_balance_row>
+   {
+      template<typename Constructor, typename Allocator>
+      tracked_balance_row( Constructor&& c, Allocator&& ) { c( *this ); }
+      tracked_balance_row( const tracked_balance_row& ) = default;
+      tracked_balance_row& operator=( const tracked_balance_row& ) = default;
+      ~tracked_balance_row() {}
+
+      id_type  id;
+      uint64_t owner   = 0;
+      uint64_t symbol  = 0;
+      int64_t  expiry  = 0;
+      int64_t  amount  = 0;
+   };
+
+   template<typename Row>
+   using balance_index = multi_index_container<
+      Row,
+      indexed_by<
+         ordered_unique< member<Row,typename Row::id_type,&Row::id> >,
+         ordered_non_unique< tag<by_owner>, member<Row,uint64_t,&Row::owner> >,
+         ordered_non_unique< tag<by_symbol>, member<Row,uint64_t,&Row::symbol> >,
+         ordered_non_unique< tag<by_expiry>, member<Row,int64_t,&Row::expiry> >
+      >,
+      chainbase::allocator<Row>
+   >;
+
+   /**
+    *  levels nested sessions each modifying changes random objects, one in ten of them moving it
+    *  to another owner, then all of them undone at once
+    */
+   template<typename Row>
+   void unwind( const bench::options& o, const char* name, uint32_t levels )
+   {
+      typedef balance_index<Row> index_type;
+
+      const uint64_t count   = std::max<uint64_t>( o.scale, 1000 );
+      const uint64_t changes = std::max<uint64_t>( count / 100, 1 );
+      bench::scratch_database s( o, 64 + ( count + levels * changes ) * 512 / ( 1024 * 1024 ) );
+      auto& db = s.db;
+      db.add_index< index_type >();
+      auto& idx = db.get_mutable_index< index_type >();
+
+      std::mt19937_64 rng( o.seed );
+      for( uint64_t i = 0; i < count; ++i )
+         idx.emplace( [&]( Row& r ) {
+            r.owner  = rng() % 10000;
+            r.symbol = rng() % 500;
+            r.expiry = int64_t( rng() % 1000000 );
+         });
+
+      for( uint32_t l = 0; l < levels; ++l ) {
+         auto session = db.start_undo_session( true );
+         for( uint64_t c = 0; c < changes; ++c ) {
+            const auto& r = idx.get( typename Row::id_type( int64_t( rng() % count ) ) );
+            const bool move = rng() % 10 == 0;
+            idx.modify( r, [&]( Row& m ) {
+               m.amount += 1;
+               if( move ) m.owner = rng() % 10000;
+            });
+         }
+         session.push();
+      }
+
+      const uint64_t restores_before = idx.counters().in_place_restores;
+      int64_t start = bench::now_ns();
+      db.undo_all();
+      const int64_t elapsed = bench::now_ns() - start;
+
+      bench::print_rate( std::string( name ) + ", modifications undone", levels * changes, elapsed );
+      printf( "  %-44s %llu levels in %.2f ms, %llu restored in place\n", name, (unsigned long long)levels, double( elapsed ) / 1e6,
+              (unsigned long long)( idx.counters().in_place_restores - restores_before ) );
+   }
+
+   void fork_unwind( const bench::options& o )
+   {
+      for( uint32_t levels : { 8, 64 } ) {
+         unwind<balance_row>( o, "trivially copyable", levels );
+         unwind<tracked_balance_row>( o, "not trivially copyable", levels );
+      }
+   }
+
+   /** levels of changes kept with the undo levels below pack_depth packed, then undone or committed */
+   void packed_levels( const bench::options& o, uint32_t pack_depth, bool undo )
+   {
+      typedef balance_index<balance_row> index_type;
+
+      const uint64_t count   = std::max<uint64_t>( o.scale, 1000 );
+      const uint64_t changes = std::max<uint64_t>( count / 100, 1 );
+      const uint32_t levels  = 64;
+      bench::scratch_database s( o, 64 + ( count + levels * changes ) * 512 / ( 1024 * 1024 ) );
+      auto& db = s.db;
+      db.add_index< index_type >();
+      auto& idx = db.get_mutable_index< index_type >();
+      idx.set_undo_pack_depth( pack_depth );
+
+      std::mt19937_64 rng( o.seed );
+      for( uint64_t i = 0; i < count; ++i )
+         idx.emplace( [&]( balance_row& r ) { r.owner = rng() % 10000; r.symbol = rng() % 500; } );
+
+      const auto free_before = db.get_free_memory();
+      int64_t start = bench::now_ns();
+      for( uint32_t l = 0; l < levels; ++l ) {
+         auto session = db.start_undo_session( true );
+         for( uint64_t c = 0; c < changes; ++c )
+            idx.modify( idx.get( balance_row::id_type( int64_t( rng() % count ) ) ), [&]( balance_row& m ) { m.amount += int64_t( c ); } );
+         session.push();
+      }
+      const int64_t elapsed = bench::now_ns() - start;
+      const auto held = free_before - db.get_free_memory();
+
+      const std::string name = pack_depth ? "pack depth " + std::to_string( pack_depth ) : std::string( "unpacked" );
+      bench::print_rate( name + ", modifications", levels * changes, elapsed );
+
+      start = bench::now_ns();
+      if( undo ) db.undo_all();
+      else       db.commit( db.revision() );
+      printf( "  %-44s %llu KiB held by %u levels, %s in %.1f ms\n", name.c_str(), (unsigned long long)( held >> 10 ), levels,
+              undo ? "undone" : "committed", double( bench::now_ns() - start ) / 1e6 );
+   }
+
+   void packed_undo( const bench::options& o )
+   {
+      for( bool undo : { true, false } )
+         for( uint32_t depth : { 0, 2 } )
+            packed_levels( o, depth, undo );
+   }
+
+   bench::registrar undo( "fork_unwind", "undo of many levels of modifications, in place restore against modify()", fork_unwind );
+   bench::registrar packing( "packed_undo", "memory and unwind time of 64 undo levels, packed below depth 2 or not", packed_undo );
+
+} // namespace
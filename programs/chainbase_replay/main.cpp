@@ -0,0 +1,348 @@
+/**
+ *  Replays a trace recorded with database::start_trace() against a fresh database and reports the
+ *  latency of each kind of operation.
+ *
+ *  The trace holds the type, id and size of the objects that were touched but not their content
+ *  or types, so every table of the traced database is replayed as a single table of objects with
+ *  a payload of the recorded size, keyed by (type_id, id).  Objects that the trace uses without
+ *  creating them existed before tracing started; they are created up front, outside of the
+ *  measurement.
+ *
+ *    chainbase_replay <trace> [--dir <path>] [--size <MiB>] [--perf] [--keep]
+ *
+ *  Without --dir the database is made in a new temporary directory that is removed at the end
+ *  unless --keep is given.  A directory passed with --dir must be new or empty and is never removed.
+ */
+#include <chainbase/chainbase.hpp>
+
+#include <boost/multi_index_container.hpp>
+#include <boost/multi_index/composite_key.hpp>
+#include <boost/multi_index/member.hpp>
+#include <boost/multi_index/ordered_index.hpp>
+
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <set>
+#include <string>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace chainbase;
+using namespace boost::multi_index;
+
+struct replay_object : public chainbase::object<0, replay_object> {
+
+   template<typename Constructor, typename Allocator>
+   replay_object( Constructor&& c, Allocator&& a ) : payload( a ) {
+      c(*this);
+   }
+
+   id_type                                  id;
+   uint16_t                                 table = 0;
+   int64_t                                  key = 0;
+   bip::vector< char, allocator< char > >   payload;
+};
+
+struct by_key;
+
+typedef multi_index_container<
+  replay_object,
+  indexed_by<
+     ordered_unique< member<replay_object,replay_object::id_type,&replay_object::id> >,
+     ordered_unique< tag<by_key>,
+        composite_key< replay_object, member<replay_object,uint16_t,&replay_object::table>, member<replay_object,int64_t,&replay_object::key> >
+     >
+  >,
+  chainbase::allocator<replay_object>
+> replay_index;
+
+CHAINBASE_SET_INDEX_TYPE( replay_object, replay_index )
+
+namespace {
+
+   const char* op_names[] = { "", "start_session", "session_push", "session_squash", "session_undo", "undo", "squash",
+                              "squash_to", "commit", "create", "modify", "remove", "find", "get" };
+   const size_t op_count  = sizeof(op_names) / sizeof(op_names[0]);
+
+   /**
+    *  Latencies in buckets of a quarter of a power of two, percentiles are reported as the upper
+    *  bound of their bucket and so are at most 25% high
+    */
+   struct histogram
+   {
+      static const uint32_t bucket_count = 256;
+
+      uint64_t buckets[bucket_count] = {};
+      uint64_t count = 0;
+      uint64_t total_ns = 0;
+      uint64_t max_ns = 0;
+
+      static uint32_t bucket( uint64_t ns )
+      {
+         if( ns < 4 ) return uint32_t( ns );
+         const uint32_t e = 63 - __builtin_clzll( ns );
+         return 4 * ( e - 1 ) + uint32_t( ( ns >> ( e - 2 ) ) & 3 );
+      }
+
+      static uint64_t upper_bound( uint32_t b )
+      {
+         if( b < 4 ) return b;
+         const uint32_t e = b / 4 + 1;
+         return ( ( uint64_t( 4 + b % 4 ) + 1 ) << ( e - 2 ) ) - 1;
+      }
+
+      void record( uint64_t ns )
+      {
+         ++buckets[ bucket( ns ) ];
+         ++count;
+         total_ns += ns;
+         if( ns > max_ns ) max_ns = ns;
+      }
+
+      uint64_t percentile( double p )const
+      {
+         const uint64_t rank = uint64_t( p * double( count - 1 ) );
+         uint64_t seen = 0;
+         for( uint32_t b = 0; b < bucket_count; ++b ) {
+            seen += buckets[b];
+            if( seen > rank ) return std::min( max_ns, upper_bound( b ) );
+         }
+         return max_ns;
+      }
+   };
+
+#ifdef __linux__
+   /** cycles and cache misses of this thread, counted as one group */
+   class perf_counters
+   {
+      public:
+         perf_counters()
+         {
+            _cycles = open( PERF_COUNT_HW_CPU_CYCLES, -1 );
+            if( _cycles >= 0 ) _misses = open( PERF_COUNT_HW_CACHE_MISSES, _cycles );
+         }
+
+         ~perf_counters()
+         {
+            if( _misses >= 0 ) ::close( _misses );
+            if( _cycles >= 0 ) ::close( _cycles );
+         }
+
+         bool available()const { return _cycles >= 0 && _misses >= 0; }
+
+         void start()
+         {
+            ioctl( _cycles, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP );
+            ioctl( _cycles, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+         }
+
+         void stop( uint64_t& cycles, uint64_t& misses )
+         {
+            ioctl( _cycles, PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP );
+            uint64_t values[3] = {};
+            if( ::read( _cycles, values, sizeof(values) ) != sizeof(values) ) values[1] = values[2] = 0;
+            cycles = values[1];
+            misses = values[2];
+         }
+
+      private:
+         static int open( uint64_t config, int group )
+         {
+            perf_event_attr attr;
+            memset( &attr, 0, sizeof(attr) );
+            attr.size           = sizeof(attr);
+            attr.type           = PERF_TYPE_HARDWARE;
+            attr.config         = config;
+            attr.disabled       = group < 0;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+            attr.read_format    = PERF_FORMAT_GROUP;
+            return int( syscall( __NR_perf_event_open, &attr, 0, -1, group, 0 ) );
+         }
+
+         int _cycles = -1;
+         int _misses = -1;
+   };
+#endif
+
+   struct replayer
+   {
+      database&                    db;
+      std::deque<database::session> sessions;
+      histogram                    latency[ op_count ];
+      uint64_t                     unmatched = 0;
+
+      explicit replayer( database& d ):db( d ){}
+
+      const replay_object* lookup( uint16_t table, int64_t key )
+      {
+         return db.find< replay_object, by_key >( boost::make_tuple( table, key ) );
+      }
+
+      void create( uint16_t table, int64_t key, int64_t size )
+      {
+         db.create< replay_object >( [&]( replay_object& o ) {
+            o.table = table;
+            o.key   = key;
+            o.payload.resize( size_t( std::max<int64_t>( size, 1 ) ) );
+         });
+      }
+
+      void apply( const trace_record& r )
+      {
+         const replay_object* obj = nullptr;
+         if( r.op == trace_op::modify || r.op == trace_op::remove ) {
+            obj = lookup( r.type_id, r.id );
+            if( !obj ) { ++unmatched; return; }
+         }
+         if( ( r.op == trace_op::create && lookup( r.type_id, r.id ) ) ||
+             ( r.op >= trace_op::session_push && r.op <= trace_op::session_undo && sessions.empty() ) ) {
+            ++unmatched;
+            return;
+         }
+
+         const int64_t start = chainbase::detail::steady_now_ns();
+         switch( r.op ) {
+            case trace_op::start_session:  sessions.emplace_back( db.start_undo_session( r.value != 0 ) ); break;
+            case trace_op::session_push:   sessions.back().push(); break;
+            case trace_op::session_squash: sessions.back().squash(); break;
+            case trace_op::session_undo:   sessions.back().undo(); break;
+            case trace_op::undo:           db.undo(); break;
+            case trace_op::squash:         db.squash(); break;
+            case trace_op::squash_to:      db.squash_to( db.revision() - r.value ); break;
+            case trace_op::commit:         db.commit( db.revision() - r.value ); break;
+            case trace_op::create:         create( r.type_id, r.id, r.value ); break;
+            case trace_op::modify:
+               db.modify( *obj, [&]( replay_object& o ) {
+                  o.payload.resize( size_t( std::max<int64_t>( r.value, 1 ) ) );
+                  ++o.payload.front();
+                  ++o.payload.back();
+               });
+               break;
+            case trace_op::remove:         db.remove( *obj ); break;
+            case trace_op::find:
+            case trace_op::get:            lookup( r.type_id, r.id ); break;
+         }
+         latency[ size_t( r.op ) ].record( uint64_t( chainbase::detail::steady_now_ns() - start ) );
+
+         if( r.op >= trace_op::session_push && r.op <= trace_op::session_undo )
+            sessions.pop_back();
+      }
+   };
+
+   /** objects the trace uses before it creates them (if it ever does) */
+   std::set<std::pair<uint16_t, int64_t>> preexisting_objects( trace_reader& trace )
+   {
+      std::set<std::pair<uint16_t, int64_t>> created, result;
+      trace_record r;
+      while( trace.next( r ) ) {
+         if( !r.has_object() || r.id < 0 ) continue;
+         const auto key = std::make_pair( r.type_id, r.id );
+         if( r.op == trace_op::create ) created.insert( key );
+         else if( !created.count( key ) ) result.insert( key );
+      }
+      trace.reset();
+      return result;
+   }
+
+   void usage()
+   {
+      std::cerr << "usage: chainbase_replay <trace> [--dir <path>] [--size <MiB>] [--perf] [--keep]\n";
+   }
+
+} // namespace
+
+int main( int argc, char** argv )
+{
+   bfs::path trace_file, dir;
+   uint64_t  size_mb = 1024;
+   bool      perf = false, keep = false;
+
+   for( int i = 1; i < argc; ++i ) {
+      const std::string arg = argv[i];
+      if( arg == "--dir" && i + 1 < argc )       dir = argv[++i];
+      else if( arg == "--size" && i + 1 < argc ) size_mb = std::stoull( argv[++i] );
+      else if( arg == "--perf" )                 perf = true;
+      else if( arg == "--keep" )                 keep = true;
+      else if( trace_file.empty() && arg[0] != '-' ) trace_file = arg;
+      else { usage(); return 1; }
+   }
+   if( trace_file.empty() ) { usage(); return 1; }
+
+   // only a directory the tool made up itself is removed afterwards, never one passed with --dir
+   bool owned = false;
+   if( dir.empty() ) {
+      dir   = bfs::temp_directory_path() / bfs::unique_path();
+      owned = !keep;
+   } else if( bfs::exists( dir ) && !bfs::is_empty( dir ) ) {
+      std::cerr << dir.generic_string() << " is not empty, --dir must name a new or empty directory\n";
+      return 1;
+   }
+
+   try {
+      trace_reader trace( trace_file );
+
+      database db;
+      db.open( dir, database::read_write, size_mb * 1024 * 1024 );
+      db.add_index< replay_index >();
+
+      replayer replay( db );
+      for( const auto& key : preexisting_objects( trace ) )
+         replay.create( key.first, key.second, 64 );
+
+      uint64_t records = 0, cycles = 0, misses = 0;
+#ifdef __linux__
+      perf_counters counters;
+      if( perf && !counters.available() ) {
+         std::cerr << "perf counters are not available, see /proc/sys/kernel/perf_event_paranoid\n";
+         perf = false;
+      }
+      if( perf ) counters.start();
+#else
+      if( perf ) std::cerr << "perf counters are only supported on Linux\n";
+      perf = false;
+#endif
+      const int64_t start = chainbase::detail::steady_now_ns();
+      trace_record r;
+      while( trace.next( r ) ) {
+         replay.apply( r );
+         ++records;
+      }
+      const int64_t elapsed = chainbase::detail::steady_now_ns() - start;
+#ifdef __linux__
+      if( perf ) counters.stop( cycles, misses );
+#endif
+      replay.sessions.clear();
+
+      printf( "%llu records in %.3f s, %llu did not match the replayed state\n\n",
+              (unsigned long long)records, double( elapsed ) / 1e9, (unsigned long long)replay.unmatched );
+      printf( "%-15s %12s %10s %10s %10s %10s %12s\n", "operation", "count", "mean ns", "p50 ns", "p99 ns", "p99.9 ns", "max ns" );
+      for( size_t op = 1; op < op_count; ++op ) {
+         const histogram& h = replay.latency[op];
+         if( !h.count ) continue;
+         printf( "%-15s %12llu %10llu %10llu %10llu %10llu %12llu\n", op_names[op], (unsigned long long)h.count,
+                 (unsigned long long)( h.total_ns / h.count ), (unsigned long long)h.percentile( 0.5 ),
+                 (unsigned long long)h.percentile( 0.99 ), (unsigned long long)h.percentile( 0.999 ),
+                 (unsigned long long)h.max_ns );
+      }
+      if( perf && records ) {
+         printf( "\n%llu cycles (%.1f per record), %llu cache misses (%.2f per record)\n",
+                 (unsigned long long)cycles, double( cycles ) / double( records ),
+                 (unsigned long long)misses, double( misses ) / double( records ) );
+      }
+   } catch( const std::exception& e ) {
+      std::cerr << e.what() << "\n";
+      if( owned ) bfs::remove_all( dir );
+      return 1;
+   }
+
+   if( owned ) bfs::remove_all( dir );
+   return 0;
+}
@@ -1,8 +1,19 @@
 #include <chainbase/chainbase.hpp>
 #include <boost/array.hpp>
 
+#include <cstddef>
 #include <iostream>
 
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#ifdef __linux__
+   #include <linux/fs.h>
+#endif
+
 namespace chainbase {
 
    struct environment_check {
@@ -30,6 +41,305 @@ namespace chainbase {
       bool                    windows = false;
    };
 
+   namespace detail {
+      /**
+       *  The regions of one segment file written since its checksums were taken.  Regions that are
+       *  not marked are mapped read only, the fault of the first write to one marks it.
+       */
+      struct write_tracker
+      {
+         write_tracker( const bfs::path& f, bip::managed_mapped_file& segment, uint64_t region_size );
+         ~write_tracker();
+
+         write_tracker( const write_tracker& ) = delete;
+         write_tracker& operator=( const write_tracker& ) = delete;
+
+         size_t region_length( uint64_t r )const { return size_t( std::min( region_size, size - r * region_size ) ); }
+
+         /** maps region r read only unless it is marked */
+         void protect( uint64_t r );
+
+         bfs::path         file;
+         char*             base;
+         uint64_t          size;
+         uint64_t          region_size;
+         uint64_t          regions;
+         vector<uint64_t>  sums;              ///< as of the last flush
+         char*             dirty = nullptr;   ///< one byte per region, mapped from the .dirty file
+         size_t            dirty_size = 0;
+      };
+   }
+
+   namespace {
+      /** writes back the dirty pages of segment and waits for the write */
+      void sync_segment( bip::managed_mapped_file& segment )
+      {
+         msync( segment.get_address(), segment.get_size(), MS_SYNC );
+      }
+
+      struct scoped_fd
+      {
+         explicit scoped_fd( int f ):fd( f ){}
+         ~scoped_fd() { if( fd >= 0 ) ::close( fd ); }
+         int fd;
+      };
+
+      /**
+       *  Makes dst a copy of src, sharing its extents if the file system supports it.
+       *
+       *  @return true if the file was cloned, false if it was copied
+       */
+      bool clone_file( const bfs::path& src, const bfs::path& dst, bool allow_copy )
+      {
+         scoped_fd in( ::open( src.generic_string().c_str(), O_RDONLY ) );
+         if( in.fd < 0 ) BOOST_THROW_EXCEPTION( std::runtime_error( "unable to open " + src.generic_string() ) );
+         scoped_fd out( ::open( dst.generic_string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ) );
+         if( out.fd < 0 ) BOOST_THROW_EXCEPTION( std::runtime_error( "unable to create " + dst.generic_string() ) );
+
+#ifdef FICLONE
+         if( ioctl( out.fd, FICLONE, in.fd ) == 0 ) return true;
+#endif
+         if( !allow_copy )
+            BOOST_THROW_EXCEPTION( std::runtime_error( "the file system cannot clone " + src.generic_string() ) );
+
+         vector<char> buffer( 1 << 20 );
+         for( ;; ) {
+            auto n = ::read( in.fd, buffer.data(), buffer.size() );
+            if( n < 0 && errno == EINTR ) continue;
+            if( n < 0 ) BOOST_THROW_EXCEPTION( std::runtime_error( "unable to read " + src.generic_string() ) );
+            if( n == 0 ) break;
+            for( ssize_t done = 0; done < n; ) {
+               auto w = ::write( out.fd, buffer.data() + done, size_t( n - done ) );
+               if( w < 0 && errno == EINTR ) continue;
+               if( w <= 0 ) BOOST_THROW_EXCEPTION( std::runtime_error( "unable to write " + dst.generic_string() ) );
+               done += w;
+            }
+         }
+         return false;
+      }
+
+      /** header of the .sums file kept next to each segment file by database::enable_checksums() */
+      struct checksum_header
+      {
+         char     magic[8] = { 'C', 'B', 'S', 'U', 'M', 'S', 0, 0 };
+         uint32_t version = 1;
+         uint32_t clean = 0;        ///< the database was closed after the checksums were taken
+         uint64_t region_size = 0;
+         uint64_t file_size = 0;
+         uint64_t regions = 0;
+      };
+
+      bfs::path checksum_path( const bfs::path& segment_file )
+      {
+         return bfs::path( segment_file ).replace_extension( ".sums" );
+      }
+
+      /** four independent lanes so that the multiplies of neighbouring words overlap */
+      uint64_t region_checksum( const char* data, size_t size )
+      {
+         static const uint64_t p1 = 0x9e3779b185ebca87ull, p2 = 0xc2b2ae3d27d4eb4full;
+         uint64_t h[4] = { 0x243f6a8885a308d3ull, 0x13198a2e03707344ull, 0xa4093822299f31d0ull, 0x082efa98ec4e6c89ull };
+
+         auto round = [&]( const char* p ) {
+            for( uint32_t l = 0; l < 4; ++l ) {
+               uint64_t w;
+               memcpy( &w, p + 8 * l, 8 );
+               h[l] += w * p2;
+               h[l]  = ( h[l] << 31 | h[l] >> 33 ) * p1;
+            }
+         };
+
+         size_t i = 0;
+         for( ; i + 32 <= size; i += 32 )
+            round( data + i );
+         char tail[32] = {};
+         memcpy( tail, data + i, size - i );
+         round( tail );
+
+         uint64_t result = size;
+         for( uint32_t l = 0; l < 4; ++l ) {
+            result ^= h[l];
+            result  = ( result << 27 | result >> 37 ) * p1 + p2;
+         }
+         result ^= result >> 33;
+         result *= p2;
+         result ^= result >> 29;
+         return result;
+      }
+
+      /** computes sums[r] for every r in regions, using as many threads as there are cores */
+      void checksum_regions( const detail::write_tracker& t, const vector<uint64_t>& regions, vector<uint64_t>& sums )
+      {
+         const uint32_t parts = uint32_t( std::max<uint64_t>( 1, std::min<uint64_t>( std::thread::hardware_concurrency(), regions.size() ) ) );
+         detail::run_parallel( parts, [&]( uint32_t p ) {
+            for( size_t i = regions.size() * p / parts; i < regions.size() * ( p + 1 ) / parts; ++i )
+               sums[ regions[i] ] = region_checksum( t.base + regions[i] * t.region_size, t.region_length( regions[i] ) );
+         });
+      }
+
+      bool read_checksums( const bfs::path& file, checksum_header& header, vector<uint64_t>& sums )
+      {
+         std::ifstream in( file.generic_string(), std::ios::binary );
+         if( !in ) return false;
+         checksum_header expected;
+         in.read( reinterpret_cast<char*>( &header ), sizeof(header) );
+         if( !in || memcmp( header.magic, expected.magic, sizeof(header.magic) ) || header.version != expected.version || !header.region_size )
+            BOOST_THROW_EXCEPTION( std::runtime_error( file.generic_string() + " is not a checksum file" ) );
+         sums.resize( header.regions );
+         in.read( reinterpret_cast<char*>( sums.data() ), std::streamsize( sums.size() * sizeof(uint64_t) ) );
+         if( !in ) BOOST_THROW_EXCEPTION( std::runtime_error( file.generic_string() + " is truncated" ) );
+         return true;
+      }
+
+      /** replaces file so that a crash leaves either the old or the new checksums */
+      void write_checksum_file( const bfs::path& file, const checksum_header& header, const vector<uint64_t>& sums )
+      {
+         const auto tmp = bfs::path( file.generic_string() + ".tmp" );
+         {
+            scoped_fd out( ::open( tmp.generic_string().c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 ) );
+            if( out.fd < 0 ) BOOST_THROW_EXCEPTION( std::runtime_error( "unable to create " + tmp.generic_string() ) );
+            const size_t sums_size = sums.size() * sizeof(uint64_t);
+            if( ::write( out.fd, &header, sizeof(header) ) != ssize_t( sizeof(header) ) ||
+                ( sums_size && ::write( out.fd, sums.data(), sums_size ) != ssize_t( sums_size ) ) ||
+                fdatasync( out.fd ) )
+               BOOST_THROW_EXCEPTION( std::runtime_error( "unable to write " + tmp.generic_string() ) );
+         }
+         bfs::rename( tmp, file );
+      }
+
+      /** clears the clean flag of file in place */
+      void mark_checksums_open( const bfs::path& file )
+      {
+         scoped_fd out( ::open( file.generic_string().c_str(), O_WRONLY ) );
+         const uint32_t clean = 0;
+         if( out.fd < 0 || pwrite( out.fd, &clean, sizeof(clean), offsetof( checksum_header, clean ) ) != ssize_t( sizeof(clean) ) || fdatasync( out.fd ) )
+            BOOST_THROW_EXCEPTION( std::runtime_error( "unable to update " + file.generic_string() ) );
+      }
+
+      bfs::path dirty_path( const bfs::path& segment_file )
+      {
+         return bfs::path( segment_file ).replace_extension( ".dirty" );
+      }
+
+      uint64_t page_size()
+      {
+         static const uint64_t size = uint64_t( sysconf( _SC_PAGESIZE ) );
+         return size;
+      }
+
+      /**
+       *  The trackers of every database of the process for the fault handler, which cannot take a
+       *  lock.  Slots are claimed and released under write_trackers_mutex.
+       */
+      const size_t                           max_write_trackers = 256;
+      std::atomic<detail::write_tracker*>    write_trackers[ max_write_trackers ];
+      std::mutex                             write_trackers_mutex;
+      struct sigaction                       previous_segv_action;
+
+      void on_segment_fault( int sig, siginfo_t* info, void* context )
+      {
+         char* addr = static_cast<char*>( info->si_addr );
+         if( info->si_code == SEGV_ACCERR ) {
+            for( auto& slot : write_trackers ) {
+               detail::write_tracker* t = slot.load( std::memory_order_acquire );
+               if( !t || addr < t->base || addr >= t->base + t->size ) continue;
+
+               // the mark reaches the disk before the write can
+               const uint64_t r = uint64_t( addr - t->base ) / t->region_size;
+               t->dirty[r] = 1;
+               msync( t->dirty + ( r & ~( page_size() - 1 ) ), 1, MS_SYNC );
+               if( mprotect( t->base + r * t->region_size, t->region_length( r ), PROT_READ | PROT_WRITE ) == 0 ) return;
+               break;
+            }
+         }
+
+         if( previous_segv_action.sa_flags & SA_SIGINFO ) {
+            previous_segv_action.sa_sigaction( sig, info, context );
+         } else if( previous_segv_action.sa_handler != SIG_DFL && previous_segv_action.sa_handler != SIG_IGN ) {
+            previous_segv_action.sa_handler( sig );
+         } else {
+            // the access faults again on return and takes the default action
+            signal( SIGSEGV, SIG_DFL );
+         }
+      }
+
+      void register_write_tracker( detail::write_tracker* t )
+      {
+         std::lock_guard<std::mutex> guard( write_trackers_mutex );
+         // (re)installed whenever a handler set since has replaced it
+         struct sigaction current;
+         if( sigaction( SIGSEGV, nullptr, &current ) == 0 &&
+             !( ( current.sa_flags & SA_SIGINFO ) && current.sa_sigaction == on_segment_fault ) ) {
+            page_size();
+            struct sigaction action;
+            memset( &action, 0, sizeof(action) );
+            action.sa_sigaction = on_segment_fault;
+            action.sa_flags     = SA_SIGINFO | SA_NODEFER;
+            sigemptyset( &action.sa_mask );
+            if( sigaction( SIGSEGV, &action, &previous_segv_action ) )
+               BOOST_THROW_EXCEPTION( std::runtime_error( "unable to install the SIGSEGV handler that tracks segment writes" ) );
+         }
+         for( auto& slot : write_trackers ) {
+            if( slot.load( std::memory_order_relaxed ) ) continue;
+            slot.store( t, std::memory_order_release );
+            return;
+         }
+         BOOST_THROW_EXCEPTION( std::runtime_error( "too many segment files with checksums" ) );
+      }
+
+      void unregister_write_tracker( detail::write_tracker* t )
+      {
+         std::lock_guard<std::mutex> guard( write_trackers_mutex );
+         for( auto& slot : write_trackers )
+            if( slot.load( std::memory_order_relaxed ) == t ) slot.store( nullptr, std::memory_order_release );
+      }
+   }
+
+   namespace detail {
+      /** maps the .dirty file of f, with every region marked; the caller protects the regions it knows are unchanged */
+      write_tracker::write_tracker( const bfs::path& f, bip::managed_mapped_file& segment, uint64_t rs )
+      :file( f ),
+       base( static_cast<char*>( segment.get_address() ) ),
+       size( segment.get_size() ),
+       region_size( rs ),
+       regions( ( size + rs - 1 ) / rs ),
+       sums( regions )
+      {
+         if( region_size % page_size() )
+            BOOST_THROW_EXCEPTION( std::logic_error( "checksum regions must be a multiple of the page size" ) );
+
+         const auto path = dirty_path( file );
+         scoped_fd fd( ::open( path.generic_string().c_str(), O_RDWR | O_CREAT, 0644 ) );
+         dirty_size = size_t( ( regions + page_size() - 1 ) & ~( page_size() - 1 ) );
+         if( fd.fd < 0 || ftruncate( fd.fd, off_t( dirty_size ) ) )
+            BOOST_THROW_EXCEPTION( std::runtime_error( "unable to create " + path.generic_string() ) );
+         void* map = mmap( nullptr, dirty_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd.fd, 0 );
+         if( map == MAP_FAILED )
+            BOOST_THROW_EXCEPTION( std::runtime_error( "unable to map " + path.generic_string() ) );
+         dirty = static_cast<char*>( map );
+         memset( dirty, 1, regions );
+         if( msync( dirty, dirty_size, MS_SYNC ) ) {
+            munmap( dirty, dirty_size );
+            BOOST_THROW_EXCEPTION( std::runtime_error( "unable to write " + path.generic_string() ) );
+         }
+         register_write_tracker( this );
+      }
+
+      write_tracker::~write_tracker()
+      {
+         unregister_write_tracker( this );
+         mprotect( base, size, PROT_READ | PROT_WRITE );
+         munmap( dirty, dirty_size );
+      }
+
+      void write_tracker::protect( uint64_t r )
+      {
+         if( dirty[r] ) return;
+         if( mprotect( base + r * region_size, region_length( r ), PROT_READ ) )
+            BOOST_THROW_EXCEPTION( std::runtime_error( "unable to protect a region of " + file.generic_string() ) );
+      }
+   }
+
    void database::open( const bfs::path& dir, uint32_t flags, uint64_t shared_file_size ) {
 
       bool write = flags & database::read_write;
@@ -70,13 +380,15 @@ namespace chainbase {
             BOOST_THROW_EXCEPTION( std::runtime_error( "database created by a different compiler, build, or operating system" ) );
          }
       } else {
+         bfs::remove( checksum_path( abs_path ) );
+         bfs::remove( dirty_path( abs_path ) );
          _segment.reset( new bip::managed_mapped_file( bip::create_only,
                                                        abs_path.generic_string().c_str(), shared_file_size
                                                        ) );
          _segment->find_or_construct< environment_check >( "environment" )();
       }
 
-
+      release_lock_slot();
       abs_path = bfs::absolute( dir / "shared_memory.meta" );
 
       if( bfs::exists( abs_path ) )
@@ -87,6 +399,7 @@ namespace chainbase {
          _rw_manager = _meta->find< read_write_mutex_manager >( "rw_manager" ).first;
          if( !_rw_manager )
             BOOST_THROW_EXCEPTION( std::runtime_error( "could not find read write lock manager" ) );
+         _rw_manager->validate();
       }
       else
       {
@@ -97,14 +410,36 @@ namespace chainbase {
          _rw_manager = _meta->find_or_construct< read_write_mutex_manager >( "rw_manager" )();
       }
 
+      _lock_slot = _rw_manager->current_lock().register_owner();
+
       if( write )
       {
          _flock = bip::file_lock( abs_path.generic_string().c_str() );
          if( !_flock.try_lock() )
             BOOST_THROW_EXCEPTION( std::runtime_error( "could not gain write access to the shared memory file" ) );
+
+         // only now is it certain that no other process is writing
+         _integrity = integrity_report();
+         verify_checksums( bfs::absolute( dir / "shared_memory.bin" ), *_segment );
       }
    }
 
+   namespace {
+      void advise_huge_pages( bip::managed_mapped_file& segment )
+      {
+#ifdef MADV_HUGEPAGE
+         madvise( segment.get_address(), segment.get_size(), MADV_HUGEPAGE );
+#endif
+      }
+   }
+
+   database::database() = default;
+
+   database::~database()
+   {
+      close();
+   }
+
    bool database::is_open() const
    {
       return _segment && _meta && !_data_dir.empty();
@@ -113,13 +448,243 @@ namespace chainbase {
    void database::flush() {
       if( _segment )
          _segment->flush();
+      for( auto& segment : _index_segments )
+         if( segment.file ) segment.file->flush();
       if( _meta )
          _meta->flush();
+      if( checksums_enabled() && !_read_only )
+         for( const auto& item : segment_files() )
+            write_checksums( item.first, *item.second, false );
+   }
+
+   vector<std::pair<bfs::path, bip::managed_mapped_file*>> database::segment_files()const
+   {
+      vector<std::pair<bfs::path, bip::managed_mapped_file*>> result;
+      if( _segment )
+         result.emplace_back( bfs::absolute( _data_dir / "shared_memory.bin" ), _segment.get() );
+      for( uint16_t type_id = 0; type_id < _index_segments.size(); ++type_id )
+         if( _index_segments[ type_id ].file )
+            result.emplace_back( bfs::absolute( index_segment_path( type_id ) ), _index_segments[ type_id ].file.get() );
+      return result;
+   }
+
+   void database::enable_checksums( uint64_t region_size )
+   {
+      if( _read_only )
+         BOOST_THROW_EXCEPTION( std::logic_error( "cannot enable checksums of a read only database" ) );
+      if( !region_size || region_size % page_size() )
+         BOOST_THROW_EXCEPTION( std::logic_error( "checksum regions must be a nonzero multiple of the page size" ) );
+      if( region_size != _checksum_region_size )
+         _write_trackers.clear();
+      _checksum_region_size = region_size;
+      flush();
+   }
+
+   void database::verify_checksums( const bfs::path& file, bip::managed_mapped_file& segment )
+   {
+      checksum_header  header;
+      vector<uint64_t> expected;
+      const auto path = checksum_path( file );
+      if( !read_checksums( path, header, expected ) ) return;
+      _checksum_region_size = header.region_size;
+
+      forget_writes( file );
+      unique_ptr<detail::write_tracker> tracker;
+      vector<char> marks;
+      {
+         // the marks of the last run, before the tracker sets them all
+         std::ifstream in( dirty_path( file ).generic_string(), std::ios::binary );
+         if( in ) marks.assign( std::istreambuf_iterator<char>( in ), std::istreambuf_iterator<char>() );
+      }
+      tracker.reset( new detail::write_tracker( file, segment, header.region_size ) );
+      auto& t = *tracker;
+
+      // regions that were written after the last flush, or all of them if the marks are lost
+      vector<uint64_t> suspect;
+      for( uint64_t r = 0; r < t.regions; ++r ) {
+         // the file may have grown since, the new space was never written and has no checksum yet
+         if( r >= expected.size() && r * header.region_size >= header.file_size ) continue;
+         if( r >= expected.size() || ( !header.clean && ( marks.size() < expected.size() || marks[r] ) ) )
+            suspect.push_back( r );
+      }
+
+      if( !header.clean ) {
+         const int64_t start = detail::steady_now_ns();
+         vector<uint64_t> actual( t.regions );
+         checksum_regions( t, suspect, actual );
+         _integrity.verified   = true;
+         _integrity.verify_ns += uint64_t( detail::steady_now_ns() - start );
+         _integrity.regions   += suspect.size();
+         for( auto r : suspect ) {
+            _integrity.bytes += t.region_length( r );
+            if( r < expected.size() && actual[r] == expected[r] ) continue;
+            changed_region region;
+            region.file   = file;
+            region.offset = r * header.region_size;
+            region.size   = t.region_length( r );
+            _integrity.changed.push_back( region );
+         }
+      }
+
+      // suspect and new regions stay marked, the next flush takes their checksums
+      std::copy( expected.begin(), expected.begin() + std::min<size_t>( expected.size(), t.regions ), t.sums.begin() );
+      memset( t.dirty, 0, t.regions );
+      for( uint64_t r = expected.size(); r < t.regions; ++r ) t.dirty[r] = 1;
+      for( auto r : suspect ) t.dirty[r] = 1;
+      if( msync( t.dirty, t.dirty_size, MS_SYNC ) )
+         BOOST_THROW_EXCEPTION( std::runtime_error( "unable to write " + dirty_path( file ).generic_string() ) );
+      for( uint64_t r = 0; r < t.regions; ++r )
+         t.protect( r );
+
+      mark_checksums_open( path );
+      _write_trackers.push_back( std::move( tracker ) );
+   }
+
+   detail::write_tracker& database::write_tracker_of( const bfs::path& file, bip::managed_mapped_file& segment )
+   {
+      for( auto& t : _write_trackers )
+         if( t->file == file && t->base == segment.get_address() ) return *t;
+      // a segment without checksums yet, every region is read by the first write_checksums()
+      _write_trackers.emplace_back( new detail::write_tracker( file, segment, _checksum_region_size ) );
+      return *_write_trackers.back();
+   }
+
+   void database::forget_writes( const bfs::path& file )
+   {
+      _write_trackers.erase( std::remove_if( _write_trackers.begin(), _write_trackers.end(), [&]( const unique_ptr<detail::write_tracker>& t ) {
+         return t->file == file;
+      }), _write_trackers.end() );
+   }
+
+   void database::write_checksums( const bfs::path& file, bip::managed_mapped_file& segment, bool clean )
+   {
+      auto& t = write_tracker_of( file, segment );
+
+      // a region written while its checksum is taken faults and is marked again
+      vector<uint64_t> written;
+      for( uint64_t r = 0; r < t.regions; ++r ) {
+         if( !t.dirty[r] ) continue;
+         t.dirty[r] = 0;
+         t.protect( r );
+         written.push_back( r );
+      }
+      checksum_regions( t, written, t.sums );
+
+      checksum_header header;
+      header.clean       = clean;
+      header.region_size = t.region_size;
+      header.file_size   = t.size;
+      header.regions     = t.regions;
+      write_checksum_file( checksum_path( file ), header, t.sums );
+      if( msync( t.dirty, t.dirty_size, MS_SYNC ) )
+         BOOST_THROW_EXCEPTION( std::runtime_error( "unable to write " + dirty_path( file ).generic_string() ) );
+   }
+
+   integrity_report database::get_integrity_report()const
+   {
+      integrity_report report = _integrity;
+      for( auto item : _index_list ) {
+         auto segment = own_segment_of( uint16_t( item->type_id() ) );
+         const auto file = segment ? bfs::absolute( index_segment_path( uint16_t( item->type_id() ) ) )
+                                   : bfs::absolute( _data_dir / "shared_memory.bin" );
+         const char* base = static_cast<const char*>( ( segment ? segment : _segment.get() )->get_address() );
+
+         vector<std::pair<const char*, const char*>> ranges;
+         for( const auto& region : report.changed )
+            if( region.file == file ) ranges.emplace_back( base + region.offset, base + region.offset + region.size );
+         if( ranges.empty() ) continue;
+
+         const bool affected = item->any_object( [&]( const void* p ) {
+            for( const auto& range : ranges )
+               if( p >= range.first && p < range.second ) return true;
+            return false;
+         });
+         if( affected ) report.affected_indices.push_back( item->get_statistics().type_name );
+      }
+      return report;
+   }
+
+   void database::release_lock_slot()
+   {
+      if( _rw_manager )
+         _rw_manager->current_lock().unregister_owner( _lock_slot );
+      _rw_manager = nullptr;
+      _lock_slot = read_write_mutex::anonymous_slot;
+   }
+
+   void database::detach_secondary_indices()
+   {
+      for( auto& item : _secondary_list )
+         item->detach();
+      _secondary_list.clear();
+   }
+
+   state_digest database::get_state_digest()const
+   {
+      state_digest result;
+      for( const auto& item : _secondary_list )
+         if( auto hash = dynamic_cast<const abstract_state_hash*>( item.get() ) )
+            result += hash->digest();
+      return result;
+   }
+
+   void database::set_key_filter( uint16_t type_id, const std::type_info& index, const abstract_key_filter* filter )
+   {
+      if( type_id >= _key_filters.size() ) _key_filters.resize( type_id + 1 );
+      auto& filters = _key_filters[ type_id ];
+      filters.erase( std::remove_if( filters.begin(), filters.end(), [&]( const std::pair<std::type_index, const abstract_key_filter*>& item ) {
+         return item.first == std::type_index( index );
+      }), filters.end() );
+      if( filter ) filters.emplace_back( std::type_index( index ), filter );
+   }
+
+   int database::cold_store_file( uint16_t type_id )
+   {
+      if( _cold_store_files.size() <= type_id )
+         _cold_store_files.resize( type_id + 1, -1 );
+      if( _cold_store_files[ type_id ] < 0 ) {
+         auto path = bfs::absolute( _data_dir / ( "cold-" + std::to_string( type_id ) + ".dat" ) );
+         int fd = _read_only ? ::open( path.generic_string().c_str(), O_RDONLY )
+                             : ::open( path.generic_string().c_str(), O_RDWR | O_CREAT, 0644 );
+         if( fd < 0 && !( _read_only && errno == ENOENT ) )
+            BOOST_THROW_EXCEPTION( std::runtime_error( "unable to open " + path.generic_string() ) );
+         _cold_store_files[ type_id ] = fd;
+      }
+      return _cold_store_files[ type_id ];
+   }
+
+   void database::close_cold_store_files()
+   {
+      for( auto fd : _cold_store_files ) {
+         if( fd < 0 ) continue;
+         detail::cold_store_registry::instance().forget( fd );
+         ::close( fd );
+      }
+      _cold_store_files.clear();
    }
 
    void database::close()
    {
+      stop_trace();
+      if( is_open() && checksums_enabled() && !_read_only ) {
+         try {
+            for( const auto& item : segment_files() ) {
+               item.second->flush();
+               write_checksums( item.first, *item.second, true );
+            }
+         } catch( const std::exception& e ) {
+            // the checksums stay marked unclean, the next open checks every region
+            std::cerr << "unable to save checksums: " << e.what() << std::endl;
+         }
+      }
+      _write_trackers.clear();
+      _checksum_region_size = 0;
+      _integrity = integrity_report();
+      detach_secondary_indices();
+      close_cold_store_files();
+      release_lock_slot();
       _segment.reset();
+      _index_segments.clear();
       _meta.reset();
       _index_list.clear();
       _index_map.clear();
@@ -128,10 +693,27 @@ namespace chainbase {
 
    void database::wipe( const bfs::path& dir )
    {
+      _write_trackers.clear();
+      detach_secondary_indices();
+      close_cold_store_files();
+      release_lock_slot();
       _segment.reset();
+      _index_segments.clear();
       _meta.reset();
       bfs::remove_all( dir / "shared_memory.bin" );
       bfs::remove_all( dir / "shared_memory.meta" );
+      bfs::remove_all( dir / "shared_memory.sums" );
+      bfs::remove_all( dir / "shared_memory.dirty" );
+      _checksum_region_size = 0;
+      if( bfs::exists( dir ) ) {
+         for( bfs::directory_iterator itr( dir ), end; itr != end; ++itr ) {
+            const auto name = itr->path().filename().generic_string();
+            if( ( name.compare( 0, 6, "index-" ) == 0 && ( itr->path().extension() == ".bin" || itr->path().extension() == ".sums" ||
+                                                          itr->path().extension() == ".dirty" ) ) ||
+                ( name.compare( 0, 5, "cold-" ) == 0 && itr->path().extension() == ".dat" ) )
+               bfs::remove( itr->path() );
+         }
+      }
       _data_dir = bfs::path();
       _index_list.clear();
       _index_map.clear();
@@ -155,6 +737,7 @@ namespace chainbase {
 
    void database::undo()
    {
+      trace( trace_op::undo );
       for( auto& item : _index_list )
       {
          item->undo();
@@ -163,14 +746,25 @@ namespace chainbase {
 
    void database::squash()
    {
+      trace( trace_op::squash );
       for( auto& item : _index_list )
       {
          item->squash();
       }
    }
 
+   void database::squash_to( int64_t revision )
+   {
+      trace( trace_op::squash_to, 0, -1, this->revision() - revision );
+      for( auto& item : _index_list )
+      {
+         item->squash_to( revision );
+      }
+   }
+
    void database::commit( int64_t revision )
    {
+      trace( trace_op::commit, 0, -1, this->revision() - revision );
       for( auto& item : _index_list )
       {
          item->commit( revision );
@@ -185,18 +779,310 @@ namespace chainbase {
       }
    }
 
+   vector<index_statistics> database::get_statistics()const
+   {
+      vector<index_statistics> result;
+      result.reserve( _index_list.size() );
+      for( const auto& item : _index_list )
+      {
+         result.push_back( item->get_statistics() );
+      }
+      return result;
+   }
+
+   segment_memory_report database::get_memory_report( uint64_t min_block_size, uint32_t max_blocks )
+   {
+      segment_memory_report report;
+      auto sm = _segment->get_segment_manager();
+      report.segment_size   = sm->get_size();
+      report.free_bytes     = sm->get_free_memory();
+      report.min_block_size = std::max<uint64_t>( min_block_size, 1 );
+
+      for( const auto& stats : get_statistics() )
+      {
+         index_memory_usage usage;
+         usage.type_id      = stats.type_id;
+         usage.type_name    = stats.type_name;
+         usage.object_count = stats.object_count;
+         usage.live_bytes   = stats.node_bytes;
+         usage.undo_bytes   = stats.undo_bytes;
+         if( auto segment = own_segment_of( uint16_t( stats.type_id ) ) ) {
+            usage.own_segment        = true;
+            usage.segment_size       = segment->get_size();
+            usage.segment_free_bytes = segment->get_free_memory();
+         }
+         report.indices.push_back( usage );
+      }
+
+      if( _read_only )
+         return report;
+
+      // largest size that can currently be allocated, 0 if not even min_block_size fits
+      auto largest_allocatable = [&]() -> uint64_t {
+         uint64_t lo = 0, hi = sm->get_free_memory();
+         while( lo < hi ) {
+            uint64_t mid = lo + ( hi - lo + 1 ) / 2;
+            void* p = sm->allocate( mid, std::nothrow );
+            if( p ) {
+               sm->deallocate( p );
+               lo = mid;
+            } else {
+               hi = mid - 1;
+            }
+         }
+         return lo >= report.min_block_size ? lo : 0;
+      };
+
+      vector<void*> held;
+      uint64_t enumerated = 0;
+      try {
+         while( held.size() < max_blocks )
+         {
+            auto size = largest_allocatable();
+            if( !size ) break;
+            void* p = sm->allocate( size, std::nothrow );
+            if( !p ) break;
+            held.push_back( p );
+
+            if( !report.largest_free_block ) report.largest_free_block = size;
+            uint32_t bucket = 0;
+            while( ( size >> ( bucket + 1 ) ) != 0 ) ++bucket;
+            if( report.free_block_histogram.size() <= bucket )
+               report.free_block_histogram.resize( bucket + 1 );
+            ++report.free_block_histogram[bucket];
+            enumerated += size;
+         }
+      } catch( ... ) {
+         for( auto p : held ) sm->deallocate( p );
+         throw;
+      }
+
+      for( auto itr = held.rbegin(); itr != held.rend(); ++itr )
+         sm->deallocate( *itr );
+
+      report.small_fragment_bytes = report.free_bytes > enumerated ? report.free_bytes - enumerated : 0;
+      return report;
+   }
+
+   void database::compact()
+   {
+      if( _read_only )
+         BOOST_THROW_EXCEPTION( std::logic_error( "cannot compact a read only database" ) );
+
+      // secondary indices are rebuilt in the new segments rather than copied
+      for( auto& item : _secondary_list )
+         item->detach();
+
+      try {
+         vector<abstract_index*> shared;
+         vector<abstract_index*> own;
+         for( auto item : _index_list )
+            ( own_segment_of( item->type_id() ) ? own : shared ).push_back( item );
+
+         compact_segment( _data_dir / "shared_memory.bin", _segment, shared );
+         for( auto item : own ) {
+            auto& segment = _index_segments[ item->type_id() ];
+            compact_segment( index_segment_path( item->type_id() ), segment.file, { item } );
+            if( segment.options.huge_pages ) advise_huge_pages( *segment.file );
+         }
+      } catch( ... ) {
+         for( auto& item : _secondary_list )
+            item->attach( *this );
+         throw;
+      }
+
+      for( auto& item : _secondary_list )
+         item->attach( *this );
+   }
+
+   void database::compact_segment( const bfs::path& path, unique_ptr<bip::managed_mapped_file>& segment, const vector<abstract_index*>& indices )
+   {
+      auto abs_path     = bfs::absolute( path );
+      auto compact_path = bfs::path( abs_path.generic_string() + ".compact" );
+      bfs::remove( compact_path );
+
+      unique_ptr<bip::managed_mapped_file> fresh( new bip::managed_mapped_file( bip::create_only,
+                                                                                compact_path.generic_string().c_str(),
+                                                                                bfs::file_size( abs_path ) ) );
+      fresh->find_or_construct< environment_check >( "environment" )();
+
+      vector<unique_ptr<abstract_index>> copies;
+      try {
+         for( auto item : indices )
+            copies.emplace_back( item->copy_to( *fresh ) );
+         fresh->flush();
+      } catch( ... ) {
+         copies.clear();
+         fresh.reset();
+         bfs::remove( compact_path );
+         throw;
+      }
+
+      for( auto& copy : copies ) {
+         auto type_id = copy->type_id();
+         std::replace( _index_list.begin(), _index_list.end(), _index_map[ type_id ].get(), copy.get() );
+         _index_map[ type_id ] = std::move( copy );
+      }
+      forget_writes( abs_path );
+      segment = std::move( fresh );
+
+      // the new mapping stays valid across the rename
+      bfs::rename( compact_path, abs_path );
+      if( checksums_enabled() )
+         write_checksums( abs_path, *segment, false );
+   }
+
+   snapshot_result database::snapshot( const bfs::path& dir, const snapshot_options& options )
+   {
+      if( !is_open() ) BOOST_THROW_EXCEPTION( std::logic_error( "database is not open" ) );
+      if( bfs::exists( dir ) && bfs::equivalent( dir, _data_dir ) )
+         BOOST_THROW_EXCEPTION( std::logic_error( "cannot snapshot a database into its own directory" ) );
+      bfs::create_directories( dir );
+
+      snapshot_result result;
+      auto sync_all = [&]() {
+         sync_segment( *_segment );
+         for( auto& segment : _index_segments )
+            if( segment.file ) sync_segment( *segment.file );
+      };
+      const bool checksums = checksums_enabled() && !_read_only;
+
+      /// most dirty pages are written back while writers are still running, leaving little for the pause
+      const auto flush_start = detail::steady_now_ns();
+      if( checksums ) flush();
+      else            sync_all();
+      result.flush_ns = detail::steady_now_ns() - flush_start;
+
+      vector<bfs::path> cloned;
+      try {
+         with_read_lock( [&]() {
+            const auto pause_start = detail::steady_now_ns();
+            sync_all();
+            result.revision = revision();
+
+            vector<bfs::path> files{ _data_dir / "shared_memory.bin" };
+            if( checksums ) {
+               // only the regions written since the flush above are read
+               for( const auto& item : segment_files() )
+                  write_checksums( item.first, *item.second, false );
+               files.push_back( _data_dir / "shared_memory.sums" );
+               files.push_back( _data_dir / "shared_memory.dirty" );
+            }
+            for( bfs::directory_iterator itr( _data_dir ), end; itr != end; ++itr ) {
+               const auto name = itr->path().filename().generic_string();
+               const auto ext  = itr->path().extension();
+               if( ( name.compare( 0, 6, "index-" ) == 0 && ( ext == ".bin" || ( checksums && ( ext == ".sums" || ext == ".dirty" ) ) ) ) ||
+                   ( name.compare( 0, 5, "cold-" ) == 0 && ext == ".dat" ) )
+                  files.push_back( itr->path() );
+            }
+
+            for( const auto& file : files ) {
+               cloned.push_back( dir / file.filename() );
+               if( !clone_file( file, cloned.back(), options.allow_copy ) ) result.cloned = false;
+               result.bytes += bfs::file_size( file );
+               ++result.files;
+            }
+            result.pause_ns = detail::steady_now_ns() - pause_start;
+         }, options.wait_micro );
+      } catch( ... ) {
+         // a partial snapshot is not a database
+         for( const auto& file : cloned )
+            bfs::remove( file );
+         throw;
+      }
+
+      return result;
+   }
+
+   bfs::path database::index_segment_path( uint16_t type_id )const
+   {
+      return _data_dir / ( "index-" + std::to_string( type_id ) + ".bin" );
+   }
+
+   bip::managed_mapped_file* database::own_segment_of( uint16_t type_id )const
+   {
+      return type_id < _index_segments.size() ? _index_segments[ type_id ].file.get() : nullptr;
+   }
+
+   void database::flush_segment_of( uint16_t type_id )
+   {
+      if( auto segment = own_segment_of( type_id ) )
+         segment->flush();
+      else if( _segment )
+         _segment->flush();
+   }
+
+   bip::managed_mapped_file& database::open_index_segment( uint16_t type_id, const segment_options& options )
+   {
+      auto abs_path = bfs::absolute( index_segment_path( type_id ) );
+      unique_ptr<bip::managed_mapped_file> segment;
+
+      if( bfs::exists( abs_path ) )
+      {
+         if( !_read_only )
+         {
+            auto existing_file_size = bfs::file_size( abs_path );
+            if( options.size > existing_file_size )
+            {
+               if( !bip::managed_mapped_file::grow( abs_path.generic_string().c_str(), options.size - existing_file_size ) )
+                  BOOST_THROW_EXCEPTION( std::runtime_error( "could not grow " + abs_path.generic_string() + " to requested size." ) );
+            }
+            segment.reset( new bip::managed_mapped_file( bip::open_only, abs_path.generic_string().c_str() ) );
+         } else {
+            segment.reset( new bip::managed_mapped_file( bip::open_read_only, abs_path.generic_string().c_str() ) );
+         }
+
+         auto env = segment->find< environment_check >( "environment" );
+         if( !env.first || !( *env.first == environment_check()) ) {
+            BOOST_THROW_EXCEPTION( std::runtime_error( abs_path.generic_string() + " created by a different compiler, build, or operating system" ) );
+         }
+         if( !_read_only ) verify_checksums( abs_path, *segment );
+      } else {
+         if( _read_only )
+            BOOST_THROW_EXCEPTION( std::runtime_error( "unable to find " + abs_path.generic_string() + " in read only database" ) );
+         bfs::remove( checksum_path( abs_path ) );
+         bfs::remove( dirty_path( abs_path ) );
+         if( !options.size )
+            BOOST_THROW_EXCEPTION( std::logic_error( "a size is required to create " + abs_path.generic_string() ) );
+         segment.reset( new bip::managed_mapped_file( bip::create_only, abs_path.generic_string().c_str(), options.size ) );
+         segment->find_or_construct< environment_check >( "environment" )();
+      }
+
+      if( options.huge_pages ) advise_huge_pages( *segment );
+
+      if( _index_segments.size() <= type_id )
+         _index_segments.resize( type_id + 1 );
+      _index_segments[ type_id ].file    = std::move( segment );
+      _index_segments[ type_id ].options = options;
+      return *_index_segments[ type_id ].file;
+   }
+
    database::session database::start_undo_session( bool enabled )
    {
+      vector< std::unique_ptr<abstract_session> > _sub_sessions;
       if( enabled ) {
-         vector< std::unique_ptr<abstract_session> > _sub_sessions;
          _sub_sessions.reserve( _index_list.size() );
          for( auto& item : _index_list ) {
             _sub_sessions.push_back( item->start_undo_session( enabled ) );
          }
-         return session( std::move( _sub_sessions ) );
-      } else {
-         return session();
       }
+      session result( std::move( _sub_sessions ) );
+      if( BOOST_UNLIKELY( bool( _trace ) ) ) {
+         trace( trace_op::start_session, 0, -1, enabled );
+         result._db = this;
+      }
+      return result;
+   }
+
+   void database::start_trace( const bfs::path& file )
+   {
+      _trace.reset();
+      _trace.reset( new trace_writer( file ) );
+   }
+
+   void database::stop_trace()
+   {
+      _trace.reset();
    }
 
 }  // namespace chainbase
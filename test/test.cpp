@@ -2,12 +2,26 @@
 
 #include <boost/test/unit_test.hpp>
 #include <chainbase/chainbase.hpp>
+#include <chainbase/column_index.hpp>
+#include <chainbase/hash_index.hpp>
+#include <chainbase/key_filter.hpp>
+#include <chainbase/prefetch.hpp>
+#include <chainbase/read_executor.hpp>
+#include <chainbase/secondary_index.hpp>
+#include <chainbase/state_hash.hpp>
+#include <chainbase/tiered_index.hpp>
 
 #include <boost/multi_index_container.hpp>
 #include <boost/multi_index/ordered_index.hpp>
 #include <boost/multi_index/member.hpp>
 
 #include <iostream>
+#include <random>
+
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 using namespace chainbase;
 using namespace boost::multi_index;
@@ -38,6 +52,60 @@ typedef multi_index_container<
 
 CHAINBASE_SET_INDEX_TYPE( book, book_index )
 
+struct account : public chainbase::object<1, account> {
+
+   template<typename Constructor, typename Allocator>
+   account( Constructor&& c, Allocator&& a ) : name( a ) {
+      c(*this);
+   }
+
+   id_type       id;
+   pooled_string name;
+   int           balance = 0;
+};
+
+struct by_name;
+
+typedef multi_index_container<
+  account,
+  indexed_by<
+     ordered_unique< member<account,account::id_type,&account::id> >,
+     ordered_unique< tag<by_name>, member<account,pooled_string,&account::name>, strcmp_less >
+  >,
+  chainbase::allocator<account>
+> account_index;
+
+CHAINBASE_SET_INDEX_TYPE( account, account_index )
+
+namespace chainbase {
+   template<> struct state_hash_serializer< account > {
+      static void write( const account& a, state_hash_writer& w ) {
+         w.write_value( a.id._id );
+         w.write_string( a.name.data(), a.name.size() );
+         w.write_value( a.balance );
+      }
+   };
+}
+
+struct by_a_b;
+
+typedef multi_index_container<
+  book,
+  indexed_by<
+     ordered_unique< member<book,book::id_type,&book::id> >,
+     ordered_unique< tag<by_a_b>,
+        normalized_composite_key< book, member<book,int,&book::a>, member<book,int,&book::b>, member<book,book::id_type,&book::id> >
+     >
+  >,
+  chainbase::allocator<book>
+> book_by_a_b_index;
+
+typedef column_index< book, column<book,int,&book::a>, column<book,int,&book::b> > book_columns;
+typedef tiered_index< book > book_tiers;
+
+typedef secondary_index< book_by_a_b_index, member<book,int,&book::b> > book_by_b;
+typedef hash_index< book_by_a_b_index, member<book,int,&book::b> > book_hashed_by_b;
+
 
 BOOST_AUTO_TEST_CASE( open_and_create ) {
    boost::filesystem::path temp = boost::filesystem::unique_path();
@@ -137,3 +205,1543 @@ BOOST_AUTO_TEST_CASE( open_and_create ) {
 }
 
 // BOOST_AUTO_TEST_SUITE_END()
+
+BOOST_AUTO_TEST_CASE( lock_recovery ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >();
+
+      db.with_write_lock( [&]() {
+         db.create<book>( []( book& b ) { b.a = 1; } );
+      });
+      BOOST_REQUIRE_EQUAL( db.with_read_lock( [&]() { return db.get( book::id_type(0) ).a; } ), 1 );
+      BOOST_REQUIRE_EQUAL( db.get_write_lock_stats().acquisitions, 1u );
+      BOOST_REQUIRE_EQUAL( db.get_read_lock_stats().acquisitions, 1u );
+
+      /// a process that dies while holding the write lock must not wedge everyone else
+      pid_t child = fork();
+      if( child == 0 ) {
+         db.with_write_lock( [&]() { _exit( 0 ); } );
+         _exit( 1 );
+      }
+      int status = 0;
+      waitpid( child, &status, 0 );
+      BOOST_REQUIRE( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+
+      BOOST_REQUIRE_EQUAL( db.with_read_lock( [&]() { return db.get( book::id_type(0) ).a; }, 5000000 ), 1 );
+      db.with_write_lock( [&]() {
+         db.modify( db.get( book::id_type(0) ), []( book& b ) { b.a = 2; } );
+      });
+      auto read_stats = db.get_read_lock_stats();
+      BOOST_REQUIRE_EQUAL( read_stats.contended, 1u );
+      uint64_t histogram_total = 0;
+      for( auto c : read_stats.wait_histogram ) histogram_total += c;
+      BOOST_REQUIRE_EQUAL( histogram_total, read_stats.acquisitions );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( lock_recovery_forked_owner ) {
+   void* memory = mmap( nullptr, sizeof(read_write_mutex), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0 );
+   BOOST_REQUIRE( memory != MAP_FAILED );
+   auto& mutex = *new( memory ) read_write_mutex();
+
+   int ready[2];
+   BOOST_REQUIRE_EQUAL( pipe( ready ), 0 );
+   BOOST_REQUIRE_EQUAL( prctl( PR_SET_CHILD_SUBREAPER, 1 ), 0 );
+
+   /// an owner forks a child that takes the write lock on the owner's slot, then the owner dies
+   pid_t owner = fork();
+   if( owner == 0 ) {
+      const int32_t slot = mutex.register_owner();
+      pid_t writer = fork();
+      if( writer == 0 ) {
+         mutex.lock( slot );
+         const pid_t self = getpid();
+         if( write( ready[1], &self, sizeof(self) ) != sizeof(self) ) _exit( 1 );
+         pause();
+         _exit( 0 );
+      }
+      _exit( 0 );
+   }
+   pid_t writer = 0;
+   BOOST_REQUIRE_EQUAL( read( ready[0], &writer, sizeof(writer) ), ssize_t( sizeof(writer) ) );
+   int status = 0;
+   waitpid( owner, &status, 0 );
+
+   /// the dead owner's slot is reclaimed but the write lock stays with the live child
+   BOOST_REQUIRE_EQUAL( mutex.recover_abandoned(), 1u );
+   BOOST_REQUIRE( !mutex.try_lock( read_write_mutex::anonymous_slot ) );
+   BOOST_REQUIRE( !mutex.try_lock_shared( read_write_mutex::anonymous_slot ) );
+
+   /// this process adopted the child when the owner died
+   kill( writer, SIGKILL );
+   while( waitpid( writer, &status, 0 ) < 0 && errno == EINTR ) {}
+   prctl( PR_SET_CHILD_SUBREAPER, 0 );
+   BOOST_REQUIRE_EQUAL( mutex.recover_abandoned(), 1u );
+   BOOST_REQUIRE( mutex.try_lock( read_write_mutex::anonymous_slot ) );
+   mutex.unlock( read_write_mutex::anonymous_slot );
+   BOOST_REQUIRE_EQUAL( mutex.state(), 0u );
+
+   close( ready[0] );
+   close( ready[1] );
+   munmap( memory, sizeof(read_write_mutex) );
+}
+
+BOOST_AUTO_TEST_CASE( statistics ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >();
+
+      const auto& b0 = db.create<book>( []( book& b ) { b.a = 1; } );
+      db.create<book>( []( book& b ) { b.a = 2; } );
+      {
+         auto session = db.start_undo_session( true );
+         db.modify( b0, []( book& b ) { b.a = 3; } );
+         db.modify( b0, []( book& b ) { b.a = 4; } );
+         db.create<book>( []( book& b ) { b.a = 5; } );
+         session.push();
+      }
+
+      auto stats = db.get_statistics();
+      BOOST_REQUIRE_EQUAL( stats.size(), 1u );
+      BOOST_REQUIRE_EQUAL( stats[0].type_id, uint32_t( book::type_id ) );
+      BOOST_REQUIRE_EQUAL( stats[0].object_count, 3u );
+      BOOST_REQUIRE_EQUAL( stats[0].node_bytes, 3 * stats[0].node_size );
+      BOOST_REQUIRE_EQUAL( stats[0].counters.creates, 3u );
+      BOOST_REQUIRE_EQUAL( stats[0].counters.modifies, 2u );
+      BOOST_REQUIRE_EQUAL( stats[0].undo_levels.size(), 1u );
+      BOOST_REQUIRE_EQUAL( stats[0].undo_levels[0].modifies, 2u );
+      BOOST_REQUIRE_EQUAL( stats[0].undo_levels[0].old_values, 1u );
+      BOOST_REQUIRE_EQUAL( stats[0].undo_levels[0].new_ids, 1u );
+      BOOST_REQUIRE_EQUAL( stats[0].undo_entries, 2u );
+      BOOST_REQUIRE( stats[0].undo_bytes > 0 );
+
+      db.undo();
+      stats = db.get_statistics();
+      BOOST_REQUIRE_EQUAL( stats[0].object_count, 2u );
+      BOOST_REQUIRE_EQUAL( stats[0].counters.undo_time.count, 1u );
+      BOOST_REQUIRE_EQUAL( stats[0].undo_levels.size(), 0u );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( memory_report_and_compact ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >();
+
+      for( int i = 0; i < 10000; ++i )
+         db.create<book>( [&]( book& b ) { b.a = i; b.b = -i; } );
+      for( int i = 0; i < 10000; i += 2 )
+         db.remove( db.get( book::id_type(i) ) );
+
+      auto before = db.get_memory_report( 64 );
+      BOOST_REQUIRE_EQUAL( before.indices.size(), 1u );
+      BOOST_REQUIRE_EQUAL( before.indices[0].object_count, 5000u );
+      BOOST_REQUIRE( before.largest_free_block > 0 );
+      BOOST_REQUIRE( before.largest_free_block <= before.free_bytes );
+      BOOST_REQUIRE_EQUAL( db.get_free_memory(), before.free_bytes ); /// probing leaves the allocator unchanged
+
+      {
+         auto session = db.start_undo_session( true );
+         db.create<book>( []( book& ) {} );
+         session.push();
+         BOOST_CHECK_THROW( db.compact(), std::logic_error ); /// undo history must be committed
+         db.undo();
+      }
+
+      db.compact();
+      auto after = db.get_memory_report( 64 );
+      BOOST_REQUIRE( after.largest_free_block > before.largest_free_block );
+      BOOST_REQUIRE_EQUAL( after.indices[0].object_count, 5000u );
+
+      for( int i = 1; i < 10000; i += 2 )
+         BOOST_REQUIRE_EQUAL( db.get( book::id_type(i) ).a, i );
+      BOOST_REQUIRE( db.find( book::id_type(0) ) == nullptr );
+      BOOST_REQUIRE_EQUAL( db.create<book>( []( book& ) {} ).id._id, 10000 );
+
+      db.close();
+      db.open( temp, database::read_write );
+      db.add_index< book_index >();
+      BOOST_REQUIRE_EQUAL( db.get( book::id_type(9999) ).b, -9999 );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( pooled_strings ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< account_index >();
+
+      const std::string long_name = "a rather long account name that is pooled";
+      const auto& alice = db.create<account>( []( account& a ) { a.name = "alice"; } );
+      const auto& bob   = db.create<account>( [&]( account& a ) { a.name = long_name + " bob"; } );
+      db.create<account>( [&]( account& a ) { a.name = long_name; } );
+
+      BOOST_REQUIRE( alice.name.is_inline() );
+      BOOST_REQUIRE( !bob.name.is_inline() );
+      BOOST_REQUIRE_EQUAL( pooled_string::pool_size( db.get_segment_manager() ), 2u );
+
+      BOOST_REQUIRE( (db.find<account, by_name>( std::string( "alice" ) ) == &alice) );
+      BOOST_REQUIRE( (db.find<account, by_name>( long_name + " bob" ) == &bob) );
+      BOOST_REQUIRE( (db.find<account, by_name>( std::string( "alic" ) ) == nullptr) );
+      BOOST_REQUIRE( (db.find<account, by_name>( long_name + " bo" ) == nullptr) );
+
+      const auto& by_name_idx = db.get_index<account_index, by_name>();
+      std::vector<std::string> names;
+      for( const auto& a : by_name_idx ) names.push_back( a.name.str() );
+      BOOST_REQUIRE( std::is_sorted( names.begin(), names.end() ) );
+
+      {
+         auto session = db.start_undo_session( true );
+         db.modify( bob, []( account& a ) { a.balance = 10; } );
+         BOOST_REQUIRE_EQUAL( bob.name.use_count(), 2u ); /// the undo copy shares the pooled buffer
+         db.modify( bob, [&]( account& a ) { a.name = "carol"; } );
+         BOOST_REQUIRE_EQUAL( pooled_string::pool_size( db.get_segment_manager() ), 2u );
+         db.remove( alice );
+      }
+      BOOST_REQUIRE( bob.name == pooled_string( long_name + " bob", chainbase::allocator<char>( db.get_segment_manager() ) ) );
+      BOOST_REQUIRE_EQUAL( bob.name.use_count(), 1u );
+      BOOST_REQUIRE_EQUAL( bob.balance, 0 );
+      BOOST_REQUIRE_EQUAL( (db.get<account, by_name>( std::string( "alice" ) ).name.str()), "alice" );
+
+      db.remove( bob );
+      BOOST_REQUIRE_EQUAL( pooled_string::pool_size( db.get_segment_manager() ), 1u );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( key_comparators ) {
+   std::mt19937 rng( 7 );
+   auto sign = []( int v ) { return v < 0 ? -1 : ( v > 0 ? 1 : 0 ); };
+   for( int len = 0; len < 100; ++len ) {
+      std::string a( len, 'x' );
+      for( auto& c : a ) c = char( rng() );
+      for( int pos = 0; pos <= len; ++pos ) {
+         std::string b = a;
+         if( pos < len ) b[pos] = char( b[pos] + 1 + rng() % 255 );
+         else b.push_back( char( rng() ) );
+         int expected = sign( memcmp( a.data(), b.data(), std::min( a.size(), b.size() ) ) );
+         if( !expected ) expected = a.size() < b.size() ? -1 : ( a.size() > b.size() ? 1 : 0 );
+         BOOST_REQUIRE_EQUAL( sign( chainbase::detail::compare_bytes( a.data(), a.size(), b.data(), b.size() ) ), expected );
+         BOOST_REQUIRE_EQUAL( sign( chainbase::detail::compare_bytes( b.data(), b.size(), a.data(), a.size() ) ), -expected );
+      }
+      BOOST_REQUIRE_EQUAL( chainbase::detail::compare_bytes( a.data(), a.size(), a.data(), a.size() ), 0 );
+   }
+
+   /// normalized keys order like the tuple of their fields
+   const int values[] = { std::numeric_limits<int>::min(), -70000, -1, 0, 1, 255, 256, 70000, std::numeric_limits<int>::max() };
+   for( int x : values ) for( int y : values ) for( int z : values ) for( int w : values ) {
+      BOOST_REQUIRE_EQUAL( make_normalized_key( x, y ) < make_normalized_key( z, w ), std::make_tuple( x, y ) < std::make_tuple( z, w ) );
+   }
+
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_by_a_b_index >();
+      auto& idx = db.get_mutable_index< book_by_a_b_index >();
+      for( int i = 0; i < 100; ++i )
+         idx.emplace( [&]( book& b ) { b.a = 50 - i % 10; b.b = -i; } );
+
+      const auto& by_key = idx.indices().get<by_a_b>();
+      auto itr = by_key.find( make_normalized_key( 45, -25, book::id_type(25) ) );
+      BOOST_REQUIRE( itr != by_key.end() );
+      BOOST_REQUIRE_EQUAL( itr->id._id, 25 );
+
+      std::vector< std::tuple<int,int,int64_t> > keys;
+      for( const auto& b : by_key ) keys.emplace_back( b.a, b.b, b.id._id );
+      BOOST_REQUIRE( std::is_sorted( keys.begin(), keys.end() ) );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( columnar_storage ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_columns >();
+      auto& table = db.get_mutable_index< book_columns >();
+
+      for( int i = 0; i < 10; ++i )
+         BOOST_REQUIRE_EQUAL( table.emplace( [&]( book& b ) { b.a = i; b.b = 2 * i; } )._id, i );
+
+      auto sum_a = [&]() {
+         int sum = 0;
+         const int* a = table.column_data< column<book,int,&book::a> >();
+         for( size_t i = 0; i < table.slots(); ++i ) sum += a[i];
+         return sum;
+      };
+      BOOST_REQUIRE_EQUAL( sum_a(), 45 );
+
+      {
+         auto session = db.start_undo_session( true );
+         table.modify( book::id_type(3), []( book& b ) { b.a = 100; } );
+         table.remove( book::id_type(4) );
+         table.emplace( []( book& b ) { b.a = 1000; } );
+         BOOST_REQUIRE_EQUAL( sum_a(), 45 + 97 - 4 + 1000 );
+         BOOST_REQUIRE_EQUAL( table.size(), 10u );
+         BOOST_REQUIRE( !table.contains( book::id_type(4) ) );
+         BOOST_CHECK_THROW( table.get( book::id_type(4) ), std::out_of_range );
+      }
+      BOOST_REQUIRE_EQUAL( sum_a(), 45 );
+      BOOST_REQUIRE_EQUAL( table.slots(), 10u );
+      BOOST_REQUIRE_EQUAL( table.get( book::id_type(4) ).b, 8 );
+      BOOST_REQUIRE_EQUAL( table.get( book::id_type(3) ).a, 3 );
+
+      {
+         auto s1 = db.start_undo_session( true );
+         table.modify( book::id_type(1), []( book& b ) { b.b = -1; } );
+         auto s2 = db.start_undo_session( true );
+         table.remove( book::id_type(1) );
+         s2.squash();
+         s1.push();
+      }
+      BOOST_REQUIRE( !table.contains( book::id_type(1) ) );
+      db.undo();
+      BOOST_REQUIRE_EQUAL( table.get( book::id_type(1) ).b, 2 );
+
+      auto stats = db.get_statistics();
+      BOOST_REQUIRE_EQUAL( stats[0].object_count, 10u );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( range_queries ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*32 );
+      db.add_index< book_by_a_b_index >();
+
+      auto& idx = db.get_mutable_index< book_by_a_b_index >();
+      for( int i = 0; i < 1000; ++i )
+         idx.emplace( [&]( book& b ) { b.a = i % 100; b.b = i; } );
+
+      /// a in [10, 20) and b odd, scanned 7 objects per read lock
+      const int min_int = std::numeric_limits<int>::min();
+      generic_index<book_by_a_b_index>::cursor<by_a_b> c( make_normalized_key( 10, min_int, book::id_type(0) ),
+                                                          make_normalized_key( 20, min_int, book::id_type(0) ) );
+      aggregate_result<int, int64_t> result;
+      uint32_t chunks = 0;
+      db.read_in_chunks( [&]() {
+         ++chunks;
+         return idx.aggregate<by_a_b>( c, 7, []( const book& b ) { return b.b; }, []( const book& b ) { return b.b % 2; }, result );
+      });
+      BOOST_REQUIRE_EQUAL( chunks, 15u );
+      BOOST_REQUIRE_EQUAL( result.count, 50u );
+      BOOST_REQUIRE_EQUAL( result.min, 11 );
+      BOOST_REQUIRE_EQUAL( result.max, 919 );
+
+      /// objects removed between chunks do not derail the cursor
+      generic_index<book_by_a_b_index>::cursor<by_a_b> all;
+      vector<book::id_type> ids;
+      idx.select_ids<by_a_b>( all, 10, []( const book& ) { return true; }, ids );
+      idx.remove( idx.get( book::id_type(1) ) ); /// next object to be visited
+      while( !idx.select_ids<by_a_b>( all, 100, []( const book& ) { return true; }, ids ) ) {}
+      BOOST_REQUIRE_EQUAL( ids.size(), 999u );
+
+      /// the same range split across threads, alone and after a first chunk
+      for( size_t first_chunk : { 0, 1, 7 } ) {
+         generic_index<book_by_a_b_index>::cursor<by_a_b> sequential( make_normalized_key( 10, min_int, book::id_type(0) ),
+                                                                      make_normalized_key( 20, min_int, book::id_type(0) ) );
+         auto parallel = sequential;
+         aggregate_result<int, int64_t> expected, threaded;
+         auto field = []( const book& b ) { return b.b; };
+         auto odd   = []( const book& b ) { return b.b % 2 == 1; };
+         while( !idx.aggregate<by_a_b>( sequential, 1000, field, odd, expected ) ) {}
+         if( first_chunk ) idx.aggregate<by_a_b>( parallel, first_chunk, field, odd, threaded );
+         idx.parallel_aggregate<by_a_b>( parallel, 4, field, odd, threaded );
+         BOOST_REQUIRE( parallel.done() );
+         BOOST_REQUIRE_EQUAL( threaded.count, expected.count );
+         BOOST_REQUIRE_EQUAL( threaded.sum, expected.sum );
+         BOOST_REQUIRE_EQUAL( threaded.min, expected.min );
+         BOOST_REQUIRE_EQUAL( threaded.max, expected.max );
+      }
+      {
+         generic_index<book_by_a_b_index>::cursor<by_a_b> sequential, parallel;
+         vector<book::id_type> expected, threaded;
+         auto some = []( const book& b ) { return b.b % 3 == 0; };
+         while( !idx.select_ids<by_a_b>( sequential, 1000, some, expected ) ) {}
+         idx.parallel_select_ids<by_a_b>( parallel, 4, some, threaded );
+         BOOST_REQUIRE( threaded == expected );
+      }
+
+      /// vectorized, multi threaded aggregates over a column
+      db.wipe( temp );
+      db.open( temp, database::read_write, 1024*1024*32 );
+      db.add_index< book_columns >();
+      auto& table = db.get_mutable_index< book_columns >();
+      for( int i = 0; i < 200000; ++i )
+         table.emplace( [&]( book& b ) { b.a = i; b.b = i % 7; } );
+      table.remove( book::id_type(5) );
+
+      typedef column<book,int,&book::a> col_a;
+      auto even = []( int v ) { return v % 2 == 0; };
+      auto single = table.aggregate<col_a, int64_t>( even );
+      auto threaded = table.aggregate<col_a, int64_t>( even, 0, -1, 4 );
+      BOOST_REQUIRE_EQUAL( single.count, 100000u );
+      BOOST_REQUIRE_EQUAL( single.sum, int64_t(199998) * 100000 / 2 );
+      BOOST_REQUIRE_EQUAL( single.min, 0 );
+      BOOST_REQUIRE_EQUAL( single.max, 199998 );
+      BOOST_REQUIRE_EQUAL( threaded.count, single.count );
+      BOOST_REQUIRE_EQUAL( threaded.sum, single.sum );
+      BOOST_REQUIRE_EQUAL( threaded.min, single.min );
+      BOOST_REQUIRE_EQUAL( threaded.max, single.max );
+
+      BOOST_REQUIRE_EQUAL( table.count<col_a>( []( int v ) { return v < 10; } ), 9u );
+      auto selected = table.select_ids<col_a>( []( int v ) { return v % 50000 == 5; }, 0, -1, 4 );
+      BOOST_REQUIRE_EQUAL( selected.size(), 3u );
+      BOOST_REQUIRE_EQUAL( selected[0]._id, 50005 );
+      BOOST_REQUIRE_EQUAL( selected[2]._id, 150005 );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+struct scan_result {
+   uint64_t             count = 0;
+   int64_t              sum   = 0;
+   vector<book::id_type> ids;
+
+   scan_result& operator += ( const scan_result& o ) {
+      count += o.count;
+      sum   += o.sum;
+      ids.insert( ids.end(), o.ids.begin(), o.ids.end() );
+      return *this;
+   }
+};
+
+BOOST_AUTO_TEST_CASE( parallel_scans ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*32 );
+      db.add_index< book_by_a_b_index >();
+
+      auto& idx = db.get_mutable_index< book_by_a_b_index >();
+      for( int i = 0; i < 50000; ++i )
+         idx.emplace( [&]( book& b ) { b.a = i % 100; b.b = i; } );
+
+      auto splits = idx.split_points<by_a_b>( 4 );
+      BOOST_REQUIRE_EQUAL( splits.size(), 3u );
+      BOOST_REQUIRE( splits[0] < splits[1] && splits[1] < splits[2] );
+
+      auto visit = []( const book& b, scan_result& r ) { ++r.count; r.sum += b.b; r.ids.push_back( b.id ); };
+      scan_result sequential;
+      for( const auto& b : idx.indices().get<by_a_b>() ) visit( b, sequential );
+
+      auto parallel = db.with_read_lock( [&]() { return idx.parallel_scan<by_a_b, scan_result>( 4, visit ); } );
+      BOOST_REQUIRE_EQUAL( parallel.count, 50000u );
+      BOOST_REQUIRE_EQUAL( parallel.sum, sequential.sum );
+      BOOST_REQUIRE( parallel.ids == sequential.ids );
+
+      BOOST_REQUIRE_THROW( ( idx.parallel_scan<by_a_b, scan_result>( 4, []( const book& b, scan_result& ) {
+         if( b.b == 49999 ) BOOST_THROW_EXCEPTION( std::runtime_error( "visitor failed" ) );
+      }) ), std::runtime_error );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( secondary_indices ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*64 );
+      db.add_index< book_by_a_b_index >();
+
+      auto& idx = db.get_mutable_index< book_by_a_b_index >();
+      for( int i = 0; i < 100000; ++i )
+         idx.emplace( [&]( book& b ) { b.a = i % 100; b.b = i % 1000; } );
+
+      auto consistent = [&]( const book_by_b& by_b ) {
+         vector<std::pair<int, int64_t>> expected;
+         for( const auto& b : db.get_index< book_by_a_b_index >().indices() ) expected.emplace_back( b.b, b.id._id );
+         std::sort( expected.begin(), expected.end() );
+         vector<std::pair<int, int64_t>> actual;
+         for( const auto& e : by_b ) actual.emplace_back( e.key, e.id );
+         return actual == expected;
+      };
+
+      {
+         auto& by_b = db.add_secondary_index< book_by_b >( 4 );
+         BOOST_REQUIRE( by_b.rebuilt_on_attach() );
+         BOOST_REQUIRE_EQUAL( by_b.size(), 100000u );
+         BOOST_REQUIRE( consistent( by_b ) );
+         auto range = by_b.equal_range( 5 );
+         BOOST_REQUIRE_EQUAL( std::distance( range.first, range.second ), 100 );
+         BOOST_REQUIRE_EQUAL( by_b.find( 5 )->id._id, 5 );
+         BOOST_REQUIRE_THROW( db.add_secondary_index< book_by_b >(), std::logic_error );
+
+         /// maintained through changes and undo
+         auto session = db.start_undo_session( true );
+         idx.modify( idx.get( book::id_type(0) ), []( book& b ) { b.b = 5000; } );
+         idx.emplace( []( book& b ) { b.a = 1; b.b = 5001; } );
+         idx.remove( idx.get( book::id_type(1) ) );
+         BOOST_REQUIRE_EQUAL( by_b.find( 5000 )->id._id, 0 );
+         BOOST_REQUIRE_EQUAL( by_b.find( 5001 )->id._id, 100000 );
+         BOOST_REQUIRE( consistent( by_b ) );
+         session.undo();
+         BOOST_REQUIRE( by_b.find( 5000 ) == nullptr );
+         BOOST_REQUIRE( by_b.find( 5001 ) == nullptr );
+         BOOST_REQUIRE( consistent( by_b ) );
+
+         db.compact();
+         BOOST_REQUIRE( db.get_secondary_index< book_by_b >().rebuilt_on_attach() );
+         BOOST_REQUIRE( consistent( db.get_secondary_index< book_by_b >() ) );
+      }
+
+      /// reattaching an up to date index does not rebuild it
+      db.close();
+      db.open( temp, database::read_write );
+      db.add_index< book_by_a_b_index >();
+      BOOST_REQUIRE( !db.add_secondary_index< book_by_b >().rebuilt_on_attach() );
+
+      /// changes made while detached are detected
+      db.close();
+      db.open( temp, database::read_write );
+      db.add_index< book_by_a_b_index >();
+      auto& reopened = db.get_mutable_index< book_by_a_b_index >();
+      reopened.modify( reopened.get( book::id_type(7) ), []( book& b ) { b.b = 7000; } );
+      auto& by_b = db.add_secondary_index< book_by_b >( 2 );
+      BOOST_REQUIRE( by_b.rebuilt_on_attach() );
+      BOOST_REQUIRE_EQUAL( by_b.find( 7000 )->id._id, 7 );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( key_filters ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      typedef key_filter< account_index, by_name > name_filter;
+
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*32 );
+      db.add_index< account_index >();
+
+      auto name_of = []( int i ) { return ( i % 2 ? "a-much-longer-account-name-" : "acct-" ) + std::to_string( i ); };
+      auto create  = [&]( int i ) {
+         db.create< account >( [&]( account& a ) { a.name = name_of( i ); a.balance = i; } );
+      };
+      for( int i = 0; i < 1000; ++i ) create( i );
+
+      const auto& filter = db.add_secondary_index< name_filter >();
+      BOOST_REQUIRE_EQUAL( filter.keys(), 1000u );
+      BOOST_REQUIRE_GE( filter.capacity(), 2000u );
+
+      auto found = [&]( const std::string& name ) { return db.find< account, by_name >( name ) != nullptr; };
+      for( int i = 0; i < 1000; ++i ) BOOST_REQUIRE( found( name_of( i ) ) );
+
+      uint32_t false_positives = 0;
+      for( int i = 1000; i < 11000; ++i ) {
+         BOOST_REQUIRE( !found( name_of( i ) ) );
+         false_positives += filter.may_contain( key_filter_hash<std::string>::hash( name_of( i ) ) );
+      }
+      BOOST_REQUIRE_LT( false_positives, 300u );
+
+      /// maintained through changes and undo, and grown as keys are added
+      {
+         auto session = db.start_undo_session( true );
+         db.modify( db.get< account, by_name >( name_of( 3 ) ), [&]( account& a ) { a.name = "renamed"; } );
+         db.remove( db.get< account, by_name >( name_of( 4 ) ) );
+         for( int i = 1000; i < 5000; ++i ) create( i );
+         BOOST_REQUIRE( found( "renamed" ) );
+         BOOST_REQUIRE( !found( name_of( 3 ) ) );
+         BOOST_REQUIRE( !found( name_of( 4 ) ) );
+         BOOST_REQUIRE_EQUAL( filter.keys(), 4999u );
+         BOOST_REQUIRE_GE( filter.capacity(), 4999u );
+         for( int i = 1000; i < 5000; ++i ) BOOST_REQUIRE( found( name_of( i ) ) );
+      }
+      BOOST_REQUIRE( !found( "renamed" ) );
+      BOOST_REQUIRE_EQUAL( filter.keys(), 1000u );
+      for( int i = 0; i < 1000; ++i ) BOOST_REQUIRE( found( name_of( i ) ) );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( prefetched_iteration ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*32 );
+      db.add_index< book_by_a_b_index >();
+
+      auto& idx = db.get_mutable_index< book_by_a_b_index >();
+      for( int i = 0; i < 20000; ++i )
+         idx.emplace( [&]( book& b ) { b.a = i % 100; b.b = i; } );
+
+      const auto& ordered = idx.indices().get<by_a_b>();
+      vector<int64_t> expected;
+      for( const auto& b : ordered ) expected.push_back( b.id._id );
+
+      for( bool helper : { true, false } ) {
+         prefetch_options options;
+         options.helper_thread = helper;
+         options.window = 100;
+         options.batch  = 7;
+
+         vector<int64_t> ids;
+         db.with_read_lock( [&]() {
+            prefetched_for_each( ordered.begin(), ordered.end(), [&]( const book& b ) { ids.push_back( b.id._id ); }, options );
+         });
+         BOOST_REQUIRE( ids == expected );
+      }
+
+      /// a throwing visitor stops the read ahead
+      BOOST_REQUIRE_THROW( prefetched_for_each( ordered.begin(), ordered.end(), []( const book& b ) {
+         if( b.b == 5000 ) BOOST_THROW_EXCEPTION( std::runtime_error( "visitor failed" ) );
+      }), std::runtime_error );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( own_segments ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      segment_options own;
+      own.size = 1024*1024*8;
+
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >( own );
+      db.add_index< account_index >();
+      BOOST_REQUIRE( bfs::exists( db.index_segment_path( book::type_id ) ) );
+
+      const auto main_free = db.get_free_memory();
+      {
+         auto session = db.start_undo_session( true );
+         for( int i = 0; i < 1000; ++i )
+            db.create< book >( [&]( book& b ) { b.a = i; b.b = i; } );
+         db.create< account >( [&]( account& a ) { a.name = "owner"; } );
+         session.push();
+      }
+      db.commit( db.revision() );
+      BOOST_REQUIRE_GT( main_free - db.get_free_memory(), 0u );
+      BOOST_REQUIRE_LT( main_free - db.get_free_memory(), 1000 * sizeof(book) );
+      db.flush_index< book_index >();
+
+      auto report = db.get_memory_report();
+      for( const auto& usage : report.indices ) {
+         BOOST_REQUIRE_EQUAL( usage.own_segment, usage.type_id == book::type_id );
+         if( usage.own_segment ) BOOST_REQUIRE_EQUAL( usage.segment_size, own.size );
+      }
+
+      db.compact();
+      BOOST_REQUIRE_EQUAL( db.get_index< book_index >().indices().size(), 1000u );
+      BOOST_REQUIRE_EQUAL( db.get< book >( book::id_type(999) ).b, 999 );
+
+      /// the table must be added the same way on every open, and the file can grow
+      db.close();
+      db.open( temp, database::read_write );
+      BOOST_REQUIRE_THROW( db.add_index< book_index >(), std::logic_error );
+      own.size *= 2;
+      db.add_index< book_index >( own );
+      db.add_index< account_index >();
+      BOOST_REQUIRE_THROW( db.add_index< account_index >( own ), std::logic_error );
+      BOOST_REQUIRE_EQUAL( bfs::file_size( db.index_segment_path( book::type_id ) ), own.size );
+      BOOST_REQUIRE_EQUAL( db.get< book >( book::id_type(999) ).b, 999 );
+      BOOST_REQUIRE_EQUAL( db.get< account >( account::id_type(0) ).name.str(), "owner" );
+
+      auto path = db.index_segment_path( book::type_id );
+      db.wipe( temp );
+      BOOST_REQUIRE( !bfs::exists( path ) );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( tiered_storage ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_tiers >();
+      auto cold_file = temp / "cold-0.dat";
+
+      {
+         auto& table = db.get_mutable_index< book_tiers >();
+         for( int i = 0; i < 100; ++i )
+            table.emplace( [&]( book& b ) { b.a = i; b.b = 2 * i; } );
+
+         /// everything was just created, the first sweep only clears the reference flags
+         BOOST_REQUIRE_EQUAL( table.evict( 10 ), 90u );
+         BOOST_REQUIRE_EQUAL( table.hot_size(), 10u );
+         BOOST_REQUIRE_EQUAL( table.cold_size(), 90u );
+         BOOST_REQUIRE_EQUAL( bfs::file_size( cold_file ), table.cold_bytes() );
+         BOOST_REQUIRE_EQUAL( table.evict( 10 ), 0u );
+
+         book::id_type cold_id;
+         for( int i = 0; i < 100 && table.is_hot( cold_id ); ++i ) cold_id = book::id_type( i );
+         BOOST_REQUIRE( !table.is_hot( cold_id ) );
+         BOOST_REQUIRE_EQUAL( table.get( cold_id ).b, 2 * cold_id._id );
+         BOOST_REQUIRE( !table.is_hot( cold_id ) );
+         BOOST_REQUIRE_EQUAL( table.fetch( cold_id ).a, cold_id._id );
+         BOOST_REQUIRE( table.is_hot( cold_id ) );
+         BOOST_REQUIRE_EQUAL( table.cold_dead_bytes(), book_tiers::record_size );
+         BOOST_REQUIRE_THROW( table.get( book::id_type(100) ), std::out_of_range );
+      }
+
+      /// changes to evicted objects are undone into the segment
+      {
+         auto& table = db.get_mutable_index< book_tiers >();
+         table.evict( 0 );
+         table.evict( 0 );
+         BOOST_REQUIRE_EQUAL( table.hot_size(), 0u );
+
+         auto session = db.start_undo_session( true );
+         table.modify( book::id_type(5), []( book& b ) { b.b = -1; } );
+         table.remove( book::id_type(6) );
+         auto id = table.emplace( []( book& b ) { b.a = 1000; } );
+         BOOST_REQUIRE_EQUAL( table.get( book::id_type(5) ).b, -1 );
+         BOOST_REQUIRE( !table.contains( book::id_type(6) ) );
+         BOOST_REQUIRE_EQUAL( table.evict( 0 ), 2u );
+         BOOST_REQUIRE_EQUAL( table.size(), 100u );
+         session.undo();
+
+         BOOST_REQUIRE_EQUAL( table.get( book::id_type(5) ).b, 10 );
+         BOOST_REQUIRE_EQUAL( table.get( book::id_type(6) ).b, 12 );
+         BOOST_REQUIRE( !table.contains( id ) );
+         BOOST_REQUIRE_EQUAL( table.size(), 100u );
+      }
+
+      /// evicted objects survive reopening and compaction
+      db.close();
+      db.open( temp, database::read_write );
+      db.add_index< book_tiers >();
+      db.compact();
+      {
+         const auto& table = db.get_index< book_tiers >();
+         BOOST_REQUIRE_EQUAL( table.size(), 100u );
+         for( int i = 0; i < 100; ++i )
+            BOOST_REQUIRE_EQUAL( table.get( book::id_type(i) ).b, 2 * i );
+      }
+
+      db.wipe( temp );
+      BOOST_REQUIRE( !bfs::exists( cold_file ) );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( packed_undo_levels ) {
+   {
+      /// records round trip through the codec, starting from a dictionary or from zero bytes
+      book dictionary( []( book& b ) { b.a = 7; b.b = 7; }, 0 );
+      vector<char> out;
+      record_encoder encoder( sizeof(book), reinterpret_cast<const char*>( &dictionary ) );
+      for( int i = 0; i < 100; ++i ) {
+         book b( [&]( book& b ) { b.id = book::id_type(i); b.a = 7; b.b = i % 3; }, 0 );
+         encoder.put( reinterpret_cast<const char*>( &b ), out );
+      }
+      put_varint( out, 300 );
+      BOOST_REQUIRE_LT( out.size(), 100 * sizeof(book) / 2 );
+
+      record_reader in( out.data(), out.size() );
+      record_decoder decoder( sizeof(book), reinterpret_cast<const char*>( &dictionary ) );
+      for( int i = 0; i < 100; ++i ) {
+         book b( []( book& ){}, 0 );
+         decoder.get( in, reinterpret_cast<char*>( &b ) );
+         BOOST_REQUIRE_EQUAL( b.id._id, i );
+         BOOST_REQUIRE_EQUAL( b.a, 7 );
+         BOOST_REQUIRE_EQUAL( b.b, i % 3 );
+      }
+      BOOST_REQUIRE_EQUAL( get_varint( in ), 300u );
+      BOOST_REQUIRE( in.done() );
+      book b( []( book& ){}, 0 );
+      BOOST_REQUIRE_THROW( decoder.get( in, reinterpret_cast<char*>( &b ) ), std::runtime_error );
+   }
+
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >();
+      db.add_index< account_index >();
+      BOOST_REQUIRE_THROW( db.get_mutable_index< account_index >().set_undo_pack_depth( 1 ), std::logic_error );
+
+      for( int i = 0; i < 1000; ++i )
+         db.create< book >( [&]( book& b ) { b.a = i; b.b = i; } );
+
+      auto& idx = db.get_mutable_index< book_index >();
+      idx.set_undo_pack_depth( 2 );
+      const auto start = db.revision();
+
+      /// each revision changes, removes and creates a few objects
+      for( int r = 0; r < 6; ++r ) {
+         auto session = db.start_undo_session( true );
+         for( int i = 0; i < 100; ++i )
+            db.modify( db.get( book::id_type( r * 100 + i ) ), [&]( book& b ) { b.b = -r; } );
+         db.remove( db.get( book::id_type( 900 + r ) ) );
+         db.create< book >( [&]( book& b ) { b.a = 2000 + r; } );
+         session.push();
+      }
+
+      auto stats = db.get_statistics();
+      const auto& levels = stats[ book::type_id ].undo_levels;
+      BOOST_REQUIRE_EQUAL( levels.size(), 6u );
+      for( size_t l = 0; l < levels.size(); ++l ) {
+         BOOST_REQUIRE_EQUAL( levels[l].packed_bytes != 0, l < 4 );
+         BOOST_REQUIRE_EQUAL( levels[l].old_values, 100u );
+         BOOST_REQUIRE_EQUAL( levels[l].removed_values, 1u );
+         BOOST_REQUIRE_EQUAL( levels[l].new_ids, 1u );
+         if( levels[l].packed_bytes )
+            BOOST_REQUIRE_LT( levels[l].packed_bytes, 101 * sizeof(book) / 2 );
+      }
+
+      /// squash merges into a packed level, undo unpacks each level as it becomes the head
+      db.squash();
+      db.undo();
+      BOOST_REQUIRE_EQUAL( db.revision(), start + 4 );
+      BOOST_REQUIRE_EQUAL( db.get( book::id_type(399) ).b, -3 );
+      BOOST_REQUIRE( !db.find( book::id_type(903) ) );
+      BOOST_REQUIRE( db.find( book::id_type(904) ) );
+      BOOST_REQUIRE( db.find( book::id_type(1003) ) );
+      BOOST_REQUIRE( !db.find( book::id_type(1004) ) );
+
+      db.commit( start + 1 );
+      db.undo_all();
+      BOOST_REQUIRE_EQUAL( db.revision(), start + 1 );
+      BOOST_REQUIRE_EQUAL( idx.indices().size(), 1000u );
+      for( int i = 0; i < 1000; ++i ) {
+         if( i == 900 ) continue;
+         const auto& b = db.get( book::id_type(i) );
+         BOOST_REQUIRE_EQUAL( b.a, i );
+         BOOST_REQUIRE_EQUAL( b.b, i < 100 ? 0 : i );
+      }
+      BOOST_REQUIRE( !db.find( book::id_type(900) ) );
+      BOOST_REQUIRE_EQUAL( db.get( book::id_type(1000) ).a, 2000 );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( state_hashes ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >();
+      db.add_index< account_index >();
+      db.add_secondary_index< state_hash< book_index > >();
+      db.add_secondary_index< state_hash< account_index > >();
+      BOOST_REQUIRE( db.get_state_digest() == state_digest() );
+
+      auto full_walk = [&]() {
+         state_digest d;
+         for( const auto& b : db.get_index< book_index >().indices() )    d += state_hash< book_index >::hash( b );
+         for( const auto& a : db.get_index< account_index >().indices() ) d += state_hash< account_index >::hash( a );
+         return d;
+      };
+
+      for( int i = 0; i < 100; ++i ) {
+         db.create< book >( [&]( book& b ) { b.a = i; b.b = i; } );
+         db.create< account >( [&]( account& a ) { a.name = "account " + std::to_string( i ); a.balance = i; } );
+      }
+      const auto before = db.get_state_digest();
+      BOOST_REQUIRE( before == full_walk() );
+      BOOST_REQUIRE_EQUAL( before.str().size(), 64u );
+
+      {
+         auto session = db.start_undo_session( true );
+         db.modify( db.get( book::id_type(5) ), []( book& b ) { b.b = 500; } );
+         db.modify( db.get( account::id_type(7) ), []( account& a ) { a.name = "a much longer account name than fits inline"; } );
+         db.remove( db.get( book::id_type(9) ) );
+         db.create< book >( []( book& b ) { b.a = 1000; } );
+         BOOST_REQUIRE( db.get_state_digest() != before );
+         BOOST_REQUIRE( db.get_state_digest() == full_walk() );
+
+         /// changing objects back restores their share of the digest
+         db.modify( db.get( book::id_type(5) ), []( book& b ) { b.b = 5; } );
+         db.modify( db.get( account::id_type(7) ), []( account& a ) { a.name = "account 7"; } );
+         db.remove( db.get( book::id_type(100) ) );
+         db.create< book >( []( book& b ) { b.a = 9; b.b = 9; } );
+         db.remove( db.get( book::id_type(101) ) );
+         BOOST_REQUIRE( db.get_state_digest() != before ); // book 9 has a new id now
+         BOOST_REQUIRE( db.get_state_digest() == full_walk() );
+      }
+      BOOST_REQUIRE( db.get_state_digest() == before );
+
+      /// a digest that was kept up to date is picked up again, a stale one is recomputed
+      db.close();
+      db.open( temp, database::read_write );
+      db.add_index< book_index >();
+      db.add_index< account_index >();
+      db.create< book >( []( book& b ) { b.a = 2000; } );
+      db.add_secondary_index< state_hash< book_index > >( 4 );
+      db.add_secondary_index< state_hash< account_index > >();
+      BOOST_REQUIRE( db.get_state_digest() == full_walk() );
+      BOOST_REQUIRE( db.get_state_digest() != before );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( modify_fields ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< account_index >();
+      db.add_secondary_index< state_hash< account_index > >();
+
+      for( int i = 0; i < 10; ++i )
+         db.create< account >( [&]( account& a ) { a.name = "account " + std::to_string( i ); a.balance = i; } );
+      const auto digest = db.get_state_digest();
+
+      {
+         auto session = db.start_undo_session( true );
+         for( int i = 0; i < 10; ++i )
+            db.modify_fields( db.get( account::id_type(i) ), []( account& a ) { a.balance += 100; } );
+         BOOST_REQUIRE_EQUAL( db.get( account::id_type(3) ).balance, 103 );
+         BOOST_REQUIRE_EQUAL( ( db.get< account, by_name >( "account 3" ).balance ), 103 );
+         BOOST_REQUIRE_EQUAL( db.get_index< account_index >().counters().modifies, 10u );
+         BOOST_REQUIRE( db.get_state_digest() != digest );
+      }
+      BOOST_REQUIRE_EQUAL( db.get( account::id_type(3) ).balance, 3 );
+      BOOST_REQUIRE( db.get_state_digest() == digest );
+
+#ifndef NDEBUG
+      /// changing a key is caught and the object left as it was
+      const auto& a = db.get( account::id_type(4) );
+      BOOST_REQUIRE_THROW( db.modify_fields( a, []( account& a ) { a.name = "renamed"; a.balance = -1; } ), std::logic_error );
+      BOOST_REQUIRE_EQUAL( a.name.str(), "account 4" );
+      BOOST_REQUIRE_EQUAL( a.balance, 4 );
+      BOOST_REQUIRE( ( db.find< account, by_name >( "account 4" ) ) );
+      BOOST_REQUIRE( db.get_state_digest() == digest );
+#endif
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( undo_arenas ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >();
+
+      for( int i = 0; i < 1000; ++i )
+         db.create< book >( [&]( book& b ) { b.a = i; b.b = i; } );
+      db.start_undo_session( true ).undo(); // the undo stack keeps its first block
+      const auto free_before = db.get_free_memory();
+
+      /// each revision's undo records come from its own arena, given back whole by undo and squash
+      auto modify_range = [&]( int first, int count ) {
+         for( int i = first; i < first + count; ++i )
+            db.modify( db.get( book::id_type(i) ), []( book& b ) { ++b.b; } );
+      };
+      {
+         auto first = db.start_undo_session( true );
+         modify_range( 0, 500 );
+         first.push();
+         auto second = db.start_undo_session( true );
+         modify_range( 250, 500 );
+         second.push();
+
+         auto stats  = db.get_statistics();
+         auto levels = stats[ book::type_id ].undo_levels;
+         BOOST_REQUIRE_EQUAL( levels.size(), 2u );
+         BOOST_REQUIRE_GE( levels[0].arena_bytes, 500 * sizeof(book) );
+         BOOST_REQUIRE_GE( levels[1].arena_bytes, 500 * sizeof(book) );
+         BOOST_REQUIRE_LT( db.get_free_memory(), free_before );
+
+         db.squash();
+         stats  = db.get_statistics();
+         levels = stats[ book::type_id ].undo_levels;
+         BOOST_REQUIRE_EQUAL( levels.size(), 1u );
+         BOOST_REQUIRE_EQUAL( levels[0].old_values, 750u );
+         db.undo();
+      }
+      BOOST_REQUIRE_EQUAL( db.get_free_memory(), free_before );
+      for( int i = 0; i < 1000; ++i )
+         BOOST_REQUIRE_EQUAL( db.get( book::id_type(i) ).b, i );
+
+      /// packing a level hands its arena back
+      db.get_mutable_index< book_index >().set_undo_pack_depth( 1 );
+      {
+         auto first = db.start_undo_session( true );
+         modify_range( 0, 100 );
+         first.push();
+         auto second = db.start_undo_session( true );
+         modify_range( 100, 100 );
+         second.push();
+
+         auto stats = db.get_statistics();
+         const auto& levels = stats[ book::type_id ].undo_levels;
+         BOOST_REQUIRE_NE( levels[0].packed_bytes, 0u );
+         BOOST_REQUIRE_EQUAL( levels[0].arena_bytes, 0u );
+         BOOST_REQUIRE_NE( levels[1].arena_bytes, 0u );
+      }
+      db.commit( db.revision() );
+      BOOST_REQUIRE( db.get_statistics()[ book::type_id ].undo_levels.empty() );
+      BOOST_REQUIRE_EQUAL( db.get( book::id_type(150) ).b, 151 );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( find_many ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< account_index >();
+      BOOST_REQUIRE( ( db.find_many< account, by_name >( vector<std::string>( 3, "missing" ) ) ) == vector<const account*>( 3, nullptr ) );
+
+      for( int i = 0; i < 2000; ++i )
+         db.create< account >( [&]( account& a ) { a.name = "account " + std::to_string( 2 * i ); } );
+
+      std::mt19937 gen( 7 );
+      vector<std::string> names;
+      for( int i = 0; i < 300; ++i )
+         names.push_back( "account " + std::to_string( gen() % 4000 ) );
+      names.push_back( names.front() );
+      names.push_back( "" );
+
+      /// results come back in input order and match find(), for any number of descents in flight
+      for( size_t group : { size_t(1), size_t(16), size_t(1000) } ) {
+         auto accounts = db.find_many< account, by_name >( names, group );
+         BOOST_REQUIRE_EQUAL( accounts.size(), names.size() );
+         for( size_t i = 0; i < names.size(); ++i )
+            BOOST_REQUIRE_EQUAL( accounts[i], ( db.find< account, by_name >( names[i] ) ) );
+      }
+      BOOST_REQUIRE( ( db.find_many< account, by_name >( vector<std::string>() ).empty() ) );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( snapshots ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   boost::filesystem::path copy = boost::filesystem::unique_path();
+   try {
+      segment_options own;
+      own.size = 1024*1024*4;
+
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >( own );
+      db.add_index< account_index >();
+      for( int i = 0; i < 100; ++i ) {
+         db.create< book >( [&]( book& b ) { b.a = i; } );
+         db.create< account >( [&]( account& a ) { a.name = "account " + std::to_string( i ); a.balance = i; } );
+      }
+      auto session = db.start_undo_session( true );
+      db.modify( db.get( book::id_type(1) ), []( book& b ) { b.a = -1; } );
+      session.push();
+
+      BOOST_REQUIRE_THROW( db.snapshot( temp ), std::logic_error );
+
+      /// without reflinks nothing is copied under the lock unless asked for
+      try {
+         BOOST_REQUIRE( db.snapshot( copy ).cloned );
+      } catch( const std::runtime_error& ) {
+         BOOST_REQUIRE( bfs::is_empty( copy ) );
+      }
+      bfs::remove_all( copy );
+
+      db.enable_checksums( 64*1024 );
+      snapshot_options allow_copy;
+      allow_copy.allow_copy = true;
+      auto result = db.snapshot( copy, allow_copy );
+      BOOST_REQUIRE_EQUAL( result.revision, db.revision() );
+      BOOST_REQUIRE_EQUAL( result.files, 6u ); /// each segment with its checksums and write marks
+      BOOST_REQUIRE_GE( result.bytes, 1024*1024*12u );
+      BOOST_REQUIRE_LE( result.pause_ns, uint64_t( 60e9 ) );
+      BOOST_REQUIRE( bfs::exists( copy / "shared_memory.sums" ) );
+      BOOST_REQUIRE( bfs::exists( copy / "index-0.sums" ) );
+
+      /// later changes do not reach the snapshot
+      db.modify( db.get( book::id_type(2) ), []( book& b ) { b.a = -2; } );
+      db.remove( db.get( account::id_type(3) ) );
+
+      {
+         chainbase::database snapshot;
+         snapshot.open( copy, database::read_only );
+         snapshot.add_index< book_index >( own );
+         snapshot.add_index< account_index >();
+         BOOST_REQUIRE_EQUAL( snapshot.revision(), result.revision );
+         BOOST_REQUIRE_EQUAL( snapshot.get( book::id_type(1) ).a, -1 );
+         BOOST_REQUIRE_EQUAL( snapshot.get( book::id_type(2) ).a, 2 );
+         BOOST_REQUIRE_EQUAL( snapshot.get( account::id_type(3) ).name.str(), "account 3" );
+      }
+
+      /// the snapshot is a database of its own, with the undo history it was taken with
+      {
+         chainbase::database restored;
+         restored.open( copy, database::read_write );
+         restored.add_index< book_index >( own );
+         restored.add_index< account_index >();
+         /// the checksums were taken with the snapshot, nothing was written after them
+         BOOST_REQUIRE( restored.checksums_enabled() );
+         BOOST_REQUIRE( restored.get_integrity_report().changed.empty() );
+         restored.undo();
+         BOOST_REQUIRE_EQUAL( restored.get( book::id_type(1) ).a, 1 );
+      }
+      BOOST_REQUIRE_EQUAL( db.get( book::id_type(1) ).a, -1 );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      bfs::remove_all( copy );
+      throw;
+   }
+   bfs::remove_all( temp );
+   bfs::remove_all( copy );
+}
+
+BOOST_AUTO_TEST_CASE( squash_to_revision ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >();
+
+      for( int i = 0; i < 100; ++i )
+         db.create< book >( [&]( book& b ) { b.a = i; b.b = i; } );
+
+      auto contents = [&]() {
+         std::map<int64_t, std::pair<int, int>> result;
+         for( const auto& b : db.get_index< book_index >().indices() )
+            result[ b.id._id ] = { b.a, b.b };
+         return result;
+      };
+
+      /// many small revisions that modify, remove and create overlapping objects
+      std::mt19937 gen( 11 );
+      vector<std::map<int64_t, std::pair<int, int>>> before;
+      const auto start = db.revision();
+      for( int r = 0; r < 20; ++r ) {
+         before.push_back( contents() );
+         auto session = db.start_undo_session( true );
+         for( int i = 0; i < 30; ++i ) {
+            const auto& idx = db.get_index< book_index >().indices();
+            auto itr = idx.lower_bound( book::id_type( gen() % 120 ) );
+            if( itr == idx.end() ) itr = idx.begin();
+            const auto& b = *itr;
+            switch( gen() % 3 ) {
+               case 0:  db.modify( b, [&]( book& b ) { b.b = int( gen() % 1000 ); } ); break;
+               case 1:  if( idx.size() > 50 ) db.remove( b ); break;
+               default: db.create< book >( [&]( book& b ) { b.a = r; } );
+            }
+         }
+         session.push();
+      }
+
+      BOOST_REQUIRE_THROW( db.squash_to( start ), std::logic_error );
+      db.squash_to( start + 5 );
+      BOOST_REQUIRE_EQUAL( db.revision(), start + 5 );
+      BOOST_REQUIRE_EQUAL( db.get_statistics()[ book::type_id ].undo_levels.size(), 5u );
+      db.squash_to( start + 7 ); // no newer revisions, nothing to do
+      BOOST_REQUIRE_EQUAL( db.revision(), start + 5 );
+
+      db.undo();
+      BOOST_REQUIRE( contents() == before[4] );
+      db.undo();
+      BOOST_REQUIRE( contents() == before[3] );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( workload_trace ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >();
+      db.add_index< account_index >();
+
+      const auto& before = db.create< book >( []( book& b ) { b.a = 1; } ); /// not traced
+      BOOST_REQUIRE( !db.is_tracing() );
+      db.start_trace( temp / "workload.trace" );
+      BOOST_REQUIRE( db.is_tracing() );
+      {
+         auto outer = db.start_undo_session( true );
+         const auto& created = db.create< account >( []( account& a ) { a.name = "alice"; } );
+         {
+            auto inner = db.start_undo_session( true );
+            db.modify( before, []( book& b ) { b.a = 2; } );
+            db.find< account, by_name >( "alice" );
+            db.find< book >( book::id_type( 7 ) );
+            db.get< book >( before.id );
+         } /// undone by its destructor
+         auto moved = std::move( outer );
+         db.remove( created );
+         moved.push();
+      }
+      db.commit( db.revision() );
+      db.stop_trace();
+      db.create< book >( []( book& ) {} );
+
+      trace_reader trace( temp / "workload.trace" );
+      vector<trace_record> records;
+      trace_record r;
+      while( trace.next( r ) ) records.push_back( r );
+
+      const vector<trace_op> ops = { trace_op::start_session, trace_op::create, trace_op::start_session, trace_op::modify,
+                                     trace_op::find, trace_op::find, trace_op::get, trace_op::session_undo,
+                                     trace_op::remove, trace_op::session_push, trace_op::commit };
+      BOOST_REQUIRE_EQUAL( records.size(), ops.size() );
+      for( size_t i = 0; i < ops.size(); ++i )
+         BOOST_REQUIRE( records[i].op == ops[i] );
+
+      BOOST_REQUIRE_EQUAL( records[0].value, 1 );
+      BOOST_REQUIRE_EQUAL( records[1].type_id, uint16_t( account::type_id ) );
+      BOOST_REQUIRE_EQUAL( records[1].id, 0 );
+      BOOST_REQUIRE_EQUAL( records[1].value, int64_t( sizeof(account) ) );
+      BOOST_REQUIRE_EQUAL( records[3].type_id, uint16_t( book::type_id ) );
+      BOOST_REQUIRE_EQUAL( records[3].id, before.id._id );
+      BOOST_REQUIRE_EQUAL( records[4].type_id, uint16_t( account::type_id ) );
+      BOOST_REQUIRE_EQUAL( records[4].id, 0 );
+      BOOST_REQUIRE_EQUAL( records[4].value, 1 ); /// by name
+      BOOST_REQUIRE_EQUAL( records[5].id, -1 );   /// not found
+      BOOST_REQUIRE_EQUAL( records[5].value, 0 );
+      BOOST_REQUIRE_EQUAL( records[6].id, before.id._id );
+      BOOST_REQUIRE_EQUAL( records[8].id, 0 );
+      BOOST_REQUIRE_EQUAL( records[10].value, 0 );
+
+      /// reading again gives the same records
+      trace.reset();
+      for( const auto& expected : records ) {
+         BOOST_REQUIRE( trace.next( r ) );
+         BOOST_REQUIRE( r.op == expected.op && r.id == expected.id && r.value == expected.value );
+      }
+      BOOST_REQUIRE( !trace.next( r ) );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( segment_checksums ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      {
+         chainbase::database db;
+         db.open( temp, database::read_write, 1024*1024*8 );
+         db.add_index< book_index >();
+         segment_options own;
+         own.size = 1024*1024;
+         db.add_index< account_index >( own );
+         for( int i = 0; i < 20000; ++i )
+            db.create< book >( [&]( book& b ) { b.a = i; } );
+         db.create< account >( []( account& a ) { a.name = "alice"; } );
+         BOOST_REQUIRE( !db.checksums_enabled() );
+         db.enable_checksums( 64*1024 );
+         BOOST_REQUIRE( db.checksums_enabled() );
+         BOOST_REQUIRE( bfs::exists( temp / "shared_memory.sums" ) );
+         BOOST_REQUIRE( bfs::exists( temp / "index-1.sums" ) );
+         BOOST_REQUIRE( bfs::exists( temp / "index-1.dirty" ) );
+         BOOST_REQUIRE_THROW( db.enable_checksums( 1000 ), std::logic_error );
+      }
+
+      /// closed cleanly, nothing to check
+      {
+         chainbase::database db;
+         db.open( temp, database::read_write );
+         BOOST_REQUIRE( db.checksums_enabled() );
+         BOOST_REQUIRE( !db.get_integrity_report().verified );
+      }
+
+      /// a process that changes one object and dies without closing the database
+      pid_t child = fork();
+      if( child == 0 ) {
+         chainbase::database db;
+         db.open( temp, database::read_write );
+         db.add_index< book_index >();
+         db.add_index< account_index >( segment_options() );
+         db.modify( db.get( book::id_type( 15000 ) ), []( book& b ) { b.b = 42; } );
+         _exit( 0 );
+      }
+      int status = 0;
+      waitpid( child, &status, 0 );
+      BOOST_REQUIRE( WIFEXITED( status ) && WEXITSTATUS( status ) == 0 );
+
+      {
+         chainbase::database db;
+         db.open( temp, database::read_write );
+         db.add_index< book_index >();
+         db.add_index< account_index >( segment_options() );
+
+         auto report = db.get_integrity_report();
+         BOOST_REQUIRE( report.verified );
+         /// only the regions the child wrote are checked
+         BOOST_REQUIRE( report.regions >= report.changed.size() );
+         BOOST_REQUIRE( report.regions <= 16 );
+         BOOST_REQUIRE_EQUAL( report.bytes, report.regions * 64*1024 );
+         BOOST_REQUIRE( !report.changed.empty() );
+         BOOST_REQUIRE( report.changed.size() <= 8 ); /// the object, the tree nodes rebalanced around it and the table header
+         for( const auto& region : report.changed )
+            BOOST_REQUIRE( region.file.filename() == "shared_memory.bin" );
+         BOOST_REQUIRE_EQUAL( report.affected_indices.size(), 1u );
+         BOOST_REQUIRE_EQUAL( report.affected_indices[0], "book" );
+         BOOST_REQUIRE_EQUAL( db.get( book::id_type( 15000 ) ).b, 42 );
+
+         db.flush(); /// takes new checksums, later changes are what a check would find
+
+         /// writes after the flush are tracked again and the data is unchanged by the tracking
+         db.compact();
+         db.modify( db.get( book::id_type( 15000 ) ), []( book& b ) { b.b = 43; } );
+         BOOST_REQUIRE_EQUAL( db.get( book::id_type( 15000 ) ).b, 43 );
+      }
+
+      {
+         chainbase::database db;
+         db.open( temp, database::read_write );
+         BOOST_REQUIRE( !db.get_integrity_report().verified );
+         db.wipe( temp );
+         BOOST_REQUIRE( !bfs::exists( temp / "shared_memory.sums" ) );
+         BOOST_REQUIRE( !bfs::exists( temp / "index-1.sums" ) );
+         BOOST_REQUIRE( !bfs::exists( temp / "shared_memory.dirty" ) );
+      }
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( incremental_hash_index ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*64 );
+      db.add_index< book_by_a_b_index >();
+
+      auto& idx = db.get_mutable_index< book_by_a_b_index >();
+      for( int i = 0; i < 5000; ++i )
+         idx.emplace( [&]( book& b ) { b.a = i; b.b = i % 3000; } );
+
+      auto consistent = [&]( const book_hashed_by_b& by_b ) {
+         std::map<int, size_t> expected;
+         for( const auto& b : db.get_index< book_by_a_b_index >().indices() ) ++expected[ b.b ];
+         for( const auto& e : expected )
+            if( by_b.count( e.first ) != e.second || by_b.find( e.first )->b != e.first ) return false;
+         return by_b.size() == idx.indices().size();
+      };
+
+      {
+         auto& by_b = db.add_secondary_index< book_hashed_by_b >();
+         BOOST_REQUIRE( by_b.rebuilt_on_attach() );
+         BOOST_REQUIRE_EQUAL( by_b.bucket_count(), 8192u ); /// sized up front by the rebuild
+         BOOST_REQUIRE( consistent( by_b ) );
+         BOOST_REQUIRE_EQUAL( by_b.find( 5 )->id._id, 5 );
+         BOOST_REQUIRE_EQUAL( by_b.count( 5 ), 2u );
+         BOOST_REQUIRE( by_b.find( 4000 ) == nullptr );
+
+         /// growing splits at most one bucket per insert
+         for( int i = 0; i < 50000; ++i ) {
+            const auto buckets = by_b.bucket_count();
+            idx.emplace( [&]( book& b ) { b.b = 10000 + i; } );
+            BOOST_REQUIRE( by_b.bucket_count() - buckets <= 1 );
+            BOOST_REQUIRE( by_b.load_factor() <= book_hashed_by_b::max_load_factor );
+         }
+         BOOST_REQUIRE_EQUAL( by_b.bucket_count(), 55000u );
+         BOOST_REQUIRE( consistent( by_b ) );
+
+         /// maintained through changes and undo, including the splits made by the undone inserts
+         auto session = db.start_undo_session( true );
+         idx.modify( idx.get( book::id_type(0) ), []( book& b ) { b.b = -1; } );
+         idx.remove( idx.get( book::id_type(1) ) );
+         for( int i = 0; i < 20000; ++i )
+            idx.emplace( [&]( book& b ) { b.b = -2; } );
+         BOOST_REQUIRE_EQUAL( by_b.find( -1 )->id._id, 0 );
+         BOOST_REQUIRE_EQUAL( by_b.count( -2 ), 20000u );
+         BOOST_REQUIRE_EQUAL( by_b.find( 1 )->id._id, 3001 );
+         BOOST_REQUIRE( consistent( by_b ) );
+         session.undo();
+         BOOST_REQUIRE( by_b.find( -1 ) == nullptr );
+         BOOST_REQUIRE_EQUAL( by_b.count( -2 ), 0u );
+         BOOST_REQUIRE_EQUAL( by_b.find( 1 )->id._id, 1 );
+         BOOST_REQUIRE( consistent( by_b ) );
+      }
+
+      /// reattaching an up to date index does not rebuild it, changes made while detached are detected
+      db.close();
+      db.open( temp, database::read_write );
+      db.add_index< book_by_a_b_index >();
+      BOOST_REQUIRE( !db.add_secondary_index< book_hashed_by_b >().rebuilt_on_attach() );
+      db.close();
+      db.open( temp, database::read_write );
+      db.add_index< book_by_a_b_index >();
+      auto& reopened = db.get_mutable_index< book_by_a_b_index >();
+      reopened.modify( reopened.get( book::id_type(7) ), []( book& b ) { b.b = 7000; } );
+      auto& by_b = db.add_secondary_index< book_hashed_by_b >();
+      BOOST_REQUIRE( by_b.rebuilt_on_attach() );
+      BOOST_REQUIRE_EQUAL( by_b.find( 7000 )->id._id, 7 );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( batched_reads ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >();
+      for( int i = 0; i < 1000; ++i )
+         db.create< book >( [&]( book& b ) { b.a = i; } );
+
+      {
+         read_executor_options options;
+         options.threads = 2;
+         options.max_batch_size = 64;
+         read_executor reads( db, options );
+
+         vector<std::future<int>> results;
+         for( int i = 0; i < 1000; ++i )
+            results.push_back( reads.submit( [&db, i]() { return db.get( book::id_type( i ) ).a; } ) );
+         auto missing = reads.submit( [&]() { return db.get( book::id_type( 5000 ) ).a; } );
+         auto nothing = reads.submit( [&]() {} );
+
+         for( int i = 0; i < 1000; ++i )
+            BOOST_REQUIRE_EQUAL( results[i].get(), i );
+         BOOST_REQUIRE_THROW( missing.get(), std::out_of_range );
+         nothing.get();
+
+         auto stats = reads.get_stats();
+         BOOST_REQUIRE_EQUAL( stats.reads, 1002u );
+         BOOST_REQUIRE( stats.batches < stats.reads / 4 );
+      }
+
+      /// a batch lets a waiting writer in between two reads
+      {
+         read_executor_options options;
+         options.threads = 1;
+         options.max_batch_latency_micro = 100000;
+         options.max_hold_micro = 10000000;
+         read_executor reads( db, options );
+
+         std::atomic<bool> started( false );
+         std::atomic<int>  ran( 0 );
+         vector<std::future<void>> results;
+         for( int i = 0; i < 50; ++i )
+            results.push_back( reads.submit( [&]() {
+               started = true;
+               std::this_thread::sleep_for( std::chrono::milliseconds( 2 ) );
+               ++ran;
+            }));
+
+         while( !started ) std::this_thread::yield();
+         int ran_before_write = db.with_write_lock( [&]() { return ran.load(); } );
+         for( auto& r : results ) r.get();
+
+         BOOST_REQUIRE( ran_before_write < 50 );
+         BOOST_REQUIRE( reads.get_stats().yielded >= 1 );
+      }
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}
+
+BOOST_AUTO_TEST_CASE( in_place_undo ) {
+   boost::filesystem::path temp = boost::filesystem::unique_path();
+   try {
+      chainbase::database db;
+      db.open( temp, database::read_write, 1024*1024*8 );
+      db.add_index< book_index >();
+      db.add_index< account_index >();
+      for( int i = 0; i < 100; ++i )
+         db.create< book >( [&]( book& b ) { b.a = i; b.b = i; } );
+      db.create< account >( []( account& a ) { a.name = "alice"; a.balance = 1; } );
+
+      const auto& books = db.get_index< book_index >();
+      {
+         auto session = db.start_undo_session( true );
+         for( int i = 0; i < 100; ++i ) {
+            const auto& b = db.get( book::id_type( i ) );
+            if( i % 2 ) {
+               /// keys end up where they were, undo copies the saved value back in place
+               db.modify( b, []( book& v ) { v.a += 1000; } );
+               db.modify( b, []( book& v ) { v.a -= 1000; } );
+            } else {
+               db.modify( b, [&]( book& v ) { v.a = 1000 - i; v.b = -i; } );
+            }
+         }
+         db.modify( db.get( account::id_type( 0 ) ), []( account& a ) { a.balance = 2; } );
+      }
+
+      BOOST_REQUIRE_EQUAL( books.counters().in_place_restores, 50u );
+      BOOST_REQUIRE_EQUAL( db.get_index< account_index >().counters().in_place_restores, 0u );
+      BOOST_REQUIRE_EQUAL( db.get( account::id_type( 0 ) ).balance, 1 );
+
+      int i = 0;
+      for( const auto& b : books.indices().get<1>() ) {
+         BOOST_REQUIRE_EQUAL( b.a, i );
+         BOOST_REQUIRE_EQUAL( b.b, i );
+         BOOST_REQUIRE_EQUAL( b.id._id, i );
+         ++i;
+      }
+      BOOST_REQUIRE_EQUAL( i, 100 );
+      BOOST_REQUIRE_EQUAL( books.indices().get<2>().begin()->b, 0 );
+      BOOST_REQUIRE_EQUAL( books.indices().get<2>().rbegin()->b, 99 );
+   } catch ( ... ) {
+      bfs::remove_all( temp );
+      throw;
+   }
+   bfs::remove_all( temp );
+}